@@ -0,0 +1,274 @@
+﻿#include "kdl.hxx"
+#include "corpus.hxx"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <variant>
+#include <vector>
+
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// Runs each scenario in a child process, so that peak RSS is its own, and
+// prints one JSON object per scenario (JSON Lines) to stdout.
+//
+// Usage: kdl_bench [--runs N] [--iterations N] [--file PATH | corpus options]
+// Without --file or corpus options, a fixed set of scenarios is run.
+
+namespace {
+
+using clock_type = std::chrono::steady_clock;
+
+struct scenario {
+	char const* name;
+	kdl_bench::corpus_options corpus;
+	char const* file = nullptr;
+};
+
+struct settings {
+	size_t runs = 10;
+	size_t iterations = 1000000;
+};
+
+// Calls into the library are opaque to the optimizer, but results are still
+// folded into here so that nothing is discarded.
+uint64_t volatile g_sink;
+
+double elapsed_ns(clock_type::time_point begin, clock_type::time_point end) {
+	return std::chrono::duration<double, std::nano>(end - begin).count();
+}
+
+double median(std::vector<double> samples) {
+	std::sort(samples.begin(), samples.end());
+	size_t mid = samples.size() / 2;
+	return samples.size() % 2 ? samples[mid] : (samples[mid - 1] + samples[mid]) / 2;
+}
+
+size_t resident_kib() {
+	long pages = 0;
+	if (FILE* statm = std::fopen("/proc/self/statm", "r")) {
+		std::fscanf(statm, "%*s %ld", &pages);
+		std::fclose(statm);
+	}
+	return static_cast<size_t>(pages) * static_cast<size_t>(sysconf(_SC_PAGESIZE)) / 1024;
+}
+
+size_t peak_rss_kib() {
+	rusage usage{};
+	getrusage(RUSAGE_SELF, &usage);
+	return static_cast<size_t>(usage.ru_maxrss);
+}
+
+std::u8string read_file(char const* path) {
+	std::ifstream in(path, std::ios::binary);
+	std::string bytes((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+	return std::u8string(bytes.begin(), bytes.end());
+}
+
+kdl::document_ptr parse(std::u8string_view source) {
+	auto result = kdl::document::parse(source);
+	if (auto* err = std::get_if<kdl::error_ptr>(&result)) {
+		auto label = (*err)->label();
+		std::fprintf(stderr, "kdl_bench: parse failed at byte %zu: %.*s\n",
+			static_cast<size_t>((*err)->span().data() - (*err)->input().data()),
+			static_cast<int>(label.size()), reinterpret_cast<char const*>(label.data()));
+		std::_Exit(1);
+	}
+	return std::move(std::get<kdl::document_ptr>(result));
+}
+
+void walk(kdl::document const& document, uint64_t& items) {
+	for (auto const& node : document) {
+		++items;
+		for (auto const& entry : node) {
+			items += entry.value() != nullptr;
+		}
+		if (auto children = node.children()) {
+			walk(*children, items);
+		}
+	}
+}
+
+void walk(kdl::flat_range<kdl::flat_node> nodes, uint64_t& items) {
+	for (auto node : nodes) {
+		++items;
+		for (auto entry : node) {
+			items += entry.which() != 0xFF;
+		}
+		walk(node.children(), items);
+	}
+}
+
+/// @brief Times `iterations` calls of `f(i)`, returning nanoseconds per call.
+template<typename F>
+double per_call(size_t iterations, F&& f) {
+	uint64_t sink = 0;
+	auto begin = clock_type::now();
+	for (size_t i = 0; i < iterations; ++i) {
+		sink += f(i);
+	}
+	auto end = clock_type::now();
+	g_sink = sink;
+	return elapsed_ns(begin, end) / static_cast<double>(iterations);
+}
+
+void run(scenario const& s, settings const& settings) {
+	std::u8string source = s.file ? read_file(s.file) : kdl_bench::generate(s.corpus);
+	size_t baseline_kib = resident_kib();
+
+	std::vector<double> parse_ns;
+	std::vector<double> free_ns;
+	for (size_t r = 0; r < settings.runs; ++r) {
+		auto t0 = clock_type::now();
+		auto document = parse(source);
+		auto t1 = clock_type::now();
+		document.reset();
+		auto t2 = clock_type::now();
+		parse_ns.push_back(elapsed_ns(t0, t1));
+		free_ns.push_back(elapsed_ns(t1, t2));
+	}
+
+	auto document = parse(source);
+	size_t live_kib = resident_kib();
+	size_t retained_kib = live_kib > baseline_kib ? live_kib - baseline_kib : 0;
+
+	std::vector<kdl::node const*> nodes;
+	std::vector<kdl::value const*> values;
+	for (auto const& node : *document) {
+		nodes.push_back(&node);
+		for (auto const& entry : node) {
+			values.push_back(entry.value());
+		}
+	}
+
+	std::array<std::u8string_view, kdl_bench::node_names.size()> node_names;
+	std::transform(kdl_bench::node_names.begin(), kdl_bench::node_names.end(), node_names.begin(), [](std::string_view name) {
+		return std::u8string_view(reinterpret_cast<char8_t const*>(name.data()), name.size());
+	});
+	std::array<std::u8string_view, kdl_bench::prop_names.size()> prop_names;
+	std::transform(kdl_bench::prop_names.begin(), kdl_bench::prop_names.end(), prop_names.begin(), [](std::string_view name) {
+		return std::u8string_view(reinterpret_cast<char8_t const*>(name.data()), name.size());
+	});
+
+	double document_get = per_call(settings.iterations, [&](size_t i) {
+		return document->get(node_names[i % node_names.size()]) != nullptr;
+	});
+	double node_get_prop = nodes.empty() ? 0 : per_call(settings.iterations, [&](size_t i) {
+		return nodes[i % nodes.size()]->get(prop_names[i % prop_names.size()]) != nullptr;
+	});
+	double value_which = values.empty() ? 0 : per_call(settings.iterations, [&](size_t i) {
+		return values[i % values.size()]->which().index();
+	});
+
+	uint64_t items = 0;
+	auto t0 = clock_type::now();
+	walk(*document, items);
+	auto t1 = clock_type::now();
+	g_sink = items;
+	double iterate = items ? elapsed_ns(t0, t1) / static_cast<double>(items) : 0;
+
+	auto flat = document->flatten();
+	items = 0;
+	t0 = clock_type::now();
+	walk(flat->roots(), items);
+	t1 = clock_type::now();
+	g_sink = items;
+	double flat_iterate = items ? elapsed_ns(t0, t1) / static_cast<double>(items) : 0;
+
+	double parse_median = median(parse_ns);
+	auto const& c = s.corpus;
+	std::printf(
+		"{\"scenario\":\"%s\","
+		"\"corpus\":{\"file\":%s%s%s,\"nodes\":%zu,\"depth\":%zu,\"fanout\":%zu,\"entries\":%zu,\"escapes\":%g,\"numeric\":%g,\"seed\":%llu,\"bytes\":%zu},"
+		"\"parse\":{\"runs\":%zu,\"median_ns\":%.0f,\"min_ns\":%.0f,\"mb_per_s\":%.2f},"
+		"\"free\":{\"median_ns\":%.0f},"
+		"\"memory\":{\"retained_kib\":%zu,\"peak_rss_kib\":%zu},"
+		"\"latency_ns\":{\"document_get\":%.2f,\"node_get_prop\":%.2f,\"value_which\":%.2f,\"iterate\":%.2f,\"flat_iterate\":%.2f}}\n",
+		s.name,
+		s.file ? "\"" : "", s.file ? s.file : "null", s.file ? "\"" : "",
+		c.nodes, c.depth, c.fanout, c.entries, c.escapes, c.numeric, static_cast<unsigned long long>(c.seed), source.size(),
+		settings.runs, parse_median, *std::min_element(parse_ns.begin(), parse_ns.end()),
+		static_cast<double>(source.size()) / (parse_median / 1e9) / 1e6,
+		median(free_ns),
+		retained_kib, peak_rss_kib(),
+		document_get, node_get_prop, value_which, iterate, flat_iterate);
+	std::fflush(stdout);
+}
+
+std::vector<scenario> default_scenarios() {
+	std::vector<scenario> scenarios;
+	scenarios.push_back({ "baseline", {} });
+	scenarios.push_back({ "flat", {} });
+	scenarios.back().corpus.depth = 1;
+	scenarios.push_back({ "deep", {} });
+	scenarios.back().corpus.depth = 12;
+	scenarios.back().corpus.fanout = 2;
+	scenarios.push_back({ "wide", {} });
+	scenarios.back().corpus.entries = 32;
+	scenarios.push_back({ "escapes", {} });
+	scenarios.back().corpus.escapes = 1.0;
+	scenarios.back().corpus.numeric = 0.0;
+	scenarios.push_back({ "numeric", {} });
+	scenarios.back().corpus.numeric = 1.0;
+	scenarios.push_back({ "large", {} });
+	scenarios.back().corpus.nodes = 200000;
+	return scenarios;
+}
+
+}
+
+int main(int argc, char** argv) {
+	settings settings;
+	scenario custom{ "custom", {} };
+	bool is_custom = false;
+	for (int i = 1; i < argc; i += 2) {
+		std::string_view name = argv[i];
+		if (i + 1 == argc) {
+			std::fprintf(stderr, "kdl_bench: option %s needs a value\n", argv[i]);
+			return 2;
+		}
+		if (name == "--runs") {
+			settings.runs = std::max<size_t>(1, std::stoul(argv[i + 1]));
+		}
+		else if (name == "--iterations") {
+			settings.iterations = std::max<size_t>(1, std::stoul(argv[i + 1]));
+		}
+		else if (name == "--file") {
+			custom.name = "file";
+			custom.file = argv[i + 1];
+			is_custom = true;
+		}
+		else if (kdl_bench::set_option(custom.corpus, name, argv[i + 1])) {
+			is_custom = true;
+		}
+		else {
+			std::fprintf(stderr, "kdl_bench: unknown option %s\n", argv[i]);
+			return 2;
+		}
+	}
+
+	auto scenarios = is_custom ? std::vector<scenario>{ custom } : default_scenarios();
+	int status = 0;
+	for (auto const& s : scenarios) {
+		pid_t child = fork();
+		if (child == 0) {
+			run(s, settings);
+			std::_Exit(0);
+		}
+		int child_status = 0;
+		if (child < 0 || waitpid(child, &child_status, 0) < 0 || !WIFEXITED(child_status) || WEXITSTATUS(child_status)) {
+			std::fprintf(stderr, "kdl_bench: scenario %s failed\n", s.name);
+			status = 1;
+		}
+	}
+	return status;
+}
@@ -0,0 +1,19 @@
+﻿#include "corpus.hxx"
+
+#include <cstdio>
+#include <string_view>
+
+// Writes a synthetic document to stdout, for benchmarking other tools on the
+// same inputs. Usage: kdl_corpus [--nodes N] [--depth N] [--fanout N]
+// [--entries N] [--escapes P] [--numeric P] [--seed N]
+int main(int argc, char** argv) {
+	kdl_bench::corpus_options options;
+	for (int i = 1; i < argc; i += 2) {
+		if (i + 1 == argc || !kdl_bench::set_option(options, argv[i], argv[i + 1])) {
+			std::fprintf(stderr, "kdl_corpus: unknown or incomplete option %s\n", argv[i]);
+			return 2;
+		}
+	}
+	std::u8string corpus = kdl_bench::generate(options);
+	std::fwrite(corpus.data(), 1, corpus.size(), stdout);
+}
@@ -0,0 +1,176 @@
+﻿#ifndef KDL_BENCH_CORPUS_HXX
+#define KDL_BENCH_CORPUS_HXX
+
+#include <array>
+#include <charconv>
+#include <cstddef>
+#include <cstdint>
+#include <random>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+
+namespace kdl_bench {
+
+/// @brief Shape of a synthetic document.
+struct corpus_options {
+	/// @brief Total number of nodes, at every depth.
+	size_t nodes = 10000;
+	/// @brief Levels of nesting; 1 makes every node top-level.
+	size_t depth = 3;
+	/// @brief Children per node above the deepest level.
+	size_t fanout = 4;
+	/// @brief Entries per node, alternating arguments and properties.
+	size_t entries = 4;
+	/// @brief Fraction of strings containing escapes.
+	double escapes = 0.1;
+	/// @brief Fraction of values that are numbers rather than strings.
+	double numeric = 0.5;
+	uint64_t seed = 1;
+};
+
+/// @brief Node names are drawn from a small pool, so lookups by name can hit.
+inline constexpr std::array<std::string_view, 8> node_names = {
+	"server", "listen", "route", "upstream", "header", "limit", "log", "tls",
+};
+
+/// @brief Property names, in the order properties appear on a node.
+inline constexpr std::array<std::string_view, 8> prop_names = {
+	"name", "port", "weight", "timeout", "path", "level", "retries", "mode",
+};
+
+namespace detail {
+
+inline constexpr std::array<std::string_view, 8> words = {
+	"alpha", "bravo", "charlie", "delta", "echo", "foxtrot", "golf", "hotel",
+};
+
+inline constexpr std::array<std::string_view, 4> escapes = {
+	"\\n", "\\\"", "\\\\", "\\u{e9}",
+};
+
+class generator {
+public:
+	explicit generator(corpus_options const& options)
+		: m_options(options), m_rng(options.seed)
+	{}
+
+	std::u8string run() {
+		while (m_emitted < m_options.nodes) {
+			node(0);
+		}
+		return std::move(m_out);
+	}
+
+private:
+	void node(size_t level) {
+		++m_emitted;
+		indent(level);
+		append(node_names[m_rng() % node_names.size()]);
+		for (size_t i = 0; i < m_options.entries; ++i) {
+			m_out += u8' ';
+			if (i % 2) {
+				append(prop_names[(i / 2) % prop_names.size()]);
+				m_out += u8'=';
+			}
+			value();
+		}
+		if (level + 1 < m_options.depth && m_emitted < m_options.nodes) {
+			append(" {\n");
+			for (size_t i = 0; i < m_options.fanout && m_emitted < m_options.nodes; ++i) {
+				node(level + 1);
+			}
+			indent(level);
+			m_out += u8'}';
+		}
+		m_out += u8'\n';
+	}
+
+	void value() {
+		if (chance(m_options.numeric)) {
+			if (m_rng() % 2) {
+				number(static_cast<int64_t>(m_rng() % 2000000) - 1000000);
+			}
+			else {
+				number(static_cast<double>(m_rng() % 1000000) / 1024.0);
+			}
+			return;
+		}
+		m_out += u8'"';
+		size_t count = 1 + m_rng() % 3;
+		for (size_t i = 0; i < count; ++i) {
+			if (i) {
+				m_out += u8' ';
+			}
+			append(words[m_rng() % words.size()]);
+		}
+		if (chance(m_options.escapes)) {
+			append(escapes[m_rng() % escapes.size()]);
+		}
+		m_out += u8'"';
+	}
+
+	template<typename T>
+	void number(T n) {
+		char buffer[32];
+		auto result = std::to_chars(buffer, buffer + sizeof(buffer), n);
+		std::string_view digits(buffer, result.ptr - buffer);
+		append(digits);
+		if constexpr (std::is_floating_point_v<T>) {
+			if (digits.find_first_of(".e") == std::string_view::npos) {
+				append(".0");
+			}
+		}
+	}
+
+	bool chance(double p) {
+		return std::uniform_real_distribution<double>(0.0, 1.0)(m_rng) < p;
+	}
+
+	void indent(size_t level) {
+		m_out.append(level * 4, u8' ');
+	}
+
+	void append(std::string_view s) {
+		m_out.append(reinterpret_cast<char8_t const*>(s.data()), s.size());
+	}
+
+	corpus_options m_options;
+	std::mt19937_64 m_rng;
+	std::u8string m_out;
+	size_t m_emitted = 0;
+};
+
+} // namespace kdl_bench::detail
+
+/// @brief Applies a `--name value` command-line option.
+/// @return Whether `name` is a corpus option.
+inline bool set_option(corpus_options& options, std::string_view name, std::string_view value) {
+	auto parse = [&](auto& field) {
+		if constexpr (std::is_floating_point_v<std::remove_reference_t<decltype(field)>>) {
+			field = std::stod(std::string(value));
+		}
+		else {
+			std::from_chars(value.data(), value.data() + value.size(), field);
+		}
+		return true;
+	};
+	if (name == "--nodes") return parse(options.nodes);
+	if (name == "--depth") return parse(options.depth);
+	if (name == "--fanout") return parse(options.fanout);
+	if (name == "--entries") return parse(options.entries);
+	if (name == "--escapes") return parse(options.escapes);
+	if (name == "--numeric") return parse(options.numeric);
+	if (name == "--seed") return parse(options.seed);
+	return false;
+}
+
+/// @brief Generates a deterministic document of the given shape.
+inline std::u8string generate(corpus_options const& options) {
+	return detail::generator(options).run();
+}
+
+} // namespace kdl_bench
+
+#endif
@@ -143,11 +143,10 @@ foo bar=true "baz" quux=false 1 2 3
 		dump(*document);
 	}
 	catch (kdl::error_ptr& e) {
-		auto before = std::u8string_view(e->input().data(), e->span().data());
-		size_t line_no = std::ranges::count(before, '\n') + 1;
-		size_t col_no = before.length() - before.rfind('\n');
+		auto lines = kdl::line_index::create(e->input());
+		auto location = lines->locate(e->span().data() - e->input().data());
 		std::cout
-			<< "line " << line_no << ", column " << col_no << ": " << fix(e->label()) << "\n"
+			<< "line " << location.line << ", column " << location.column << ": " << fix(e->label()) << "\n"
 			<< "  help: " << fix(e->help())
 			;
 	}
@@ -5,7 +5,7 @@
 #include <stddef.h>
 #include <stdint.h>
 
-#if (defined(__STDC__) /*&& __STDC_VERSION_STDINT_H__ < 202301L*/) || \
+#if (defined(__STDC__) && !defined(__cplusplus) /*&& __STDC_VERSION_STDINT_H__ < 202301L*/) || \
 	(defined(__cplusplus) && __cpp_char8_t < 201811L) || \
 	(!defined(__STDC__) && !defined(__cplusplus))
 typedef unsigned char char8_t;
@@ -32,8 +32,8 @@ typedef unsigned char char8_t;
 #	define KDL_THIS_MUT
 #	define KDL_ARRAY(len)
 #	define KDL_ARRAY_B(len, stride)
-#	define KDL_NONNULL
-#	define KDL_NULLABLE                 __attribute__((__returns_nonnull__))
+#	define KDL_NONNULL                  __attribute__((__returns_nonnull__))
+#	define KDL_NULLABLE
 #	define KDL_OUTPTR_NONNULL
 #	define KDL_OUTPTR_NULLABLE
 #	define KDL_OUTPTR_ARRAY(len)
@@ -57,19 +57,46 @@ typedef unsigned char char8_t;
 #endif
 #pragma endregion
 
+/// @brief Bump allocator that documents can be parsed into.
+struct KDL_Arena;
 /// @brief Represents a KDL Document.
 struct KDL_Document;
+/// @brief Structure-of-arrays copy of a KDL Document.
+struct KDL_FlatDocument;
+/// @brief Hash index over the names in a KDL Document.
+struct KDL_DocumentIndex;
+/// @brief The nodes that differ between two KDL Documents.
+struct KDL_Diff;
+/// @brief A KDL Document whose children blocks are parsed on first access.
+struct KDL_LazyDocument;
+/// @brief A node of a lazy document.
+struct KDL_LazyNode;
 /// @brief Represents a KDL Argument or KDL Property.
 struct KDL_Entry;
 /// @brief Represents a KDL Identifier.
 struct KDL_Identifier;
 /// @brief Represents a KDL Node.
 struct KDL_Node;
+/// @brief A compiled path query over KDL Documents.
+struct KDL_Query;
 /// @brief Represents a KDL Value.
 struct KDL_Value;
 
 /// @brief An error that occurs when parsing a KDL document.
 struct KDL_Error;
+/// @brief Every error found in one pass over a document.
+struct KDL_ErrorList;
+/// @brief Line start offsets of a document, for locating byte offsets.
+struct KDL_LineIndex;
+
+/// @brief Incremental parser reporting a document as a stream of events.
+struct KDL_EventParser;
+/// @brief Streaming KDL serializer.
+struct KDL_Writer;
+
+/// @brief A name interned by a document index, compared and hashed as an integer.
+/// Symbols are nonzero; 0 names nothing. A symbol only means something to the index it came from.
+typedef uint32_t KDL_Symbol;
 
 enum KdlValueWhich {
 	KDL_VALUE_WHICH_NULL = 0x00,
@@ -89,13 +116,247 @@ enum KdlValueWhich {
 #define KDL_VALUE_IS_FLOAT(which)   ((which) & 0x40)
 #define KDL_VALUE_IS_BOOL(which)    ((which) & 0x80)
 
+/// @brief A single result of running a query.
+struct KDL_QueryMatch {
+	/// @brief The node matched by the last path segment.
+	struct KDL_Node const* node;
+	/// @brief The argument or property selected from the node, if the query ends in one.
+	struct KDL_Entry const* entry;
+	/// @brief The value of `entry`, if any.
+	struct KDL_Value const* value;
+};
+
+/// @brief Version of the layouts of the `KDL_Flat*` structs, which may be read in place.
+/// Functions handing them out carry the version in their symbol names, so a header and
+/// library that disagree fail to link rather than misread each other.
+#define KDL_LAYOUT_VERSION 1
+#define KDL_FlatDocument_view KDL_FlatDocument_view_v1
+
+/// @brief A borrowed UTF-8 string; `data` is null when absent.
+struct KDL_FlatString {
+	char8_t const* data;
+	size_t length;
+};
+
+/// @brief A half-open range of indices.
+struct KDL_FlatRange {
+	size_t begin;
+	size_t end;
+};
+
+/// @brief A value payload, discriminated by the matching `KdlValueWhich`.
+union KDL_FlatPayload {
+	int64_t integer;
+	double floating;
+	bool boolean;
+	struct KDL_FlatString string;
+};
+
+/// @brief Columns of a flattened document.
+/// Nodes are laid out breadth-first: the top-level nodes are `[0, root_count)`
+/// and each node’s direct children occupy one contiguous range. Columns
+/// prefixed `node_` have `node_count` elements; the rest have `entry_count`.
+struct KDL_FlatDocumentView {
+	size_t root_count;
+	size_t node_count;
+	/// @brief The original node.
+	struct KDL_Node const* const* node;
+	struct KDL_FlatString const* node_name;
+	/// @brief The node’s type annotation, if any.
+	struct KDL_FlatString const* node_ty;
+	/// @brief Index of the parent node, or `SIZE_MAX` for top-level nodes.
+	size_t const* node_parent;
+	/// @brief Index range of the node’s children.
+	struct KDL_FlatRange const* node_children;
+	/// @brief Index range of the node’s entries.
+	struct KDL_FlatRange const* node_entries;
+	size_t entry_count;
+	/// @brief The entry’s name, if it is a property.
+	struct KDL_FlatString const* entry_name;
+	/// @brief The entry’s type annotation, if any.
+	struct KDL_FlatString const* entry_ty;
+	/// @brief The entry value’s `KdlValueWhich`.
+	uint8_t const* value_which;
+	union KDL_FlatPayload const* value_payload;
+};
+
+enum KdlParseStatus {
+	KDL_PARSE_OK = 0,
+	KDL_PARSE_ERROR,
+	/// @brief An event callback returned false.
+	KDL_PARSE_STOPPED,
+};
+
+enum KdlArgsStatus {
+	KDL_ARGS_OK = 0,
+	/// @brief There were more arguments than room for them.
+	KDL_ARGS_TRUNCATED,
+	/// @brief An argument was not of the requested type.
+	KDL_ARGS_MISTYPED,
+};
+
+enum KdlChangeKind {
+	KDL_CHANGE_ADDED = 0,
+	KDL_CHANGE_REMOVED,
+	/// @brief The node’s name, type annotation or entries changed.
+	KDL_CHANGE_CHANGED,
+};
+
+enum KdlTraceKind {
+	KDL_TRACE_PARSE_BEGIN = 0,
+	KDL_TRACE_PARSE_END,
+	/// @brief A parse failed; reported just before its end.
+	KDL_TRACE_ERROR,
+};
+
+/// @brief A parse error located by byte offset into the caller’s input.
+struct KDL_Diagnostic {
+	size_t offset;
+	size_t length;
+	struct KDL_FlatString label;
+	/// @brief Help text for the error; `data` is null if absent.
+	struct KDL_FlatString help;
+};
+
+/// @brief Callbacks for streaming parse events; any may be null.
+/// Strings are only valid for the duration of the callback, and each callback
+/// returns whether to continue parsing. Slashdashed items produce no events.
+struct KDL_EventHandler {
+	void* user;
+	/// @brief A node begins; `ty` is its type annotation, if any.
+	bool (*node_begin)(void* user, struct KDL_FlatString name, struct KDL_FlatString ty);
+	/// @brief An argument (`name.data` is null) or property of the current node.
+	bool (*entry)(void* user, struct KDL_FlatString name, struct KDL_FlatString ty, uint8_t which, union KDL_FlatPayload value);
+	/// @brief The current node’s children block begins.
+	bool (*children_begin)(void* user);
+	/// @brief The current node’s children block ends.
+	bool (*children_end)(void* user);
+	/// @brief The current node ends.
+	bool (*node_end)(void* user);
+};
+
+/// @brief A 1-based line, and 1-based byte column within it.
+struct KDL_Location {
+	size_t line;
+	size_t column;
+};
+
+/// @brief A node that differs between two documents.
+struct KDL_Change {
+	enum KdlChangeKind kind;
+	/// @brief The node in the old document; null if added.
+	struct KDL_Node const* old_node;
+	/// @brief The node in the new document; null if removed.
+	struct KDL_Node const* new_node;
+	/// @brief Names from the root to the node, as a query path. Siblings
+	/// with the same name share a path.
+	struct KDL_FlatString path;
+};
+
+/// @brief Time spent in each phase of a parse, in nanoseconds.
+struct KDL_ParseTiming {
+	/// @brief Opening and mapping the input, for a file.
+	uint64_t read_ns;
+	/// @brief Checking the input is UTF-8, where the caller does not vouch for it.
+	uint64_t validate_ns;
+	/// @brief Building the document.
+	uint64_t parse_ns;
+	uint64_t total_ns;
+};
+
+/// @brief Counts and sizes describing a document, and how its parse went.
+struct KDL_DocumentStats {
+	size_t nodes;
+	size_t entries;
+	/// @brief Node names, and type annotations and property names wherever present.
+	size_t identifiers;
+	/// @brief Nesting depth; top-level nodes are at depth 1.
+	size_t max_depth;
+	/// @brief Bytes of identifiers and string values.
+	size_t string_bytes;
+	/// @brief Heap bytes the document held when parsed; 0 if not recorded.
+	size_t heap_bytes;
+	/// @brief Time the parse took; zeros if not recorded.
+	struct KDL_ParseTiming timing;
+};
+
+/// @brief A parse reported to the trace callback.
+struct KDL_TraceEvent {
+	enum KdlTraceKind kind;
+	/// @brief Bytes of input.
+	size_t length;
+	/// @brief Time since the parse began, for its end and errors.
+	uint64_t duration_ns;
+	/// @brief Allocations made since the parse began.
+	size_t allocations;
+	size_t allocated_bytes;
+	/// @brief Bytes allocated and not freed since the parse began.
+	size_t retained_bytes;
+	/// @brief For an error, where it is; otherwise null.
+	struct KDL_Diagnostic const* error;
+};
+
+/// @brief Receives trace events; called on the parsing thread.
+typedef void (*KDL_TraceCallback)(void* user, struct KDL_TraceEvent const* event);
+
+/// @brief A byte range of a document’s old source that an edit replaced.
+struct KDL_EditRange {
+	size_t offset;
+	size_t length;
+};
+
+/// @brief Destination for a writer’s output.
+struct KDL_WriteSink {
+	void* user;
+	/// @brief Consumes the next piece of output; returns whether it succeeded.
+	bool (*write)(void* user, char8_t const* data, size_t length);
+};
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+#pragma region kdl::arena
+
+/// @brief Creates an arena to parse documents into.
+/// @return Owning pointer to the arena.
+KDL_NONNULL
+struct KDL_Arena*
+KDL_Arena_new(void);
+
+/// @brief Free an arena, and with it every document and error parsed into it, in one step.
+/// These must not be used, or freed individually, afterwards. Some of the memory is kept for
+/// later arenas, and the rest returned to the system.
+/// @param arena The arena to free.
+void
+KDL_Arena_free(
+	KDL_THIS_MUT struct KDL_Arena* arena);
+
+/// @brief Parses a document with all its nodes, entries and strings bump-allocated in `arena`.
+/// Freeing the document, from any thread while the arena lives, is optional; its memory is only
+/// released with the arena. Anything added
+/// to it afterwards is allocated outside the arena and is not released with it.
+/// An arena must not be parsed into from two threads at once.
+/// @param arena The arena to allocate in.
+/// @param string Pointer to UTF-8 document.
+/// @param length Length of UTF-8 document.
+/// @param document (out) On successs, pointer to parsed document, owned by `arena`.
+/// @param error (out) On failure, pointer to parse error, owned by `arena`.
+/// @return Boolean indicating success.
+bool
+KDL_FALLIBLE
+KDL_Document_parse_in(
+	KDL_THIS_MUT struct KDL_Arena* arena,
+	KDL_INPTR_ARRAY(length) char8_t const string[],
+	size_t length,
+	KDL_OUTPTR_NULLABLE struct KDL_Document** document,
+	KDL_OUTPTR_NULLABLE struct KDL_Error** error);
+
+#pragma endregion
+
 #pragma region kdl::document
 
-/// @brief Free a KDL Document.
+/// @brief Free a KDL Document. Does nothing for one parsed into an arena.
 /// @param document The document to free.
 void
 KDL_Document_free(
@@ -121,6 +382,96 @@ KDL_Document_parse(
 	KDL_OUTPTR_NULLABLE struct KDL_Document** document,
 	KDL_OUTPTR_NULLABLE struct KDL_Error** error);
 
+/// @brief Checks that a document is valid, including its UTF-8, without building it.
+/// Any error is identical to the one `KDL_Document_parse` would report.
+/// @param string Pointer to UTF-8 document.
+/// @param length Length of UTF-8 document.
+/// @param error (out) On failure, owning pointer to parse error.
+/// @return Boolean indicating validity.
+bool
+KDL_FALLIBLE
+KDL_Document_validate(
+	KDL_INPTR_ARRAY(length) char8_t const string[],
+	size_t length,
+	KDL_OUTPTR_NULLABLE struct KDL_Error** error);
+
+/// @brief Updates a document after an edit to its source, reparsing only the nodes the edit touches
+/// within the innermost children block that holds it. Spans of the nodes after the edit are moved
+/// rather than reparsed. The result, spans included, is identical to a fresh parse of `new_string`,
+/// which is the fallback whenever the edit cannot be isolated.
+/// `new_string` must be `old_string` with the `edit` range replaced; this is trusted, not checked.
+/// @param document The document to update, which was parsed from `old_string`.
+/// @param old_string Pointer to the UTF-8 source `document` was parsed from.
+/// @param old_length Length of the old source.
+/// @param new_string Pointer to the edited UTF-8 source.
+/// @param new_length Length of the edited source.
+/// @param edit The range of the old source that the edit replaced.
+/// @param error (out) On failure, owning pointer to parse error; `document` is then unchanged.
+/// @return Boolean indicating success.
+bool
+KDL_FALLIBLE
+KDL_Document_reparse(
+	KDL_THIS_MUT struct KDL_Document* document,
+	KDL_INPTR_ARRAY(old_length) char8_t const old_string[],
+	size_t old_length,
+	KDL_INPTR_ARRAY(new_length) char8_t const new_string[],
+	size_t new_length,
+	struct KDL_EditRange edit,
+	KDL_OUTPTR_NULLABLE struct KDL_Error** error);
+
+/// @brief Parses a document, splitting it at top-level nodes and parsing the pieces concurrently.
+/// The result, and any error, is identical to `KDL_Document_parse`; small documents are parsed serially.
+/// @param string Pointer to UTF-8 document.
+/// @param length Length of UTF-8 document.
+/// @param document (out) On successs, owning pointer to parsed document.
+/// @param error (out) On failure, owning pointer to parse error.
+/// @param threads Maximum number of threads to use, or 0 for one per core.
+/// @return Boolean indicating success.
+bool
+KDL_FALLIBLE
+KDL_Document_parse_parallel(
+	KDL_INPTR_ARRAY(length) char8_t const string[],
+	size_t length,
+	KDL_OUTPTR_NULLABLE struct KDL_Document** document,
+	KDL_OUTPTR_NULLABLE struct KDL_Error** error,
+	size_t threads);
+
+/// @brief Parses a file, reading it through a read-only memory mapping instead of a copy.
+/// The file must not be modified while it is being parsed.
+/// @param path Pointer to UTF-8 path.
+/// @param path_length Length of UTF-8 path.
+/// @param document (out) On successs, owning pointer to parsed document.
+/// @param error (out) On failure, owning pointer to the error. If the file could not be read, its
+/// input is the path and `os_error` gives the cause.
+/// @param os_error (out, optional) The OS error code (`errno` or `GetLastError`) if the file could not be read;
+/// otherwise 0.
+/// @return Boolean indicating success.
+bool
+KDL_FALLIBLE
+KDL_Document_parse_file(
+	KDL_INPTR_ARRAY(path_length) char8_t const path[],
+	size_t path_length,
+	KDL_OUTPTR_NULLABLE struct KDL_Document** document,
+	KDL_OUTPTR_NULLABLE struct KDL_Error** error,
+	KDL_MSVC_SAL(_Out_opt_) int* os_error);
+
+/// @brief Parses many documents at once, spread across a pool of threads.
+/// @param count Number of documents.
+/// @param strings Pointers to UTF-8 documents.
+/// @param lengths Lengths of UTF-8 documents.
+/// @param documents (out) For each input, owning pointer to the parsed document, or null on failure.
+/// @param errors (out) For each input, owning pointer to the parse error, or null on success.
+/// @param threads Maximum number of threads to use, or 0 for one per core.
+/// @return Number of documents that failed to parse.
+size_t
+KDL_Document_parse_many(
+	size_t count,
+	KDL_INPTR_ARRAY(count) char8_t const* const strings[],
+	KDL_INPTR_ARRAY(count) size_t const lengths[],
+	KDL_MSVC_SAL(_Out_writes_(count)) struct KDL_Document* documents[],
+	KDL_MSVC_SAL(_Out_writes_(count)) struct KDL_Error* errors[],
+	size_t threads);
+
 /// @brief Gets the first child node with a matching name.
 /// @param document The document to work on.
 /// @param name Pointer to name.
@@ -158,6 +509,618 @@ KDL_Document_nodes(
 
 #pragma endregion
 
+#pragma region kdl::document_index
+
+/// @brief Builds a hash index over a document’s node and property names.
+/// @param document The document to index, including all nested child documents.
+/// @return Owning pointer to the index. The document must outlive it.
+KDL_NONNULL
+struct KDL_DocumentIndex*
+KDL_Document_index(
+	KDL_THIS_CONST struct KDL_Document const* document);
+
+/// @brief Free a document index.
+/// @param index The index to free.
+void
+KDL_DocumentIndex_free(
+	KDL_THIS_MUT struct KDL_DocumentIndex* index);
+
+/// @brief Gets the first child node with a matching name.
+/// @param index The index to work on.
+/// @param document The (possibly nested) indexed document to search, or null for the root.
+/// @param name Pointer to name.
+/// @param length Length of name.
+/// @return Pointer to found node, if present.
+KDL_NULLABLE
+struct KDL_Node const*
+KDL_DocumentIndex_get(
+	KDL_THIS_CONST struct KDL_DocumentIndex const* index,
+	struct KDL_Document const* document,
+	KDL_INPTR_ARRAY(length) char8_t const name[],
+	size_t length);
+
+/// @brief Gets the first child node whose name is a symbol, comparing only integers.
+/// @param index The index to work on.
+/// @param document The (possibly nested) indexed document to search, or null for the root.
+/// @param name The interned name.
+/// @return Pointer to found node, if present.
+KDL_NULLABLE
+struct KDL_Node const*
+KDL_DocumentIndex_get_symbol(
+	KDL_THIS_CONST struct KDL_DocumentIndex const* index,
+	struct KDL_Document const* document,
+	KDL_Symbol name);
+
+/// @brief Gets all child nodes with a matching name, in document order.
+/// @param index The index to work on.
+/// @param document The (possibly nested) indexed document to search, or null for the root.
+/// @param name Pointer to name.
+/// @param length Length of name.
+/// @param count (out) The number of found nodes.
+/// @return Pointer to the first found node pointer, if any.
+KDL_NULLABLE
+KDL_ARRAY(*count)
+struct KDL_Node const* const*
+KDL_DocumentIndex_get_all(
+	KDL_THIS_CONST struct KDL_DocumentIndex const* index,
+	struct KDL_Document const* document,
+	KDL_INPTR_ARRAY(length) char8_t const name[],
+	size_t length,
+	KDL_OUT size_t* count);
+
+/// @brief Gets all child nodes whose name is a symbol, in document order.
+/// @param index The index to work on.
+/// @param document The (possibly nested) indexed document to search, or null for the root.
+/// @param name The interned name.
+/// @param count (out) The number of found nodes.
+/// @return Pointer to the first found node pointer, if any.
+KDL_NULLABLE
+KDL_ARRAY(*count)
+struct KDL_Node const* const*
+KDL_DocumentIndex_get_all_symbol(
+	KDL_THIS_CONST struct KDL_DocumentIndex const* index,
+	struct KDL_Document const* document,
+	KDL_Symbol name,
+	KDL_OUT size_t* count);
+
+/// @brief Gets the first argument (value) of the first child node with a matching name.
+/// @param index The index to work on.
+/// @param document The (possibly nested) indexed document to search, or null for the root.
+/// @param name Pointer to name.
+/// @param length Length of name.
+/// @return Pointer to found value, if present.
+KDL_NULLABLE
+struct KDL_Value const*
+KDL_DocumentIndex_get_arg(
+	KDL_THIS_CONST struct KDL_DocumentIndex const* index,
+	struct KDL_Document const* document,
+	KDL_INPTR_ARRAY(length) char8_t const name[],
+	size_t length);
+
+/// @brief Gets the first argument (value) of the first child node whose name is a symbol.
+/// @param index The index to work on.
+/// @param document The (possibly nested) indexed document to search, or null for the root.
+/// @param name The interned name.
+/// @return Pointer to found value, if present.
+KDL_NULLABLE
+struct KDL_Value const*
+KDL_DocumentIndex_get_arg_symbol(
+	KDL_THIS_CONST struct KDL_DocumentIndex const* index,
+	struct KDL_Document const* document,
+	KDL_Symbol name);
+
+/// @brief Fetches the property entry with a matching name, as `KDL_Node_get_prop`.
+/// @param index The index to work on.
+/// @param node The indexed node to search.
+/// @param name Pointer to name.
+/// @param length Length of name.
+/// @return Pointer to found entry, if present.
+KDL_NULLABLE
+struct KDL_Entry const*
+KDL_DocumentIndex_get_prop(
+	KDL_THIS_CONST struct KDL_DocumentIndex const* index,
+	struct KDL_Node const* node,
+	KDL_INPTR_ARRAY(length) char8_t const name[],
+	size_t length);
+
+/// @brief Fetches the property entry whose name is a symbol, comparing only integers.
+/// @param index The index to work on.
+/// @param node The indexed node to search.
+/// @param name The interned name.
+/// @return Pointer to found entry, if present.
+KDL_NULLABLE
+struct KDL_Entry const*
+KDL_DocumentIndex_get_prop_symbol(
+	KDL_THIS_CONST struct KDL_DocumentIndex const* index,
+	struct KDL_Node const* node,
+	KDL_Symbol name);
+
+/// @brief Gets the symbol this index uses for a name.
+/// @param index The index to work on.
+/// @param name Pointer to UTF-8 name.
+/// @param length Length of name.
+/// @return The symbol for the name, or 0 if no node or property in the indexed document has it.
+KDL_Symbol
+KDL_DocumentIndex_symbol(
+	KDL_THIS_CONST struct KDL_DocumentIndex const* index,
+	KDL_INPTR_ARRAY(length) char8_t const name[],
+	size_t length);
+
+/// @brief Gets the symbol this index uses for an identifier’s name, for dispatching on node names
+/// without hashing strings.
+/// @param index The index to work on.
+/// @param name The identifier. Node and property names of the indexed document are found by address;
+/// any other identifier is looked up by its string.
+/// @return The symbol for the name, or 0 if no node or property in the indexed document has it.
+KDL_Symbol
+KDL_DocumentIndex_name_symbol(
+	KDL_THIS_CONST struct KDL_DocumentIndex const* index,
+	struct KDL_Identifier const* name);
+
+/// @brief Gets the name a symbol of this index stands for.
+/// @param index The index to work on.
+/// @param symbol The symbol.
+/// @param length (out) The length of the name.
+/// @return Pointer to the name, valid as long as the indexed document, or null if `symbol` names nothing.
+KDL_NULLABLE
+KDL_ARRAY(*length)
+char8_t const*
+KDL_DocumentIndex_symbol_name(
+	KDL_THIS_CONST struct KDL_DocumentIndex const* index,
+	KDL_Symbol symbol,
+	KDL_OUT size_t* length);
+
+#pragma endregion
+
+#pragma region kdl::flat_document
+
+/// @brief Flattens a document into a structure-of-arrays layout in one tree walk.
+/// @param document The document to flatten.
+/// @return Owning pointer to the flattened document. Strings borrow from `document`, which must outlive it.
+KDL_NONNULL
+struct KDL_FlatDocument*
+KDL_Document_flatten(
+	KDL_THIS_CONST struct KDL_Document const* document);
+
+/// @brief Free a flattened document.
+/// @param flat The flattened document to free.
+void
+KDL_FlatDocument_free(
+	KDL_THIS_MUT struct KDL_FlatDocument* flat);
+
+/// @brief Gets the columns of a flattened document.
+/// @param flat The flattened document to work on.
+/// @return Pointer to the columns, valid as long as `flat`.
+KDL_NONNULL
+struct KDL_FlatDocumentView const*
+KDL_FlatDocument_view(
+	KDL_THIS_CONST struct KDL_FlatDocument const* flat);
+
+/// @brief Parses a document straight into a structure-of-arrays layout, without building a KDL Document.
+/// Strings point into the input unless they contained escapes, so the input must outlive the result.
+/// The `node` column is null.
+/// @param string Pointer to UTF-8 document.
+/// @param length Length of UTF-8 document.
+/// @param flat (out) On success, owning pointer to the flattened document.
+/// @param error (out, optional) On failure, the error.
+/// @return Whether parsing was successful.
+KDL_FALLIBLE
+bool
+KDL_Document_parse_borrowed(
+	KDL_INPTR_ARRAY(length) char8_t const string[],
+	size_t length,
+	KDL_OUTPTR_NULLABLE struct KDL_FlatDocument** flat,
+	KDL_MSVC_SAL(_Out_opt_) struct KDL_Diagnostic* error);
+
+/// @brief Parses a file straight into a structure-of-arrays layout, through a read-only memory mapping.
+/// The mapping lives as long as the result, which borrows its strings from it;
+/// the file must not be modified in the meantime. The `node` column is null.
+/// @param path Pointer to UTF-8 path.
+/// @param path_length Length of UTF-8 path.
+/// @param flat (out) On success, owning pointer to the flattened document.
+/// @param error (out, optional) On failure, the error. If the file could not be read, it is at offset 0
+/// and `os_error` gives the cause.
+/// @param os_error (out, optional) The OS error code (`errno` or `GetLastError`) if the file could not be read;
+/// otherwise 0.
+/// @return Whether parsing was successful.
+KDL_FALLIBLE
+bool
+KDL_Document_parse_file_borrowed(
+	KDL_INPTR_ARRAY(path_length) char8_t const path[],
+	size_t path_length,
+	KDL_OUTPTR_NULLABLE struct KDL_FlatDocument** flat,
+	KDL_MSVC_SAL(_Out_opt_) struct KDL_Diagnostic* error,
+	KDL_MSVC_SAL(_Out_opt_) int* os_error);
+
+#pragma endregion
+
+#pragma region kdl::lazy_document
+
+/// @brief Parses a document, only brace-matching children blocks; each is parsed on first access.
+/// Errors outside children blocks are identical to `KDL_Document_parse`.
+/// @param string Pointer to UTF-8 document.
+/// @param length Length of UTF-8 document.
+/// @param document (out) On successs, owning pointer to parsed document. It keeps its own copy of the source.
+/// @param error (out) On failure, owning pointer to parse error.
+/// @return Boolean indicating success.
+bool
+KDL_FALLIBLE
+KDL_Document_parse_lazy(
+	KDL_INPTR_ARRAY(length) char8_t const string[],
+	size_t length,
+	KDL_OUTPTR_NULLABLE struct KDL_LazyDocument** document,
+	KDL_OUTPTR_NULLABLE struct KDL_Error** error);
+
+/// @brief Free a lazy document.
+/// @param document The document to free.
+void
+KDL_LazyDocument_free(
+	KDL_THIS_MUT struct KDL_LazyDocument* document);
+
+/// @brief Returns a reference to this document’s nodes.
+/// @param document The document to work on.
+/// @param length (out) The number of nodes.
+/// @return Pointer to the first node (stride by `KDL_LazyNode_sizeof` bytes).
+KDL_NULLABLE
+KDL_ARRAY_B(*length, KDL_LazyNode_sizeof)
+struct KDL_LazyNode const*
+KDL_LazyDocument_nodes(
+	KDL_THIS_CONST struct KDL_LazyDocument const* document,
+	KDL_OUT size_t* length);
+
+/// @brief Gets the first node with a matching name.
+/// @param document The document to work on.
+/// @param name Pointer to name.
+/// @param length Length of name.
+/// @return Pointer to found node, if present.
+KDL_NULLABLE
+struct KDL_LazyNode const*
+KDL_LazyDocument_get(
+	KDL_THIS_CONST struct KDL_LazyDocument const* document,
+	KDL_INPTR_ARRAY(length) char8_t const name[],
+	size_t length);
+
+/// @brief Gets the node itself: its name, type and entries. Its `KDL_Node_children` is always null.
+/// Spans are located in the whole source, as `KDL_Document_parse` would give them.
+/// @param node The node to work on.
+/// @return Pointer to the node.
+KDL_NONNULL
+struct KDL_Node const*
+KDL_LazyNode_node(
+	KDL_THIS_CONST struct KDL_LazyNode const* node);
+
+/// @brief Checks whether this node has a children block, without parsing it.
+/// @param node The node to work on.
+/// @return Boolean indicating a children block.
+bool
+KDL_LazyNode_has_children(
+	KDL_THIS_CONST struct KDL_LazyNode const* node);
+
+/// @brief Gets this node’s children, parsing them on the first call. Safe to call from several threads at once.
+/// @param node The node to work on.
+/// @param children (out) On success, the node’s children, or null if it has none. Owned by `node`.
+/// @param error (out) On failure, the error in the children block, located in the whole source. Owned by `node`;
+/// every later call reports it again.
+/// @return Boolean indicating success.
+bool
+KDL_FALLIBLE
+KDL_LazyNode_children(
+	KDL_THIS_CONST struct KDL_LazyNode const* node,
+	KDL_OUTPTR_NULLABLE struct KDL_LazyDocument const** children,
+	KDL_OUTPTR_NULLABLE struct KDL_Error const** error);
+
+/// @brief Stride in bytes between lazy nodes.
+extern size_t KDL_LazyNode_sizeof;
+
+#pragma endregion
+
+#pragma region kdl::diagnostics
+
+/// @brief Parses a document; errors refer to the input by offset instead of copying it.
+/// It is checked without being built first, so a failing parse never copies the input.
+/// @param string Pointer to UTF-8 document.
+/// @param length Length of UTF-8 document.
+/// @param document (out) On successs, owning pointer to parsed document.
+/// @param error (out, optional) On failure, the error. Its strings are static.
+/// @return Boolean indicating success.
+bool
+KDL_FALLIBLE
+KDL_Document_parse_checked(
+	KDL_INPTR_ARRAY(length) char8_t const string[],
+	size_t length,
+	KDL_OUTPTR_NULLABLE struct KDL_Document** document,
+	KDL_MSVC_SAL(_Out_opt_) struct KDL_Diagnostic* error);
+
+/// @brief Checks a document without building it, collecting its errors.
+/// @param string Pointer to UTF-8 document.
+/// @param length Length of UTF-8 document.
+/// @param recover Whether to resume after each top-level node that fails, finding an error in every
+/// such node, rather than stopping at the first error.
+/// @return Owning pointer to the errors, which are empty for a valid document.
+KDL_NONNULL
+struct KDL_ErrorList*
+KDL_Document_check(
+	KDL_INPTR_ARRAY(length) char8_t const string[],
+	size_t length,
+	bool recover);
+
+/// @brief Free an error list.
+/// @param list The list to free.
+void
+KDL_ErrorList_free(
+	KDL_THIS_MUT struct KDL_ErrorList* list);
+
+/// @brief Returns a reference to the errors in a list, in order of offset.
+/// @param list The list to work on.
+/// @param length (out) The number of errors.
+/// @return Pointer to the first error.
+KDL_ARRAY(*length)
+struct KDL_Diagnostic const*
+KDL_ErrorList_items(
+	KDL_THIS_CONST struct KDL_ErrorList const* list,
+	KDL_OUT size_t* length);
+
+/// @brief Records where each line of a document starts, in one vectorized pass.
+/// @param string Pointer to UTF-8 document.
+/// @param length Length of UTF-8 document.
+/// @return Owning pointer to the index, which does not refer to `string` afterwards.
+KDL_NONNULL
+struct KDL_LineIndex*
+KDL_LineIndex_new(
+	KDL_INPTR_ARRAY(length) char8_t const string[],
+	size_t length);
+
+/// @brief Free a line index.
+/// @param index The index to free.
+void
+KDL_LineIndex_free(
+	KDL_THIS_MUT struct KDL_LineIndex* index);
+
+/// @brief Finds the line and column of a byte offset, by binary search.
+/// @param index The index to work on.
+/// @param offset Byte offset into the indexed document.
+/// @return The offset’s line and column.
+struct KDL_Location
+KDL_LineIndex_locate(
+	KDL_THIS_CONST struct KDL_LineIndex const* index,
+	size_t offset);
+
+#pragma endregion
+
+#pragma region kdl::diff
+
+/// @brief Hashes a document’s content. Formatting, comments and how values are written do not
+/// affect the hash, so documents that mean the same thing hash the same. The hashes of a parsed
+/// document’s subtrees are computed once, on first use here or by `KDL_Document_diff`, and kept
+/// until it is freed or reparsed.
+/// @param document The document to hash.
+/// @return The hash: 64-bit FNV-1a over a fixed encoding of the content, so the same on every
+/// platform and in every process.
+uint64_t
+KDL_Document_hash(
+	KDL_THIS_CONST struct KDL_Document const* document);
+
+/// @brief Hashes a node’s content, including its children, like `KDL_Document_hash`.
+/// A node of a parsed document whose subtrees are already computed is looked up rather than hashed again.
+/// @param node The node to hash.
+/// @return The hash.
+uint64_t
+KDL_Node_hash(
+	KDL_THIS_CONST struct KDL_Node const* node);
+
+/// @brief Compares two documents, skipping subtrees whose hashes match. Nodes are paired by name
+/// and position among same-named siblings; a pair with the same head is compared child by child,
+/// and otherwise reported as changed. Siblings are walked in step while their names agree, so
+/// only where the documents diverge are nodes looked up by name.
+/// @param old_document The document compared from.
+/// @param new_document The document compared to.
+/// @return Owning pointer to the changes, which refer to both documents.
+KDL_NONNULL
+struct KDL_Diff*
+KDL_Document_diff(
+	KDL_THIS_CONST struct KDL_Document const* old_document,
+	struct KDL_Document const* new_document);
+
+/// @brief Free a diff.
+/// @param diff The diff to free.
+void
+KDL_Diff_free(
+	KDL_THIS_MUT struct KDL_Diff* diff);
+
+/// @brief Returns a reference to the changes in a diff, in document order within each level,
+/// removals and changes before additions.
+/// @param diff The diff to work on.
+/// @param length (out) The number of changes.
+/// @return Pointer to the first change.
+KDL_ARRAY(*length)
+struct KDL_Change const*
+KDL_Diff_changes(
+	KDL_THIS_CONST struct KDL_Diff const* diff,
+	KDL_OUT size_t* length);
+
+#pragma endregion
+
+#pragma region kdl::stats
+
+/// @brief Counts a document’s contents. Heap bytes and timing are as of the parse, and recorded by
+/// every function that builds a `KDL_Document`: `KDL_Document_parse`, `_parse_in`, `_parse_file`,
+/// `_parse_parallel` (counting its worker threads’ heap), `_parse_many` and `_parse_checked` (for input that passes its check).
+/// Lazy, borrowed and event parses build none, and are neither recorded nor traced.
+/// @param document The document to describe.
+/// @return The document’s statistics.
+struct KDL_DocumentStats
+KDL_Document_stats(
+	KDL_THIS_CONST struct KDL_Document const* document);
+
+/// @brief Sets the process-wide callback told of each parse that records statistics, replacing any
+/// previous one. While none is set, tracing costs one load per event.
+/// @param callback The callback, or null to stop tracing.
+/// @param user Passed to the callback.
+void
+KDL_set_trace_callback(
+	KDL_MSVC_SAL(_In_opt_) KDL_TraceCallback callback,
+	void* user);
+
+#pragma endregion
+
+#pragma region kdl::event_parser
+
+/// @brief Parses a document as a stream of events, without building it.
+/// @param string Pointer to UTF-8 document.
+/// @param length Length of UTF-8 document.
+/// @param handler The event callbacks.
+/// @param error (out, optional) On failure, the error.
+/// @return Whether the parse finished, failed, or was stopped by a callback.
+KdlParseStatus
+KDL_Parse_events(
+	KDL_INPTR_ARRAY(length) char8_t const string[],
+	size_t length,
+	struct KDL_EventHandler const* handler,
+	KDL_MSVC_SAL(_Out_opt_) struct KDL_Diagnostic* error);
+
+/// @brief Creates a parser to be fed input in chunks.
+/// Memory use is proportional to nesting depth and the longest single item.
+/// @return Owning pointer to the parser.
+KDL_NONNULL
+struct KDL_EventParser*
+KDL_EventParser_new(void);
+
+/// @brief Free an event parser.
+/// @param parser The parser to free.
+void
+KDL_EventParser_free(
+	KDL_THIS_MUT struct KDL_EventParser* parser);
+
+/// @brief Parses the next chunk of input, emitting events for every complete item.
+/// Chunks may split items and UTF-8 sequences anywhere.
+/// @param parser The parser to work on.
+/// @param chunk Pointer to the next chunk of UTF-8 input.
+/// @param length Length of the chunk.
+/// @param handler The event callbacks.
+/// @param error (out, optional) On failure, the error.
+/// @return `KDL_PARSE_OK` if more input may follow; once failed or stopped, always fails the same way.
+KdlParseStatus
+KDL_EventParser_feed(
+	KDL_THIS_MUT struct KDL_EventParser* parser,
+	KDL_INPTR_ARRAY(length) char8_t const chunk[],
+	size_t length,
+	struct KDL_EventHandler const* handler,
+	KDL_MSVC_SAL(_Out_opt_) struct KDL_Diagnostic* error);
+
+/// @brief Signals the end of input, emitting any remaining events.
+/// @param parser The parser to work on.
+/// @param handler The event callbacks.
+/// @param error (out, optional) On failure, the error.
+/// @return Whether the parse finished, failed, or was stopped by a callback.
+KdlParseStatus
+KDL_EventParser_finish(
+	KDL_THIS_MUT struct KDL_EventParser* parser,
+	struct KDL_EventHandler const* handler,
+	KDL_MSVC_SAL(_Out_opt_) struct KDL_Diagnostic* error);
+
+#pragma endregion
+
+#pragma region kdl::writer
+
+/// @brief Creates a writer that accumulates output in a growable buffer.
+/// @return Owning pointer to the writer.
+KDL_NONNULL
+struct KDL_Writer*
+KDL_Writer_new(void);
+
+/// @brief Creates a writer that hands its output to `sink` in large pieces.
+/// @param sink The destination, which must outlive the writer.
+/// @return Owning pointer to the writer.
+KDL_NONNULL
+struct KDL_Writer*
+KDL_Writer_new_sink(
+	struct KDL_WriteSink sink);
+
+/// @brief Free a writer.
+/// @param writer The writer to free.
+void
+KDL_Writer_free(
+	KDL_THIS_MUT struct KDL_Writer* writer);
+
+/// @brief Begins a node, quoting its name and type annotation as needed.
+/// @param writer The writer to work on.
+/// @param name The node name.
+/// @param ty The type annotation; `data` is null if absent.
+void
+KDL_Writer_node_begin(
+	KDL_THIS_MUT struct KDL_Writer* writer,
+	struct KDL_FlatString name,
+	struct KDL_FlatString ty);
+
+/// @brief Writes an argument (`name.data` is null) or property of the current node.
+/// Integers keep the radix given by `which`, except the minimum `int64_t`, which is written in
+/// decimal so that it reads back; raw strings stay raw.
+/// @param writer The writer to work on.
+/// @param name The property name; `data` is null for an argument.
+/// @param ty The type annotation; `data` is null if absent.
+/// @param which The kind of value, a `KdlValueWhich`.
+/// @param value The value.
+void
+KDL_Writer_entry(
+	KDL_THIS_MUT struct KDL_Writer* writer,
+	struct KDL_FlatString name,
+	struct KDL_FlatString ty,
+	uint8_t which,
+	union KDL_FlatPayload value);
+
+/// @brief Begins the current node’s children block.
+/// @param writer The writer to work on.
+void
+KDL_Writer_children_begin(
+	KDL_THIS_MUT struct KDL_Writer* writer);
+
+/// @brief Ends the current node’s children block.
+/// @param writer The writer to work on.
+void
+KDL_Writer_children_end(
+	KDL_THIS_MUT struct KDL_Writer* writer);
+
+/// @brief Ends the current node.
+/// @param writer The writer to work on.
+void
+KDL_Writer_node_end(
+	KDL_THIS_MUT struct KDL_Writer* writer);
+
+/// @brief Gets the output not yet handed to a sink.
+/// @param writer The writer to work on.
+/// @param length (out) Length of the output.
+/// @return Pointer to the output, valid until the next call on `writer`.
+char8_t const*
+KDL_Writer_data(
+	KDL_THIS_CONST struct KDL_Writer const* writer,
+	KDL_OUT size_t* length);
+
+/// @brief Discards all output and state, keeping the buffer’s capacity.
+/// @param writer The writer to work on.
+void
+KDL_Writer_clear(
+	KDL_THIS_MUT struct KDL_Writer* writer);
+
+/// @brief Hands any remaining output to the sink.
+/// @param writer The writer to work on.
+/// @return Whether every call so far was well nested and valid, every float finite, and every sink write successful.
+bool
+KDL_Writer_finish(
+	KDL_THIS_MUT struct KDL_Writer* writer);
+
+/// @brief Serializes a document, preserving its formatting.
+/// @param document The document to serialize.
+/// @param buffer Buffer to write into.
+/// @param capacity Capacity of the buffer.
+/// @return Full length of the output; if greater than `capacity`, the output was truncated.
+size_t
+KDL_Document_write(
+	KDL_THIS_CONST struct KDL_Document const* document,
+	KDL_MSVC_SAL(_Out_writes_(capacity)) char8_t buffer[],
+	size_t capacity);
+
+#pragma endregion
+
 #pragma region kdl::entry
 
 /// @brief Gets a reference to this entry’s name, if it’s a property entry.
@@ -254,6 +1217,35 @@ KDL_Node_get_arg(
 	KDL_THIS_CONST struct KDL_Node const* node,
 	size_t index);
 
+/// @brief Copies all of this node’s arguments into a buffer as doubles, in one call.
+/// Integer arguments are converted; any other type is a mismatch.
+/// @param node The node to work on.
+/// @param values (out) Buffer receiving up to `capacity` arguments.
+/// @param capacity Length of the buffer.
+/// @param count (out) The number of arguments; on a mismatch, the index of the mistyped argument.
+/// @return `KDL_ARGS_TRUNCATED` if only the first `capacity` arguments fit, or `KDL_ARGS_MISTYPED`
+/// if an argument is not a number, in which case the arguments before it were copied.
+KdlArgsStatus
+KDL_Node_args_f64(
+	KDL_THIS_CONST struct KDL_Node const* node,
+	KDL_MSVC_SAL(_Out_writes_(capacity)) double values[],
+	size_t capacity,
+	KDL_OUT size_t* count);
+
+/// @brief Copies all of this node’s arguments into a buffer as integers, in one call.
+/// @param node The node to work on.
+/// @param values (out) Buffer receiving up to `capacity` arguments.
+/// @param capacity Length of the buffer.
+/// @param count (out) The number of arguments; on a mismatch, the index of the mistyped argument.
+/// @return `KDL_ARGS_TRUNCATED` if only the first `capacity` arguments fit, or `KDL_ARGS_MISTYPED`
+/// if an argument is not an integer, in which case the arguments before it were copied.
+KdlArgsStatus
+KDL_Node_args_i64(
+	KDL_THIS_CONST struct KDL_Node const* node,
+	KDL_MSVC_SAL(_Out_writes_(capacity)) int64_t values[],
+	size_t capacity,
+	KDL_OUT size_t* count);
+
 /// @brief Returns a reference to this node’s children, if any.
 /// @param node The node to work on.
 /// @return The node’s children, if any.
@@ -267,6 +1259,53 @@ extern size_t KDL_Node_sizeof;
 
 #pragma endregion
 
+#pragma region kdl::query
+
+/// @brief Compiles a path query.
+/// Queries are `/`-separated node names, each optionally preceded by a `(type)`
+/// annotation filter, where `*` matches any name and `"..."` quotes a name,
+/// with KDL string escapes. The last segment may be followed by `[index]` to
+/// select an argument or `@name` to select a property, e.g.
+/// `server/(tcp)listener/port[0]`.
+/// @param string Pointer to UTF-8 query.
+/// @param length Length of UTF-8 query.
+/// @param query (out) On success, owning pointer to compiled query.
+/// @param error_offset (out) On failure, byte offset of what failed to parse:
+/// the opening quote of an unclosed name, the backslash of a bad escape, or
+/// otherwise the unexpected byte.
+/// @return Boolean indicating success.
+bool
+KDL_FALLIBLE
+KDL_MSVC_SAL(
+	_At_(*query, _Post_notnull_)
+	_On_failure_(_At_(*query, _Post_null_)))
+KDL_Query_compile(
+	KDL_INPTR_ARRAY(length) char8_t const string[],
+	size_t length,
+	KDL_OUTPTR_NULLABLE struct KDL_Query** query,
+	KDL_OUT size_t* error_offset);
+
+/// @brief Free a compiled query.
+/// @param query The query to free.
+void
+KDL_Query_free(
+	KDL_THIS_MUT struct KDL_Query* query);
+
+/// @brief Runs a compiled query against a document.
+/// @param query The query to run.
+/// @param document The document to search.
+/// @param matches (out) Buffer receiving up to `capacity` matches, in document order.
+/// @param capacity The number of matches the buffer can hold.
+/// @return The total number of matches, which may exceed `capacity`.
+size_t
+KDL_Query_run(
+	KDL_THIS_CONST struct KDL_Query const* query,
+	struct KDL_Document const* document,
+	KDL_MSVC_SAL(_Out_writes_to_(capacity, return)) struct KDL_QueryMatch matches[],
+	size_t capacity);
+
+#pragma endregion
+
 #pragma region kdl::value
 
 /// @brief Extract the string value from a value.
@@ -330,7 +1369,7 @@ KDL_Value_which(
 
 #pragma region kdl::error
 
-/// @brief Free a KDL error.
+/// @brief Free a KDL error. Does nothing for one from parsing into an arena.
 /// @param error The error to free.
 void
 KDL_Error_free(
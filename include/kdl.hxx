@@ -1,7 +1,9 @@
 ﻿#ifndef KDL_HXX
 #define KDL_HXX
 
+#include <array>
 #include <cassert>
+#include <compare>
 #include <cstddef>
 #include <cstdint>
 
@@ -17,58 +19,315 @@ extern "C" {
 	T& operator=(T&) = delete; \
 	T& operator=(T&&) = delete;
 
+#include <filesystem>
+#include <functional>
 #include <iterator>
 #include <memory>
 #include <optional>
 #include <span>
+#include <string>
 #include <string_view>
+#include <system_error>
+#include <tuple>
 #include <type_traits>
 #include <utility>
 #include <variant>
+#include <vector>
 
 namespace kdl {
 
+/// @brief Bump allocator that documents can be parsed into.
+using arena = KDL_Arena;
 /// @brief Represents a KDL Document.
 using document = KDL_Document;
+/// @brief Hash index over the names in a KDL Document.
+using document_index = KDL_DocumentIndex;
+/// @brief A node that differs between two documents.
+using change = KDL_Change;
+/// @brief The nodes that differ between two KDL Documents.
+using diff_result = KDL_Diff;
+/// @brief A byte range of a document’s old source that an edit replaced.
+using edit_range = KDL_EditRange;
+/// @brief Structure-of-arrays copy of a KDL Document.
+using flat_document = KDL_FlatDocument;
 /// @brief Represents a KDL Argument or KDL Property.
 using entry = KDL_Entry;
 /// @brief Represents a KDL Identifier.
 using identifier = KDL_Identifier;
+/// @brief A KDL Document whose children blocks are parsed on first access.
+using lazy_document = KDL_LazyDocument;
+/// @brief A node of a lazy document.
+using lazy_node = KDL_LazyNode;
 /// @brief Represents a KDL Node.
 using node = KDL_Node;
+/// @brief A compiled path query over KDL Documents.
+using query = KDL_Query;
+/// @brief A single result of running a query.
+using query_match = KDL_QueryMatch;
 /// @brief Represents a KDL Value.
 using value = KDL_Value;
 
 /// @brief An error that occurs when parsing a KDL document.
 using error = KDL_Error;
+/// @brief A parse error located by byte offset into the caller’s input.
+using diagnostic = KDL_Diagnostic;
+/// @brief Every error found in one pass over a document.
+using error_list = KDL_ErrorList;
+/// @brief Line start offsets of a document, for locating byte offsets.
+using line_index = KDL_LineIndex;
+/// @brief A 1-based line, and 1-based byte column within it.
+using location = KDL_Location;
+/// @brief Time spent in each phase of a parse, in nanoseconds.
+using parse_timing = KDL_ParseTiming;
+/// @brief Counts and sizes describing a document, and how its parse went.
+using stats = KDL_DocumentStats;
+/// @brief A parse reported to the trace callback.
+using trace_event = KDL_TraceEvent;
+/// @brief Incremental parser reporting a document as a stream of events.
+using event_parser = KDL_EventParser;
+/// @brief Streaming KDL serializer.
+using writer = KDL_Writer;
+
+/// @brief The contents of a KDL Value.
+using value_variant = std::variant<
+	std::monostate,
+	std::u8string_view,
+	int64_t,
+	double,
+	bool
+>;
+
+/// @brief A name interned by a `document_index`, compared and hashed as an integer. The
+/// default symbol is empty and names nothing.
+class symbol {
+public:
+	constexpr symbol() = default;
+	constexpr explicit symbol(KDL_Symbol id)
+		: m_id(id)
+	{}
+
+	constexpr KDL_Symbol id() const { return m_id; }
+	constexpr explicit operator bool() const { return m_id != 0; }
+
+	friend constexpr bool operator==(symbol, symbol) = default;
+	friend constexpr auto operator<=>(symbol, symbol) = default;
+
+private:
+	KDL_Symbol m_id = 0;
+};
 
 namespace detail {
+struct arena_deleter;
+struct diff_deleter;
 struct document_deleter;
+struct document_index_deleter;
 struct error_deleter;
+struct error_list_deleter;
+struct event_parser_deleter;
+struct flat_document_deleter;
+struct lazy_document_deleter;
+struct line_index_deleter;
+struct query_deleter;
+struct writer_deleter;
 template<typename T>
 class iterator;
 } // namespace kdl::detail
 
+using arena_ptr = std::unique_ptr<arena, detail::arena_deleter>;
+using diff_ptr = std::unique_ptr<diff_result, detail::diff_deleter>;
 using document_ptr = std::unique_ptr<document, detail::document_deleter>;
+using document_index_ptr = std::unique_ptr<document_index, detail::document_index_deleter>;
 using error_ptr = std::unique_ptr<error, detail::error_deleter>;
+using error_list_ptr = std::unique_ptr<error_list, detail::error_list_deleter>;
+using event_parser_ptr = std::unique_ptr<event_parser, detail::event_parser_deleter>;
+using flat_document_ptr = std::unique_ptr<flat_document, detail::flat_document_deleter>;
+using lazy_document_ptr = std::unique_ptr<lazy_document, detail::lazy_document_deleter>;
+using line_index_ptr = std::unique_ptr<line_index, detail::line_index_deleter>;
+using query_ptr = std::unique_ptr<query, detail::query_deleter>;
+using writer_ptr = std::unique_ptr<writer, detail::writer_deleter>;
 
 template<typename T>
 using slice = std::counted_iterator<detail::iterator<T>>;
 
 namespace detail {
 
+struct arena_deleter {
+	void operator()(arena* a) const {
+		KDL_Arena_free(a);
+	}
+};
+
+struct diff_deleter {
+	void operator()(diff_result* diff) const {
+		KDL_Diff_free(diff);
+	}
+};
+
 struct document_deleter {
 	void operator()(document* doc) const {
 		KDL_Document_free(doc);
 	}
 };
 
+struct document_index_deleter {
+	void operator()(document_index* index) const {
+		KDL_DocumentIndex_free(index);
+	}
+};
+
 struct error_deleter {
 	void operator()(error* err) const {
 		KDL_Error_free(err);
 	}
 };
 
+struct error_list_deleter {
+	void operator()(error_list* list) const {
+		KDL_ErrorList_free(list);
+	}
+};
+
+struct event_parser_deleter {
+	void operator()(event_parser* parser) const {
+		KDL_EventParser_free(parser);
+	}
+};
+
+struct flat_document_deleter {
+	void operator()(flat_document* flat) const {
+		KDL_FlatDocument_free(flat);
+	}
+};
+
+struct lazy_document_deleter {
+	void operator()(lazy_document* doc) const {
+		KDL_LazyDocument_free(doc);
+	}
+};
+
+struct line_index_deleter {
+	void operator()(line_index* index) const {
+		KDL_LineIndex_free(index);
+	}
+};
+
+struct query_deleter {
+	void operator()(query* q) const {
+		KDL_Query_free(q);
+	}
+};
+
+struct writer_deleter {
+	void operator()(writer* w) const {
+		KDL_Writer_free(w);
+	}
+};
+
+inline std::optional<std::u8string_view> flat_string(KDL_FlatString s) {
+	if (s.data) {
+		return std::u8string_view(s.data, s.length);
+	}
+	else {
+		return std::nullopt;
+	}
+}
+
+inline value_variant flat_value(uint8_t which, KDL_FlatPayload const& payload) {
+	if (KDL_VALUE_IS_STRING(which)) {
+		return std::u8string_view(payload.string.data, payload.string.length);
+	}
+	else if (KDL_VALUE_IS_INT(which)) {
+		return payload.integer;
+	}
+	else if (KDL_VALUE_IS_FLOAT(which)) {
+		return payload.floating;
+	}
+	else if (KDL_VALUE_IS_BOOL(which)) {
+		return payload.boolean;
+	}
+	else {
+		return std::monostate();
+	}
+}
+
+inline KDL_FlatString to_flat_string(std::optional<std::u8string_view> s) {
+	if (s) {
+		return { s->data(), s->size() };
+	}
+	else {
+		return { nullptr, 0 };
+	}
+}
+
+inline std::pair<uint8_t, KDL_FlatPayload> to_flat_value(value_variant const& value) {
+	KDL_FlatPayload payload;
+	switch (value.index()) {
+	case 1:
+		payload.string = to_flat_string(std::get<1>(value));
+		return { KDL_VALUE_WHICH_STRING, payload };
+	case 2:
+		payload.integer = std::get<2>(value);
+		return { KDL_VALUE_WHICH_BASE10, payload };
+	case 3:
+		payload.floating = std::get<3>(value);
+		return { KDL_VALUE_WHICH_BASE10_FLOAT, payload };
+	case 4:
+		payload.boolean = std::get<4>(value);
+		return { KDL_VALUE_WHICH_BOOL, payload };
+	default:
+		payload.integer = 0;
+		return { KDL_VALUE_WHICH_NULL, payload };
+	}
+}
+
+template<typename F>
+bool keep_going(F&& f) {
+	if constexpr (std::is_void_v<decltype(f())>) {
+		f();
+		return true;
+	}
+	else {
+		return f();
+	}
+}
+
+/// @brief Builds callbacks for whichever event methods `Visitor` has.
+template<typename Visitor>
+KDL_EventHandler event_handler(Visitor& visitor) {
+	KDL_EventHandler handler = {};
+	handler.user = &visitor;
+	if constexpr (requires { visitor.node_begin(std::u8string_view(), std::optional<std::u8string_view>()); }) {
+		handler.node_begin = [](void* user, KDL_FlatString name, KDL_FlatString ty) {
+			return keep_going([&] {
+				return static_cast<Visitor*>(user)->node_begin(std::u8string_view(name.data, name.length), flat_string(ty));
+			});
+		};
+	}
+	if constexpr (requires { visitor.entry(std::optional<std::u8string_view>(), std::optional<std::u8string_view>(), value_variant()); }) {
+		handler.entry = [](void* user, KDL_FlatString name, KDL_FlatString ty, uint8_t which, KDL_FlatPayload value) {
+			return keep_going([&] {
+				return static_cast<Visitor*>(user)->entry(flat_string(name), flat_string(ty), flat_value(which, value));
+			});
+		};
+	}
+	if constexpr (requires { visitor.children_begin(); }) {
+		handler.children_begin = [](void* user) {
+			return keep_going([&] { return static_cast<Visitor*>(user)->children_begin(); });
+		};
+	}
+	if constexpr (requires { visitor.children_end(); }) {
+		handler.children_end = [](void* user) {
+			return keep_going([&] { return static_cast<Visitor*>(user)->children_end(); });
+		};
+	}
+	if constexpr (requires { visitor.node_end(); }) {
+		handler.node_end = [](void* user) {
+			return keep_going([&] { return static_cast<Visitor*>(user)->node_end(); });
+		};
+	}
+	return handler;
+}
+
 template<typename T>
 class iterator {
 public:
@@ -132,6 +391,36 @@ private:
 
 } // namespace kdl
 
+template<>
+struct std::hash<kdl::symbol> {
+	size_t operator()(kdl::symbol symbol) const noexcept {
+		return std::hash<KDL_Symbol>()(symbol.id());
+	}
+};
+
+/// @brief Bump allocator that documents can be parsed into.
+/// Freeing the arena releases every document and error parsed into it at once.
+extern "C" struct KDL_Arena {
+	KDL_OPAQUE(KDL_Arena);
+
+	static kdl::arena_ptr create() {
+		return kdl::arena_ptr(KDL_Arena_new());
+	}
+
+	/// @brief Parses a document into this arena. The result is owned by the
+	/// arena and must not be used after it is freed.
+	std::variant<kdl::document*, kdl::error*> parse(std::u8string_view source) {
+		kdl::document* doc;
+		kdl::error* err;
+		if (KDL_Document_parse_in(this, source.data(), source.size(), &doc, &err)) {
+			return doc;
+		}
+		else {
+			return err;
+		}
+	}
+};
+
 /// @brief Represents a KDL Document.
 extern "C" struct KDL_Document {
 	KDL_OPAQUE(KDL_Document);
@@ -147,6 +436,68 @@ extern "C" struct KDL_Document {
 		}
 	}
 
+	/// @brief Parses as `parse`, but an error refers to `source` by offset
+	/// instead of copying it.
+	static std::variant<kdl::document_ptr, kdl::diagnostic> parse_checked(std::u8string_view source) {
+		kdl::document* doc;
+		kdl::diagnostic error;
+		if (KDL_Document_parse_checked(source.data(), source.size(), &doc, &error)) {
+			return kdl::document_ptr(doc);
+		}
+		else {
+			return error;
+		}
+	}
+
+	/// @brief Checks that `source` is a valid document without building it.
+	/// @return Null if valid; otherwise the error `parse` would give.
+	static kdl::error_ptr validate(std::u8string_view source) {
+		kdl::error* err;
+		KDL_Document_validate(source.data(), source.size(), &err);
+		return kdl::error_ptr(err);
+	}
+
+	/// @brief Parses a large document on up to `threads` threads (0 for one per core),
+	/// splitting it at top-level nodes. Results and errors match `parse`.
+	static std::variant<kdl::document_ptr, kdl::error_ptr> parse_parallel(std::u8string_view source, size_t threads = 0) {
+		kdl::document* doc;
+		kdl::error* err;
+		if (KDL_Document_parse_parallel(source.data(), source.size(), &doc, &err, threads)) {
+			return kdl::document_ptr(doc);
+		}
+		else {
+			return kdl::error_ptr(err);
+		}
+	}
+
+	/// @brief Parses a file through a read-only memory mapping instead of a copy.
+	static std::variant<kdl::document_ptr, kdl::error_ptr, std::error_code> parse_file(std::filesystem::path const& path) {
+		std::u8string utf8 = path.u8string();
+		kdl::document* doc;
+		kdl::error* err;
+		int os_error;
+		if (KDL_Document_parse_file(utf8.data(), utf8.size(), &doc, &err, &os_error)) {
+			return kdl::document_ptr(doc);
+		}
+		kdl::error_ptr error(err);
+		if (os_error) {
+			return std::error_code(os_error, std::system_category());
+		}
+		else {
+			return error;
+		}
+	}
+
+	/// @brief Updates this document, parsed from `old_source`, to match `new_source`,
+	/// reparsing only the nodes that `edit` touches within the innermost children
+	/// block that holds it. `new_source` must be `old_source` with `edit` replaced.
+	/// @return Null on success; otherwise the error, and this document is unchanged.
+	kdl::error_ptr reparse(std::u8string_view old_source, std::u8string_view new_source, kdl::edit_range edit) {
+		kdl::error* err;
+		KDL_Document_reparse(this, old_source.data(), old_source.size(), new_source.data(), new_source.size(), edit, &err);
+		return kdl::error_ptr(err);
+	}
+
 	KDL_NULLABLE
 	kdl::node const* get(std::u8string_view name) const {
 		return KDL_Document_get(this, name.data(), name.size());
@@ -171,6 +522,416 @@ extern "C" struct KDL_Document {
 		auto children = nodes();
 		return children.base() + children.count();
 	}
+
+	/// @brief Counts this document’s contents, with the heap bytes and timing
+	/// recorded when it was parsed.
+	kdl::stats stats() const {
+		return KDL_Document_stats(this);
+	}
+
+	/// @brief Hashes this document’s content, ignoring formatting and comments.
+	uint64_t hash() const {
+		return KDL_Document_hash(this);
+	}
+
+	/// @brief Builds a hash index over this document’s node and property names.
+	/// The index borrows from this document, which must outlive it.
+	kdl::document_index_ptr index() const {
+		return kdl::document_index_ptr(KDL_Document_index(this));
+	}
+
+	/// @brief Flattens this document into a structure-of-arrays layout.
+	/// The flat document borrows from this document, which must outlive it.
+	kdl::flat_document_ptr flatten() const {
+		return kdl::flat_document_ptr(KDL_Document_flatten(this));
+	}
+
+	/// @brief Serializes this document, preserving its formatting, into `out`
+	/// (whose capacity is reused).
+	void write(std::u8string& out) const {
+		out.resize(out.capacity());
+		size_t length = KDL_Document_write(this, out.data(), out.size());
+		if (length > out.size()) {
+			out.resize(length);
+			KDL_Document_write(this, out.data(), out.size());
+		}
+		out.resize(length);
+	}
+
+	std::u8string write() const {
+		std::u8string out;
+		write(out);
+		return out;
+	}
+};
+
+namespace kdl {
+
+/// @brief Sets the process-wide callback told of each parse that records
+/// statistics; null stops tracing.
+inline void set_trace_callback(KDL_TraceCallback callback, void* user = nullptr) {
+	KDL_set_trace_callback(callback, user);
+}
+
+/// @brief Parses many documents at once, spread across up to `threads` threads (0 for one per core).
+inline std::vector<std::variant<kdl::document_ptr, kdl::error_ptr>> parse_batch(std::span<std::u8string_view const> sources, size_t threads = 0) {
+	std::vector<char8_t const*> strings;
+	std::vector<size_t> lengths;
+	strings.reserve(sources.size());
+	lengths.reserve(sources.size());
+	for (auto source : sources) {
+		strings.push_back(source.data());
+		lengths.push_back(source.size());
+	}
+	std::vector<kdl::document*> docs(sources.size());
+	std::vector<kdl::error*> errs(sources.size());
+	KDL_Document_parse_many(sources.size(), strings.data(), lengths.data(), docs.data(), errs.data(), threads);
+
+	std::vector<std::variant<kdl::document_ptr, kdl::error_ptr>> results;
+	results.reserve(sources.size());
+	for (size_t i = 0; i < sources.size(); ++i) {
+		if (docs[i]) {
+			results.emplace_back(kdl::document_ptr(docs[i]));
+		}
+		else {
+			results.emplace_back(kdl::error_ptr(errs[i]));
+		}
+	}
+	return results;
+}
+
+} // namespace kdl
+
+namespace kdl {
+
+/// @brief Sizes and offsets of the `KDL_Flat*` structs, which the library
+/// asserts identically, so that their columns can be read inline.
+namespace layout {
+
+inline constexpr uint32_t version = KDL_LAYOUT_VERSION;
+inline constexpr size_t word = sizeof(size_t);
+inline constexpr size_t flat_string_size = 2 * word;
+inline constexpr size_t flat_range_size = 2 * word;
+inline constexpr size_t flat_payload_size = flat_string_size > 8 ? flat_string_size : 8;
+/// @brief Every column of the view is one word, in declaration order.
+inline constexpr size_t flat_view_size = 13 * word;
+
+static_assert(sizeof(size_t) == sizeof(void*));
+static_assert(sizeof(KDL_FlatString) == flat_string_size);
+static_assert(offsetof(KDL_FlatString, length) == word);
+static_assert(sizeof(KDL_FlatRange) == flat_range_size);
+static_assert(offsetof(KDL_FlatRange, end) == word);
+static_assert(sizeof(KDL_FlatPayload) == flat_payload_size);
+static_assert(sizeof(KDL_FlatDocumentView) == flat_view_size);
+static_assert(offsetof(KDL_FlatDocumentView, root_count) == 0);
+static_assert(offsetof(KDL_FlatDocumentView, node_count) == word);
+static_assert(offsetof(KDL_FlatDocumentView, node) == 2 * word);
+static_assert(offsetof(KDL_FlatDocumentView, node_name) == 3 * word);
+static_assert(offsetof(KDL_FlatDocumentView, node_ty) == 4 * word);
+static_assert(offsetof(KDL_FlatDocumentView, node_parent) == 5 * word);
+static_assert(offsetof(KDL_FlatDocumentView, node_children) == 6 * word);
+static_assert(offsetof(KDL_FlatDocumentView, node_entries) == 7 * word);
+static_assert(offsetof(KDL_FlatDocumentView, entry_count) == 8 * word);
+static_assert(offsetof(KDL_FlatDocumentView, entry_name) == 9 * word);
+static_assert(offsetof(KDL_FlatDocumentView, entry_ty) == 10 * word);
+static_assert(offsetof(KDL_FlatDocumentView, value_which) == 11 * word);
+static_assert(offsetof(KDL_FlatDocumentView, value_payload) == 12 * word);
+
+} // namespace kdl::layout
+
+/// @brief Handles to the rows of a flattened document, numbered by index
+/// within `[begin, end)`.
+template<typename T>
+class flat_range {
+public:
+	class iterator {
+	public:
+		using difference_type = ptrdiff_t;
+		using value_type = T;
+
+		iterator() = default;
+		iterator(KDL_FlatDocumentView const* view, size_t index)
+			: m_view(view), m_index(index)
+		{}
+
+		T operator*() const { return T(*m_view, m_index); }
+		iterator& operator++() { ++m_index; return *this; }
+		iterator operator++(int) { auto tmp = *this; ++m_index; return tmp; }
+		friend bool operator==(iterator const& a, iterator const& b) { return a.m_index == b.m_index; }
+
+	private:
+		KDL_FlatDocumentView const* m_view = nullptr;
+		size_t m_index = 0;
+	};
+
+	flat_range(KDL_FlatDocumentView const& view, KDL_FlatRange range)
+		: m_view(&view), m_range(range)
+	{}
+
+	iterator begin() const { return { m_view, m_range.begin }; }
+	iterator end() const { return { m_view, m_range.end }; }
+	size_t size() const { return m_range.end - m_range.begin; }
+	bool empty() const { return m_range.begin == m_range.end; }
+	T operator[](size_t i) const { return T(*m_view, m_range.begin + i); }
+
+private:
+	KDL_FlatDocumentView const* m_view;
+	KDL_FlatRange m_range;
+};
+
+/// @brief An entry of a flattened document, read in place.
+class flat_entry {
+public:
+	flat_entry(KDL_FlatDocumentView const& view, size_t index)
+		: m_view(&view), m_index(index)
+	{}
+
+	size_t index() const { return m_index; }
+
+	/// @brief The entry’s name, if it is a property.
+	std::optional<std::u8string_view> name() const {
+		return kdl::detail::flat_string(m_view->entry_name[m_index]);
+	}
+
+	std::optional<std::u8string_view> ty() const {
+		return kdl::detail::flat_string(m_view->entry_ty[m_index]);
+	}
+
+	/// @brief The value's `KdlValueWhich`.
+	uint8_t which() const { return m_view->value_which[m_index]; }
+
+	/// @brief The value, discriminated by `which()`.
+	KDL_FlatPayload const& payload() const { return m_view->value_payload[m_index]; }
+
+	kdl::value_variant value() const {
+		return kdl::detail::flat_value(m_view->value_which[m_index], m_view->value_payload[m_index]);
+	}
+
+private:
+	KDL_FlatDocumentView const* m_view;
+	size_t m_index;
+};
+
+/// @brief A node of a flattened document, read in place.
+class flat_node {
+public:
+	flat_node(KDL_FlatDocumentView const& view, size_t index)
+		: m_view(&view), m_index(index)
+	{}
+
+	size_t index() const { return m_index; }
+
+	std::u8string_view name() const {
+		auto name = m_view->node_name[m_index];
+		return { name.data, name.length };
+	}
+
+	std::optional<std::u8string_view> ty() const {
+		return kdl::detail::flat_string(m_view->node_ty[m_index]);
+	}
+
+	std::optional<flat_node> parent() const {
+		size_t parent = m_view->node_parent[m_index];
+		return parent == SIZE_MAX ? std::nullopt : std::optional(flat_node(*m_view, parent));
+	}
+
+	kdl::flat_range<flat_node> children() const { return { *m_view, m_view->node_children[m_index] }; }
+	kdl::flat_range<kdl::flat_entry> entries() const { return { *m_view, m_view->node_entries[m_index] }; }
+
+	auto begin() const { return entries().begin(); }
+	auto end() const { return entries().end(); }
+
+	/// @brief The original node, for anything the columns lack; null if the
+	/// document was parsed without building one.
+	KDL_NULLABLE
+	kdl::node const* node() const {
+		return m_view->node ? m_view->node[m_index] : nullptr;
+	}
+
+private:
+	KDL_FlatDocumentView const* m_view;
+	size_t m_index;
+};
+
+} // namespace kdl
+
+/// @brief Structure-of-arrays copy of a KDL Document.
+struct KDL_FlatDocument {
+	KDL_OPAQUE(KDL_FlatDocument);
+
+	/// @brief Parses a document straight into a structure-of-arrays layout.
+	/// Strings point into `source` unless they contained escapes, so `source`
+	/// must outlive the result; `nodes()` is empty.
+	static std::variant<kdl::flat_document_ptr, kdl::diagnostic> parse_borrowed(std::u8string_view source) {
+		kdl::flat_document* flat;
+		kdl::diagnostic error;
+		if (KDL_Document_parse_borrowed(source.data(), source.size(), &flat, &error)) {
+			return kdl::flat_document_ptr(flat);
+		}
+		else {
+			return error;
+		}
+	}
+
+	/// @brief Parses a file straight into a structure-of-arrays layout, through
+	/// a read-only memory mapping that lives as long as the result.
+	static std::variant<kdl::flat_document_ptr, kdl::diagnostic, std::error_code> parse_file_borrowed(std::filesystem::path const& path) {
+		std::u8string utf8 = path.u8string();
+		kdl::flat_document* flat;
+		kdl::diagnostic error;
+		int os_error;
+		if (KDL_Document_parse_file_borrowed(utf8.data(), utf8.size(), &flat, &error, &os_error)) {
+			return kdl::flat_document_ptr(flat);
+		}
+		else if (os_error) {
+			return std::error_code(os_error, std::system_category());
+		}
+		else {
+			return error;
+		}
+	}
+
+	KDL_FlatDocumentView const& view() const {
+		return *KDL_FlatDocument_view(this);
+	}
+
+	size_t root_count() const { return view().root_count; }
+	size_t node_count() const { return view().node_count; }
+	size_t entry_count() const { return view().entry_count; }
+
+	std::span<kdl::node const* const> nodes() const { return { view().node, view().node ? node_count() : 0 }; }
+	std::span<KDL_FlatString const> node_names() const { return { view().node_name, node_count() }; }
+	std::span<KDL_FlatString const> node_types() const { return { view().node_ty, node_count() }; }
+	std::span<size_t const> node_parents() const { return { view().node_parent, node_count() }; }
+	std::span<KDL_FlatRange const> node_children() const { return { view().node_children, node_count() }; }
+	std::span<KDL_FlatRange const> node_entries() const { return { view().node_entries, node_count() }; }
+	std::span<KDL_FlatString const> entry_names() const { return { view().entry_name, entry_count() }; }
+	std::span<KDL_FlatString const> entry_types() const { return { view().entry_ty, entry_count() }; }
+	std::span<uint8_t const> value_which() const { return { view().value_which, entry_count() }; }
+	std::span<KDL_FlatPayload const> value_payloads() const { return { view().value_payload, entry_count() }; }
+
+	static std::optional<std::u8string_view> string(KDL_FlatString s) {
+		return kdl::detail::flat_string(s);
+	}
+
+	std::u8string_view node_name(size_t node) const {
+		auto name = view().node_name[node];
+		return { name.data, name.length };
+	}
+
+	kdl::value_variant value(size_t entry) const {
+		return kdl::detail::flat_value(view().value_which[entry], view().value_payload[entry]);
+	}
+
+	/// @brief The top-level nodes. Walking them and their children reads the
+	/// columns in place, without calling into the library.
+	kdl::flat_range<kdl::flat_node> roots() const {
+		return { view(), { 0, root_count() } };
+	}
+
+	auto begin() const {
+		return roots().begin();
+	}
+
+	auto end() const {
+		return roots().end();
+	}
+};
+
+/// @brief Hash index over the names in a KDL Document.
+struct KDL_DocumentIndex {
+	KDL_OPAQUE(KDL_DocumentIndex);
+
+	KDL_NULLABLE
+	kdl::node const* get(std::u8string_view name) const {
+		return KDL_DocumentIndex_get(this, nullptr, name.data(), name.size());
+	}
+
+	KDL_NULLABLE
+	kdl::node const* get(kdl::document const& document, std::u8string_view name) const {
+		return KDL_DocumentIndex_get(this, &document, name.data(), name.size());
+	}
+
+	std::span<kdl::node const* const> get_all(std::u8string_view name) const {
+		size_t count;
+		kdl::node const* const* head = KDL_DocumentIndex_get_all(this, nullptr, name.data(), name.size(), &count);
+		return { head, count };
+	}
+
+	std::span<kdl::node const* const> get_all(kdl::document const& document, std::u8string_view name) const {
+		size_t count;
+		kdl::node const* const* head = KDL_DocumentIndex_get_all(this, &document, name.data(), name.size(), &count);
+		return { head, count };
+	}
+
+	KDL_NULLABLE
+	kdl::value const* get_arg(std::u8string_view name) const {
+		return KDL_DocumentIndex_get_arg(this, nullptr, name.data(), name.size());
+	}
+
+	KDL_NULLABLE
+	kdl::value const* get_arg(kdl::document const& document, std::u8string_view name) const {
+		return KDL_DocumentIndex_get_arg(this, &document, name.data(), name.size());
+	}
+
+	KDL_NULLABLE
+	kdl::entry const* get_prop(kdl::node const& node, std::u8string_view name) const {
+		return KDL_DocumentIndex_get_prop(this, &node, name.data(), name.size());
+	}
+
+	KDL_NULLABLE
+	kdl::node const* get(kdl::symbol name) const {
+		return KDL_DocumentIndex_get_symbol(this, nullptr, name.id());
+	}
+
+	KDL_NULLABLE
+	kdl::node const* get(kdl::document const& document, kdl::symbol name) const {
+		return KDL_DocumentIndex_get_symbol(this, &document, name.id());
+	}
+
+	std::span<kdl::node const* const> get_all(kdl::symbol name) const {
+		size_t count;
+		kdl::node const* const* head = KDL_DocumentIndex_get_all_symbol(this, nullptr, name.id(), &count);
+		return { head, count };
+	}
+
+	std::span<kdl::node const* const> get_all(kdl::document const& document, kdl::symbol name) const {
+		size_t count;
+		kdl::node const* const* head = KDL_DocumentIndex_get_all_symbol(this, &document, name.id(), &count);
+		return { head, count };
+	}
+
+	KDL_NULLABLE
+	kdl::value const* get_arg(kdl::symbol name) const {
+		return KDL_DocumentIndex_get_arg_symbol(this, nullptr, name.id());
+	}
+
+	KDL_NULLABLE
+	kdl::value const* get_arg(kdl::document const& document, kdl::symbol name) const {
+		return KDL_DocumentIndex_get_arg_symbol(this, &document, name.id());
+	}
+
+	KDL_NULLABLE
+	kdl::entry const* get_prop(kdl::node const& node, kdl::symbol name) const {
+		return KDL_DocumentIndex_get_prop_symbol(this, &node, name.id());
+	}
+
+	/// @brief The symbol for `name`; empty if no node or property in the document has it.
+	kdl::symbol symbol(std::u8string_view name) const {
+		return kdl::symbol(KDL_DocumentIndex_symbol(this, name.data(), name.size()));
+	}
+
+	/// @brief The symbol for an identifier’s name, such as `node.name()`; found by address, without
+	/// hashing the string, when the identifier belongs to the indexed document.
+	kdl::symbol symbol(kdl::identifier const& name) const {
+		return kdl::symbol(KDL_DocumentIndex_name_symbol(this, &name));
+	}
+
+	std::u8string_view name(kdl::symbol symbol) const {
+		size_t length;
+		char8_t const* string = KDL_DocumentIndex_symbol_name(this, symbol.id(), &length);
+		return { string, length };
+	}
 };
 
 /// @brief Represents a KDL Argument or KDL Property.
@@ -243,12 +1004,228 @@ struct KDL_Node {
 		return KDL_Node_get_arg(this, index);
 	}
 
+	/// @brief Copies all arguments into `values` in one call; integers convert.
+	/// @param count Receives the number of arguments, or the index of a mistyped one.
+	KdlArgsStatus args(std::span<double> values, size_t& count) const {
+		return KDL_Node_args_f64(this, values.data(), values.size(), &count);
+	}
+
+	/// @brief Copies all arguments into `values` in one call.
+	/// @param count Receives the number of arguments, or the index of a mistyped one.
+	KdlArgsStatus args(std::span<int64_t> values, size_t& count) const {
+		return KDL_Node_args_i64(this, values.data(), values.size(), &count);
+	}
+
+	/// @brief Hashes this node’s content and children, ignoring formatting and comments.
+	uint64_t hash() const {
+		return KDL_Node_hash(this);
+	}
+
 	KDL_NULLABLE
 	kdl::document const* children() const {
 		return KDL_Node_children(this);
 	}
 };
 
+/// @brief A KDL Document whose children blocks are parsed on first access.
+struct KDL_LazyDocument {
+	KDL_OPAQUE(KDL_LazyDocument);
+
+	/// @brief Parses a document, only brace-matching children blocks. The
+	/// document keeps its own copy of `source`.
+	static std::variant<kdl::lazy_document_ptr, kdl::error_ptr> parse(std::u8string_view source) {
+		kdl::lazy_document* doc;
+		kdl::error* err;
+		if (KDL_Document_parse_lazy(source.data(), source.size(), &doc, &err)) {
+			return kdl::lazy_document_ptr(doc);
+		}
+		else {
+			return kdl::error_ptr(err);
+		}
+	}
+
+	kdl::slice<kdl::lazy_node const> nodes() const {
+		size_t length;
+		kdl::lazy_node const* head = KDL_LazyDocument_nodes(this, &length);
+		return { kdl::detail::iterator(head, (ptrdiff_t)KDL_LazyNode_sizeof), (ptrdiff_t)length };
+	}
+
+	auto begin() const {
+		return nodes().base();
+	}
+
+	auto end() const {
+		auto children = nodes();
+		return children.base() + children.count();
+	}
+
+	KDL_NULLABLE
+	kdl::lazy_node const* get(std::u8string_view name) const {
+		return KDL_LazyDocument_get(this, name.data(), name.size());
+	}
+};
+
+/// @brief A node of a lazy document.
+struct KDL_LazyNode {
+	KDL_OPAQUE(KDL_LazyNode);
+
+	/// @brief The node’s name, type and entries; its `children()` is always null.
+	KDL_NONNULL
+	kdl::node const* node() const {
+		return KDL_LazyNode_node(this);
+	}
+
+	KDL_NONNULL
+	kdl::identifier const* name() const {
+		return node()->name();
+	}
+
+	bool has_children() const {
+		return KDL_LazyNode_has_children(this);
+	}
+
+	/// @brief Parses the children block on first call, safely from any thread.
+	/// @return The children, null if there are none; or the error in the block,
+	/// which this node owns and reports on every call.
+	std::variant<kdl::lazy_document const*, kdl::error const*> children() const {
+		kdl::lazy_document const* doc;
+		kdl::error const* err;
+		if (KDL_LazyNode_children(this, &doc, &err)) {
+			return doc;
+		}
+		else {
+			return err;
+		}
+	}
+};
+
+/// @brief A compiled path query over KDL Documents.
+struct KDL_Query {
+	KDL_OPAQUE(KDL_Query);
+
+	/// @brief Compiles a path query; on failure, returns the byte offset of the syntax error.
+	static std::variant<kdl::query_ptr, size_t> compile(std::u8string_view source) {
+		kdl::query* q;
+		size_t offset;
+		if (KDL_Query_compile(source.data(), source.size(), &q, &offset)) {
+			return kdl::query_ptr(q);
+		}
+		else {
+			return offset;
+		}
+	}
+
+	/// @brief Runs this query, replacing the contents of `matches` (whose capacity is reused).
+	void run(kdl::document const& document, std::vector<kdl::query_match>& matches) const {
+		matches.resize(matches.capacity());
+		size_t count = KDL_Query_run(this, &document, matches.data(), matches.size());
+		if (count > matches.size()) {
+			matches.resize(count);
+			KDL_Query_run(this, &document, matches.data(), matches.size());
+		}
+		matches.resize(count);
+	}
+
+	std::vector<kdl::query_match> run(kdl::document const& document) const {
+		std::vector<kdl::query_match> matches;
+		run(document, matches);
+		return matches;
+	}
+};
+
+/// @brief Incremental parser reporting a document as a stream of events.
+/// Visitors may implement any of `node_begin(name, ty)`, `entry(name, ty, value)`,
+/// `children_begin()`, `children_end()` and `node_end()`, returning `void` or
+/// `bool` (whether to continue).
+struct KDL_EventParser {
+	KDL_OPAQUE(KDL_EventParser);
+
+	static kdl::event_parser_ptr create() {
+		return kdl::event_parser_ptr(KDL_EventParser_new());
+	}
+
+	template<typename Visitor>
+	KdlParseStatus feed(std::u8string_view chunk, Visitor& visitor, kdl::diagnostic* error = nullptr) {
+		auto handler = kdl::detail::event_handler(visitor);
+		return KDL_EventParser_feed(this, chunk.data(), chunk.size(), &handler, error);
+	}
+
+	template<typename Visitor>
+	KdlParseStatus finish(Visitor& visitor, kdl::diagnostic* error = nullptr) {
+		auto handler = kdl::detail::event_handler(visitor);
+		return KDL_EventParser_finish(this, &handler, error);
+	}
+};
+
+/// @brief Streaming KDL serializer, writing to a growable buffer or a sink.
+/// Calls mirror the `kdl::event_parser` visitor protocol; misuse, non-finite
+/// floats and sink failures are reported by `finish()`.
+struct KDL_Writer {
+	KDL_OPAQUE(KDL_Writer);
+
+	static kdl::writer_ptr create() {
+		return kdl::writer_ptr(KDL_Writer_new());
+	}
+
+	/// @brief Creates a writer handing its output to `sink(std::u8string_view)`,
+	/// which returns `void` or `bool` (whether it succeeded) and must outlive the writer.
+	template<typename Sink>
+	static kdl::writer_ptr create(Sink& sink) {
+		KDL_WriteSink s {
+			&sink,
+			[](void* user, char8_t const* data, size_t length) {
+				return kdl::detail::keep_going([&] { return (*static_cast<Sink*>(user))(std::u8string_view(data, length)); });
+			},
+		};
+		return kdl::writer_ptr(KDL_Writer_new_sink(s));
+	}
+
+	void node_begin(std::u8string_view name, std::optional<std::u8string_view> ty = std::nullopt) {
+		KDL_Writer_node_begin(this, kdl::detail::to_flat_string(name), kdl::detail::to_flat_string(ty));
+	}
+
+	void entry(std::optional<std::u8string_view> name, std::optional<std::u8string_view> ty, kdl::value_variant const& value) {
+		auto [which, payload] = kdl::detail::to_flat_value(value);
+		KDL_Writer_entry(this, kdl::detail::to_flat_string(name), kdl::detail::to_flat_string(ty), which, payload);
+	}
+
+	void arg(kdl::value_variant const& value, std::optional<std::u8string_view> ty = std::nullopt) {
+		entry(std::nullopt, ty, value);
+	}
+
+	void prop(std::u8string_view name, kdl::value_variant const& value, std::optional<std::u8string_view> ty = std::nullopt) {
+		entry(name, ty, value);
+	}
+
+	void children_begin() { KDL_Writer_children_begin(this); }
+	void children_end() { KDL_Writer_children_end(this); }
+	void node_end() { KDL_Writer_node_end(this); }
+
+	/// @brief The output not yet handed to a sink.
+	std::u8string_view data() const {
+		size_t length;
+		char8_t const* data = KDL_Writer_data(this, &length);
+		return { data, length };
+	}
+
+	void clear() { KDL_Writer_clear(this); }
+
+	/// @brief Flushes to the sink; returns whether all output was valid and written.
+	bool finish() { return KDL_Writer_finish(this); }
+};
+
+namespace kdl {
+
+/// @brief Parses a document as a stream of events, without building it.
+/// See `kdl::event_parser` for the visitor protocol.
+template<typename Visitor>
+KdlParseStatus parse_events(std::u8string_view source, Visitor& visitor, kdl::diagnostic* error = nullptr) {
+	auto handler = kdl::detail::event_handler(visitor);
+	return KDL_Parse_events(source.data(), source.size(), &handler, error);
+}
+
+} // namespace kdl
+
 /// @brief A specific KDL Value.
 struct KDL_Value {
 	std::optional<std::u8string_view> string() const {
@@ -301,13 +1278,7 @@ struct KDL_Value {
 		}
 	}
 
-	std::variant<
-		std::monostate,
-		std::u8string_view,
-		int64_t,
-		double,
-		bool
-	> which() const {
+	kdl::value_variant which() const {
 		switch (KDL_Value_which(this)) {
 		case KDL_VALUE_WHICH_NULL:
 			return *null();
@@ -360,4 +1331,347 @@ struct KDL_Error {
 	}
 };
 
+/// @brief Every error found in one pass over a document.
+struct KDL_ErrorList {
+	KDL_OPAQUE(KDL_ErrorList);
+
+	/// @brief Checks `source` without building it. With `recover`, checking resumes
+	/// after each top-level node that fails; otherwise it stops at the first error.
+	static kdl::error_list_ptr check(std::u8string_view source, bool recover = true) {
+		return kdl::error_list_ptr(KDL_Document_check(source.data(), source.size(), recover));
+	}
+
+	std::span<kdl::diagnostic const> items() const {
+		size_t length;
+		kdl::diagnostic const* head = KDL_ErrorList_items(this, &length);
+		return { head, length };
+	}
+
+	auto begin() const {
+		return items().begin();
+	}
+
+	auto end() const {
+		return items().end();
+	}
+
+	bool empty() const {
+		return items().empty();
+	}
+};
+
+/// @brief Line start offsets of a document, for locating byte offsets.
+struct KDL_LineIndex {
+	KDL_OPAQUE(KDL_LineIndex);
+
+	static kdl::line_index_ptr create(std::u8string_view source) {
+		return kdl::line_index_ptr(KDL_LineIndex_new(source.data(), source.size()));
+	}
+
+	/// @brief Finds the line and column of a byte offset, by binary search.
+	kdl::location locate(size_t offset) const {
+		return KDL_LineIndex_locate(this, offset);
+	}
+
+	kdl::location locate(kdl::diagnostic const& error) const {
+		return locate(error.offset);
+	}
+};
+
+/// @brief The nodes that differ between two KDL Documents.
+struct KDL_Diff {
+	KDL_OPAQUE(KDL_Diff);
+
+	std::span<kdl::change const> changes() const {
+		size_t length;
+		kdl::change const* head = KDL_Diff_changes(this, &length);
+		return { head, length };
+	}
+
+	auto begin() const {
+		return changes().begin();
+	}
+
+	auto end() const {
+		return changes().end();
+	}
+
+	bool empty() const {
+		return changes().empty();
+	}
+};
+
+namespace kdl {
+
+/// @brief Compares two documents, skipping subtrees whose hashes match, and
+/// reports added, removed and changed nodes with their paths. The result
+/// refers to both documents, which must outlive it.
+inline kdl::diff_ptr diff(kdl::document const& old_document, kdl::document const& new_document) {
+	return kdl::diff_ptr(KDL_Document_diff(&old_document, &new_document));
+}
+
+/// @brief Why a node could not be bound to a struct.
+enum class bind_status {
+	/// @brief A required field was absent.
+	missing,
+	/// @brief A field had the wrong type of value, or one out of range.
+	mistyped,
+};
+
+/// @brief A field that could not be bound.
+struct bind_error {
+	bind_status status;
+	/// @brief The node being bound.
+	kdl::flat_node node;
+	/// @brief The property or child node name; empty for an argument.
+	std::u8string_view name;
+	/// @brief The argument index, for an argument.
+	size_t index;
+};
+
+/// @brief Describes how `kdl::bind` fills in a `T`. Specializations provide
+/// `static constexpr auto fields = std::tuple{ ... };` built from `kdl::arg`,
+/// `kdl::prop` and `kdl::child`.
+template<typename T>
+struct binding;
+
+namespace detail {
+
+/// @brief 64-bit FNV-1a, for hashing field names at compile time.
+constexpr uint64_t fnv1a(std::u8string_view s) {
+	uint64_t hash = 0xcbf29ce484222325;
+	for (char8_t c : s) {
+		hash ^= c;
+		hash *= 0x100000001b3;
+	}
+	return hash;
+}
+
+template<typename T>
+struct is_optional : std::false_type {};
+template<typename T>
+struct is_optional<std::optional<T>> : std::true_type {};
+
+template<typename T>
+struct is_vector : std::false_type {};
+template<typename T, typename A>
+struct is_vector<std::vector<T, A>> : std::true_type {};
+
+template<typename T>
+concept bindable = requires { kdl::binding<T>::fields; };
+
+template<typename T>
+concept optional_bindable = is_optional<T>::value && bindable<typename T::value_type>;
+
+enum class field_kind { arg, prop, child };
+
+template<field_kind Kind, typename T, typename M>
+struct field {
+	static constexpr field_kind kind = Kind;
+	/// @brief Optional and repeated fields may be absent.
+	static constexpr bool required = !is_optional<M>::value && !is_vector<M>::value;
+
+	std::u8string_view name;
+	uint64_t hash;
+	size_t index;
+	M T::* member;
+};
+
+/// @brief Decodes a value in place from its flat columns.
+template<typename M>
+bool decode(uint8_t which, KDL_FlatPayload const& payload, M& out) {
+	if constexpr (is_optional<M>::value) {
+		if (KDL_VALUE_IS_NULL(which)) {
+			out.reset();
+			return true;
+		}
+		return decode(which, payload, out.emplace());
+	}
+	else if constexpr (std::is_same_v<M, bool>) {
+		if (!KDL_VALUE_IS_BOOL(which)) {
+			return false;
+		}
+		out = payload.boolean;
+		return true;
+	}
+	else if constexpr (std::is_integral_v<M>) {
+		if (!KDL_VALUE_IS_INT(which) || !std::in_range<M>(payload.integer)) {
+			return false;
+		}
+		out = static_cast<M>(payload.integer);
+		return true;
+	}
+	else if constexpr (std::is_floating_point_v<M>) {
+		if (KDL_VALUE_IS_FLOAT(which)) {
+			out = static_cast<M>(payload.floating);
+			return true;
+		}
+		if (KDL_VALUE_IS_INT(which)) {
+			out = static_cast<M>(payload.integer);
+			return true;
+		}
+		return false;
+	}
+	else {
+		static_assert(std::is_constructible_v<M, std::u8string_view>, "unsupported field type");
+		if (!KDL_VALUE_IS_STRING(which)) {
+			return false;
+		}
+		out = M(std::u8string_view(payload.string.data, payload.string.length));
+		return true;
+	}
+}
+
+template<bindable T>
+std::optional<kdl::bind_error> bind_node(kdl::flat_node node, T& out);
+
+/// @brief Binds a child node: a struct with its own binding, or else the
+/// child’s first argument.
+template<typename M>
+std::optional<kdl::bind_error> bind_child(kdl::flat_node node, M& out) {
+	if constexpr (is_vector<M>::value) {
+		return bind_child(node, out.emplace_back());
+	}
+	else if constexpr (optional_bindable<M>) {
+		return bind_child(node, out.emplace());
+	}
+	else if constexpr (bindable<M>) {
+		return bind_node(node, out);
+	}
+	else {
+		for (kdl::flat_entry entry : node) {
+			if (!entry.name()) {
+				if (!decode(entry.which(), entry.payload(), out)) {
+					return kdl::bind_error { kdl::bind_status::mistyped, node, {}, 0 };
+				}
+				return std::nullopt;
+			}
+		}
+		return kdl::bind_error { kdl::bind_status::missing, node, {}, 0 };
+	}
+}
+
+/// @brief Calls `visit(field, I)` if field `I` is of kind `Kind` and is the one named `name`
+/// (or, for arguments, at `index`). The hashes are constants, so a chain of these compiles
+/// to a switch on `hash`.
+template<field_kind Kind, size_t I, typename Fields, typename Visit>
+bool visit_field(Fields const& fields, uint64_t hash, std::u8string_view name, size_t index, Visit& visit) {
+	auto const& field = std::get<I>(fields);
+	if constexpr (std::remove_cvref_t<decltype(field)>::kind != Kind) {
+		return false;
+	}
+	else {
+		bool matches;
+		if constexpr (Kind == field_kind::arg) {
+			matches = field.index == index;
+		}
+		else {
+			matches = field.hash == hash && field.name == name;
+		}
+		if (matches) {
+			visit(field, I);
+		}
+		return matches;
+	}
+}
+
+template<field_kind Kind, typename Fields, typename Visit, size_t... I>
+void dispatch(Fields const& fields, uint64_t hash, std::u8string_view name, size_t index, Visit&& visit, std::index_sequence<I...>) {
+	(visit_field<Kind, I>(fields, hash, name, index, visit) || ...);
+}
+
+template<typename Fields, size_t N, size_t... I>
+std::optional<kdl::bind_error> check_required(Fields const& fields, std::array<bool, N> const& seen, kdl::flat_node node, std::index_sequence<I...>) {
+	std::optional<kdl::bind_error> error;
+	((std::remove_cvref_t<decltype(std::get<I>(fields))>::required && !seen[I] && !error
+		&& (error = kdl::bind_error { kdl::bind_status::missing, node, std::get<I>(fields).name, std::get<I>(fields).index }, true)), ...);
+	return error;
+}
+
+template<bindable T>
+std::optional<kdl::bind_error> bind_node(kdl::flat_node node, T& out) {
+	constexpr auto const& fields = kdl::binding<T>::fields;
+	constexpr size_t count = std::tuple_size_v<std::remove_cvref_t<decltype(fields)>>;
+	constexpr auto indices = std::make_index_sequence<count>();
+
+	std::array<bool, count> seen {};
+	std::optional<kdl::bind_error> error;
+	size_t index = 0;
+	for (kdl::flat_entry entry : node) {
+		auto bind_entry = [&](auto const& field, size_t i) {
+			seen[i] = true;
+			if (!decode(entry.which(), entry.payload(), out.*field.member)) {
+				error = kdl::bind_error { kdl::bind_status::mistyped, node, field.name, field.index };
+			}
+		};
+		if (auto key = entry.name()) {
+			dispatch<field_kind::prop>(fields, fnv1a(*key), *key, 0, bind_entry, indices);
+		}
+		else {
+			dispatch<field_kind::arg>(fields, 0, {}, index++, bind_entry, indices);
+		}
+		if (error) {
+			return error;
+		}
+	}
+
+	for (kdl::flat_node child : node.children()) {
+		std::u8string_view key = child.name();
+		dispatch<field_kind::child>(fields, fnv1a(key), key, 0, [&](auto const& field, size_t i) {
+			seen[i] = true;
+			error = bind_child(child, out.*field.member);
+		}, indices);
+		if (error) {
+			return error;
+		}
+	}
+
+	return check_required(fields, seen, node, indices);
+}
+
+} // namespace kdl::detail
+
+/// @brief Binds the argument at `index` to `member`.
+template<typename T, typename M>
+constexpr auto arg(size_t index, M T::* member) {
+	return detail::field<detail::field_kind::arg, T, M> { {}, 0, index, member };
+}
+
+/// @brief Binds the property `name` to `member`; the last one wins.
+template<typename T, typename M>
+constexpr auto prop(std::u8string_view name, M T::* member) {
+	return detail::field<detail::field_kind::prop, T, M> { name, detail::fnv1a(name), 0, member };
+}
+
+/// @brief Binds child nodes named `name` to `member`: through the member type’s own
+/// binding if it has one, or else from the child’s first argument. `std::vector`
+/// members collect every such child; others take the last.
+template<typename T, typename M>
+constexpr auto child(std::u8string_view name, M T::* member) {
+	return detail::field<detail::field_kind::child, T, M> { name, detail::fnv1a(name), 0, member };
+}
+
+/// @brief Binds `node` to `out` in one pass over its entries and children,
+/// as described by `kdl::binding<T>`. Values are decoded from the flattened
+/// document’s columns in place, so flatten a document once and bind its nodes.
+/// Unknown entries and children are ignored; `std::optional` and `std::vector`
+/// fields may be absent.
+/// @return The first field that could not be bound, if any.
+template<detail::bindable T>
+std::optional<kdl::bind_error> bind(kdl::flat_node node, T& out) {
+	return detail::bind_node(node, out);
+}
+
+/// @brief Binds `node` to a new `T`; see `bind(node, out)`.
+template<detail::bindable T>
+std::variant<T, kdl::bind_error> bind(kdl::flat_node node) {
+	T out {};
+	if (auto error = detail::bind_node(node, out)) {
+		return *error;
+	}
+	return out;
+}
+
+} // namespace kdl
+
 #endif // KDL_HXX
@@ -0,0 +1,539 @@
+use crate::stats;
+use kdl::*;
+use std::alloc::{GlobalAlloc, Layout, System};
+use std::cell::Cell;
+use std::sync::atomic::{AtomicUsize, Ordering};
+use std::sync::{Mutex, PoisonError};
+use std::{mem, ptr, slice, str};
+
+const CHUNK_SHIFT: u32 = 20;
+/// Size and alignment of arena chunks. Alignment lets any pointer be mapped
+/// back to its chunk, and so be recognized as arena memory when freed.
+const CHUNK: usize = 1 << CHUNK_SHIFT;
+/// Allocations larger than this get a chunk of their own.
+const LARGE: usize = CHUNK / 4;
+/// Bytes of freed arenas' chunks kept for later arenas; the rest go back to
+/// the system.
+const POOL_LIMIT: usize = 16 * CHUNK;
+
+/// Header at the start of every chunk, linking the chunks of an arena.
+#[repr(C)]
+struct Chunk {
+    next: *mut Chunk,
+    size: usize,
+}
+
+const HEADER: usize = mem::size_of::<Chunk>();
+
+/// One bit per chunk-aligned address, marking those that start a chunk of a
+/// live arena.
+mod registry {
+    use super::CHUNK_SHIFT;
+    use std::alloc::{GlobalAlloc, Layout, System};
+    use std::ptr;
+    use std::sync::atomic::{AtomicPtr, AtomicU64, AtomicUsize, Ordering};
+
+    const ADDRESS_BITS: u32 = 48;
+    const LEAF_BITS: u32 = 16;
+    const LEAF_WORDS: usize = (1 << LEAF_BITS) / 64;
+    const ROOT_LEN: usize = 1 << (ADDRESS_BITS - CHUNK_SHIFT - LEAF_BITS);
+
+    #[allow(clippy::declare_interior_mutable_const)]
+    const EMPTY: AtomicPtr<AtomicU64> = AtomicPtr::new(ptr::null_mut());
+    static ROOT: [AtomicPtr<AtomicU64>; ROOT_LEN] = [EMPTY; ROOT_LEN];
+    /// Registered chunks; while zero, nothing needs looking up.
+    static LIVE: AtomicUsize = AtomicUsize::new(0);
+
+    fn locate(address: usize) -> Option<(usize, usize, u64)> {
+        if (address as u64) >> ADDRESS_BITS != 0 {
+            return None;
+        }
+        let index = address >> CHUNK_SHIFT;
+        let bit = index & ((1 << LEAF_BITS) - 1);
+        Some((index >> LEAF_BITS, bit / 64, 1 << (bit % 64)))
+    }
+
+    /// Registers the chunk at `base`; fails if it cannot be tracked.
+    pub(super) unsafe fn insert(base: *mut u8) -> bool {
+        let Some((root, word, mask)) = locate(base as usize) else {
+            return false;
+        };
+        let mut leaf = ROOT[root].load(Ordering::Acquire);
+        if leaf.is_null() {
+            let layout = Layout::array::<AtomicU64>(LEAF_WORDS).unwrap();
+            let fresh = System.alloc_zeroed(layout) as *mut AtomicU64;
+            if fresh.is_null() {
+                return false;
+            }
+            match ROOT[root].compare_exchange(
+                ptr::null_mut(),
+                fresh,
+                Ordering::AcqRel,
+                Ordering::Acquire,
+            ) {
+                Ok(_) => leaf = fresh,
+                Err(winner) => {
+                    System.dealloc(fresh as *mut u8, layout);
+                    leaf = winner;
+                }
+            }
+        }
+        (*leaf.add(word)).fetch_or(mask, Ordering::Release);
+        LIVE.fetch_add(1, Ordering::Release);
+        true
+    }
+
+    /// Unregisters the chunk at `base`, which was registered.
+    pub(super) fn remove(base: *mut u8) {
+        let (root, word, mask) = locate(base as usize).unwrap();
+        let leaf = ROOT[root].load(Ordering::Acquire);
+        unsafe { (*leaf.add(word)).fetch_and(!mask, Ordering::Release) };
+        LIVE.fetch_sub(1, Ordering::Release);
+    }
+
+    /// Whether `ptr` lies in the first `CHUNK` bytes of an arena chunk.
+    pub(super) fn contains(ptr: *mut u8) -> bool {
+        if LIVE.load(Ordering::Acquire) == 0 {
+            return false;
+        }
+        let Some((root, word, mask)) = locate(ptr as usize) else {
+            return false;
+        };
+        let leaf = ROOT[root].load(Ordering::Acquire);
+        !leaf.is_null() && unsafe { (*leaf.add(word)).load(Ordering::Acquire) } & mask != 0
+    }
+}
+
+/// Chunks of freed arenas, up to `POOL_LIMIT` bytes, in two lists linked
+/// through their headers: those of `CHUNK` bytes, and larger ones. They are
+/// unregistered while pooled, so that freeing memory outside any arena never
+/// has to look them up.
+struct Pool {
+    small: *mut Chunk,
+    large: *mut Chunk,
+    bytes: usize,
+}
+
+unsafe impl Send for Pool {}
+
+static POOL: Mutex<Pool> = Mutex::new(Pool {
+    small: ptr::null_mut(),
+    large: ptr::null_mut(),
+    bytes: 0,
+});
+
+impl Pool {
+    /// Takes a chunk of at least `size` bytes, if any.
+    unsafe fn take(&mut self, size: usize) -> Option<*mut Chunk> {
+        let mut link = if size == CHUNK {
+            &mut self.small
+        } else {
+            &mut self.large
+        };
+        while !link.is_null() {
+            let chunk = *link;
+            if (*chunk).size >= size {
+                *link = (*chunk).next;
+                self.bytes -= (*chunk).size;
+                return Some(chunk);
+            }
+            link = &mut (*chunk).next;
+        }
+        None
+    }
+
+    /// Keeps an unregistered chunk, or gives it back to the system if the
+    /// pool is full.
+    unsafe fn put(&mut self, chunk: *mut Chunk) {
+        let size = (*chunk).size;
+        if self.bytes + size > POOL_LIMIT {
+            System.dealloc(
+                chunk as *mut u8,
+                Layout::from_size_align_unchecked(size, CHUNK),
+            );
+            return;
+        }
+        self.bytes += size;
+        let list = if size == CHUNK {
+            &mut self.small
+        } else {
+            &mut self.large
+        };
+        (*chunk).next = *list;
+        *list = chunk;
+    }
+}
+
+/// Bump allocator backing documents parsed into it.
+pub struct KdlArena {
+    cur: Cell<usize>,
+    end: Cell<usize>,
+    chunks: Cell<*mut Chunk>,
+}
+
+impl KdlArena {
+    fn new() -> Self {
+        KdlArena {
+            cur: Cell::new(0),
+            end: Cell::new(0),
+            chunks: Cell::new(ptr::null_mut()),
+        }
+    }
+
+    /// Takes a chunk of at least `size` bytes from the pool, or else
+    /// allocates and registers one, returning its base.
+    unsafe fn chunk(&self, size: usize) -> Option<*mut u8> {
+        let pooled = POOL
+            .lock()
+            .unwrap_or_else(PoisonError::into_inner)
+            .take(size);
+        let (base, size) = match pooled {
+            Some(chunk) => (chunk as *mut u8, (*chunk).size),
+            None => {
+                let layout = Layout::from_size_align(size, CHUNK).ok()?;
+                let base = System.alloc(layout);
+                if base.is_null() {
+                    return None;
+                }
+                (base, size)
+            }
+        };
+        if !registry::insert(base) {
+            System.dealloc(base, Layout::from_size_align_unchecked(size, CHUNK));
+            return None;
+        }
+        (base as *mut Chunk).write(Chunk {
+            next: self.chunks.get(),
+            size,
+        });
+        self.chunks.set(base as *mut Chunk);
+        Some(base)
+    }
+
+    unsafe fn alloc(&self, layout: Layout) -> Option<*mut u8> {
+        if layout.size() > LARGE || layout.align() > LARGE {
+            if layout.align() > CHUNK / 2 {
+                return None;
+            }
+            // Keep the result within the first chunk-aligned block, where
+            // `registry::contains` can find it.
+            let offset = (HEADER + layout.align() - 1) & !(layout.align() - 1);
+            let size = (offset + layout.size() + CHUNK - 1) & !(CHUNK - 1);
+            return self.chunk(size).map(|base| base.add(offset));
+        }
+        let start = (self.cur.get() + layout.align() - 1) & !(layout.align() - 1);
+        if self.cur.get() != 0 && start + layout.size() <= self.end.get() {
+            self.cur.set(start + layout.size());
+            return Some(start as *mut u8);
+        }
+        let base = self.chunk(CHUNK)? as usize;
+        self.end.set(base + CHUNK);
+        let start = (base + HEADER + layout.align() - 1) & !(layout.align() - 1);
+        self.cur.set(start + layout.size());
+        Some(start as *mut u8)
+    }
+
+    /// Grows or shrinks the most recent allocation where it is.
+    fn resize(&self, ptr: *mut u8, layout: Layout, new_size: usize) -> bool {
+        let last = ptr as usize + layout.size() == self.cur.get();
+        if last && ptr as usize + new_size <= self.end.get() {
+            self.cur.set(ptr as usize + new_size);
+            true
+        } else {
+            false
+        }
+    }
+
+    /// Runs `f` with every allocation on this thread served by this arena,
+    /// except within `outside`. Nothing allocated so may be freed after the
+    /// arena, whose memory may have gone back to the system.
+    pub(crate) fn scope<R>(&self, f: impl FnOnce() -> R) -> R {
+        SCOPES.fetch_add(1, Ordering::Relaxed);
+        let _scoped = Scoped;
+        let _restore = Restore(CURRENT.with(|current| current.replace(self)));
+        f()
+    }
+}
+
+impl Drop for KdlArena {
+    fn drop(&mut self) {
+        let mut pool = POOL.lock().unwrap_or_else(PoisonError::into_inner);
+        let mut chunk = self.chunks.get();
+        while !chunk.is_null() {
+            unsafe {
+                let next = (*chunk).next;
+                // Its documents need not have been freed one by one.
+                stats::forget_range(chunk as usize, chunk as usize + (*chunk).size);
+                registry::remove(chunk as *mut u8);
+                pool.put(chunk);
+                chunk = next;
+            }
+        }
+    }
+}
+
+thread_local! {
+    static CURRENT: Cell<*const KdlArena> = const { Cell::new(ptr::null()) };
+}
+
+/// Arena scopes open on any thread; while zero, allocating need not look up
+/// the thread's arena.
+static SCOPES: AtomicUsize = AtomicUsize::new(0);
+
+/// Closes an arena scope when dropped, also when unwinding.
+struct Scoped;
+
+impl Drop for Scoped {
+    fn drop(&mut self) {
+        SCOPES.fetch_sub(1, Ordering::Relaxed);
+    }
+}
+
+/// Puts back the thread's previous arena when dropped, also when unwinding.
+struct Restore(*const KdlArena);
+
+impl Drop for Restore {
+    fn drop(&mut self) {
+        let _ = CURRENT.try_with(|current| current.set(self.0));
+    }
+}
+
+/// Runs `f` with allocations served by the system allocator even within an
+/// arena's scope, for whatever must not go away with the arena, such as
+/// caches and bookkeeping.
+pub(crate) fn outside<R>(f: impl FnOnce() -> R) -> R {
+    let previous = CURRENT.try_with(|current| current.replace(ptr::null()));
+    let _restore = Restore(previous.unwrap_or(ptr::null()));
+    f()
+}
+
+/// Whether `ptr` is arena memory, so freeing what it points to is left to
+/// its arena, which may already have been freed.
+pub(crate) fn owns<T>(ptr: *const T) -> bool {
+    registry::contains(ptr as *mut u8)
+}
+
+fn current() -> Option<&'static KdlArena> {
+    // A thread sees its own scopes, so this only skips other threads'.
+    if SCOPES.load(Ordering::Relaxed) == 0 {
+        return None;
+    }
+    let arena = CURRENT.try_with(Cell::get).unwrap_or(ptr::null());
+    unsafe { arena.as_ref() }
+}
+
+/// Serves allocations from the thread's current arena, if any, and the
+/// system allocator otherwise. Freeing memory of a live arena does nothing,
+/// wherever it happens: the memory goes back with the arena. Outside any
+/// arena scope or parse, allocating costs two relaxed loads over the system
+/// allocator, and freeing one while no arena is live.
+struct Allocator;
+
+#[global_allocator]
+static ALLOCATOR: Allocator = Allocator;
+
+impl Allocator {
+    unsafe fn allocate(&self, layout: Layout) -> *mut u8 {
+        match current().and_then(|arena| arena.alloc(layout)) {
+            Some(ptr) => ptr,
+            None => System.alloc(layout),
+        }
+    }
+}
+
+unsafe impl GlobalAlloc for Allocator {
+    unsafe fn alloc(&self, layout: Layout) -> *mut u8 {
+        stats::on_alloc(layout.size());
+        self.allocate(layout)
+    }
+
+    unsafe fn alloc_zeroed(&self, layout: Layout) -> *mut u8 {
+        stats::on_alloc(layout.size());
+        match current().and_then(|arena| arena.alloc(layout)) {
+            Some(ptr) => {
+                ptr.write_bytes(0, layout.size());
+                ptr
+            }
+            None => System.alloc_zeroed(layout),
+        }
+    }
+
+    unsafe fn dealloc(&self, ptr: *mut u8, layout: Layout) {
+        stats::on_dealloc(layout.size());
+        if !registry::contains(ptr) {
+            System.dealloc(ptr, layout)
+        }
+    }
+
+    unsafe fn realloc(&self, ptr: *mut u8, layout: Layout, new_size: usize) -> *mut u8 {
+        stats::on_dealloc(layout.size());
+        stats::on_alloc(new_size);
+        if !registry::contains(ptr) {
+            return System.realloc(ptr, layout, new_size);
+        }
+        if current().map_or(false, |arena| arena.resize(ptr, layout, new_size)) {
+            return ptr;
+        }
+        let moved = self.allocate(Layout::from_size_align_unchecked(new_size, layout.align()));
+        if !moved.is_null() {
+            ptr::copy_nonoverlapping(ptr, moved, layout.size().min(new_size));
+        }
+        moved
+    }
+}
+
+#[no_mangle]
+pub extern "C" fn KDL_Arena_new() -> Box<KdlArena> {
+    Box::new(KdlArena::new())
+}
+
+#[no_mangle]
+pub extern "C" fn KDL_Arena_free(_arena: Box<KdlArena>) {}
+
+#[no_mangle]
+pub unsafe extern "C" fn KDL_Document_parse_in(
+    arena: &KdlArena,
+    s: *const u8,
+    len: usize,
+    docptr: &mut *mut KdlDocument,
+    errptr: &mut *mut KdlError,
+) -> bool {
+    let s = str::from_utf8_unchecked(slice::from_raw_parts(s, len));
+    // Only the result goes in the arena; what is recorded about it must not.
+    let result = stats::record(len, Default::default(), |timing| {
+        arena.scope(|| {
+            timing
+                .parse(|| s.parse::<KdlDocument>())
+                .map(Box::new)
+                .map_err(Box::new)
+        })
+    });
+    match result {
+        Ok(doc) => {
+            *docptr = Box::into_raw(doc);
+            *errptr = ptr::null_mut();
+            true
+        }
+        Err(err) => {
+            *docptr = ptr::null_mut();
+            *errptr = Box::into_raw(err);
+            false
+        }
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use std::panic::{self, AssertUnwindSafe};
+    use std::thread;
+
+    /// Whether `ptr` is in one of `arena`'s chunks.
+    fn in_arena<T>(arena: &KdlArena, ptr: *const T) -> bool {
+        let base = (ptr as usize & !(CHUNK - 1)) as *mut Chunk;
+        let mut chunk = arena.chunks.get();
+        while !chunk.is_null() {
+            if chunk == base {
+                return true;
+            }
+            chunk = unsafe { (*chunk).next };
+        }
+        false
+    }
+
+    /// Lets a test hand an arena to another thread, as C callers may.
+    struct Sent(Box<KdlArena>);
+
+    unsafe impl Send for Sent {}
+
+    impl Sent {
+        fn free(self) {
+            KDL_Arena_free(self.0);
+        }
+    }
+
+    #[test]
+    fn scope_is_restored_on_unwind() {
+        let arena = KdlArena::new();
+        let result = panic::catch_unwind(AssertUnwindSafe(|| {
+            // Unwinds without a panic message, which the test harness would
+            // capture into a buffer that outlives the arena.
+            arena.scope(|| -> () { panic::resume_unwind(Box::new(())) })
+        }));
+        assert!(result.is_err());
+        assert!(current().is_none());
+        let after = vec![0u8; 16];
+        assert!(!owns(after.as_ptr()));
+    }
+
+    #[test]
+    fn nested_arenas_and_opting_out() {
+        let outer = KdlArena::new();
+        let inner = KdlArena::new();
+        let (a, b, c, d) = outer.scope(|| {
+            let a = vec![1u8; 64];
+            let (b, c) = inner.scope(|| (vec![2u8; 64], outside(|| vec![3u8; 64])));
+            let d = vec![4u8; 64];
+            (a, b, c, d)
+        });
+        assert!(in_arena(&outer, a.as_ptr()) && in_arena(&outer, d.as_ptr()));
+        assert!(in_arena(&inner, b.as_ptr()));
+        assert!(!owns(c.as_ptr()));
+        assert!(current().is_none());
+
+        // Freeing into an arena that is not current, or not the owner, is ignored.
+        inner.scope(|| drop(a));
+        outer.scope(|| drop(b));
+        assert_eq!(d, [4u8; 64]);
+        assert_eq!(c, [3u8; 64]);
+    }
+
+    #[test]
+    fn growing_stays_in_the_arena() {
+        let arena = KdlArena::new();
+        let (small, large) = arena.scope(|| {
+            let mut small = Vec::new();
+            for i in 0..10_000u32 {
+                small.push(i);
+            }
+            (small, vec![7u8; CHUNK])
+        });
+        assert!(in_arena(&arena, small.as_ptr()) && in_arena(&arena, large.as_ptr()));
+        assert!(small.iter().copied().eq(0..10_000));
+        assert!(large.iter().all(|&b| b == 7));
+    }
+
+    #[test]
+    fn freed_arenas_keep_a_bounded_pool() {
+        let arena = KdlArena::new();
+        let chunks: Vec<Vec<u8>> = arena.scope(|| (0..24).map(|_| vec![1u8; LARGE * 2]).collect());
+        assert!(chunks.iter().all(|chunk| owns(chunk.as_ptr())));
+        // Arena memory is not freed on its own, nor after the arena.
+        mem::forget(chunks);
+        drop(arena);
+        assert!(POOL.lock().unwrap().bytes <= POOL_LIMIT);
+
+        // A later arena reuses what was kept.
+        let next = KdlArena::new();
+        let live = next.scope(|| vec![3u8; LARGE * 2]);
+        assert!(owns(live.as_ptr()) && live.iter().all(|&b| b == 3));
+    }
+
+    #[test]
+    fn cross_thread_frees() {
+        let arena = Box::new(KdlArena::new());
+        let (early, late) = arena.scope(|| {
+            let mut early: Vec<Vec<u32>> = (0..8).map(|i| vec![i; 256]).collect();
+            let late = early.split_off(4);
+            (early, late)
+        });
+        assert!(early
+            .iter()
+            .chain(&late)
+            .all(|v| in_arena(&arena, v.as_ptr())));
+        let arena = Sent(arena);
+        thread::spawn(move || drop(early)).join().unwrap();
+        thread::spawn(move || drop(late)).join().unwrap();
+        thread::spawn(move || arena.free()).join().unwrap();
+    }
+}
@@ -0,0 +1,165 @@
+use crate::stats;
+use kdl::*;
+use std::panic;
+use std::sync::atomic::{AtomicUsize, Ordering};
+use std::{ptr, slice, str, thread};
+
+/// The caller's arrays; each index is read and written by exactly one worker.
+struct Batch {
+    strings: *const *const u8,
+    lengths: *const usize,
+    docs: *mut *mut KdlDocument,
+    errs: *mut *mut KdlError,
+}
+
+unsafe impl Sync for Batch {}
+
+impl Batch {
+    /// Parses input `i` into its output slots, returning whether it succeeded.
+    unsafe fn parse(&self, i: usize) -> bool {
+        let len = *self.lengths.add(i);
+        let s = if len == 0 {
+            &[]
+        } else {
+            slice::from_raw_parts(*self.strings.add(i), len)
+        };
+        let s = str::from_utf8_unchecked(s);
+        let (doc, err) = match stats::record(len, Default::default(), |timing| {
+            timing.parse(|| s.parse::<KdlDocument>())
+        }) {
+            Ok(doc) => (Box::into_raw(doc), ptr::null_mut()),
+            Err(err) => (ptr::null_mut(), Box::into_raw(err)),
+        };
+        *self.docs.add(i) = doc;
+        *self.errs.add(i) = err;
+        err.is_null()
+    }
+}
+
+/// Resolves a requested thread count, where 0 means one per core.
+pub(crate) fn thread_count(threads: usize) -> usize {
+    match threads {
+        0 => thread::available_parallelism().map_or(1, |n| n.get()),
+        n => n,
+    }
+}
+
+/// Runs `work(i)` for every `i < count` on up to `threads` threads (0 for one
+/// per core). Workers claim the next unclaimed index as they finish, so a few
+/// large inputs do not hold up the rest. What the workers allocate is counted
+/// as the calling thread's, for `stats::record`.
+pub(crate) fn for_each_index(count: usize, threads: usize, work: impl Fn(usize) + Sync) {
+    let threads = thread_count(threads).min(count);
+    if threads <= 1 {
+        (0..count).for_each(work);
+        return;
+    }
+    let next = AtomicUsize::new(0);
+    let worker = || loop {
+        let i = next.fetch_add(1, Ordering::Relaxed);
+        if i >= count {
+            break;
+        }
+        work(i);
+    };
+    thread::scope(|scope| {
+        let workers: Vec<_> = (1..threads)
+            .map(|_| {
+                scope.spawn(|| {
+                    worker();
+                    stats::heap()
+                })
+            })
+            .collect();
+        worker();
+        for worker in workers {
+            match worker.join() {
+                Ok(heap) => stats::credit(heap),
+                Err(payload) => panic::resume_unwind(payload),
+            }
+        }
+    });
+}
+
+#[no_mangle]
+pub unsafe extern "C" fn KDL_Document_parse_many(
+    count: usize,
+    strings: *const *const u8,
+    lengths: *const usize,
+    docs: *mut *mut KdlDocument,
+    errs: *mut *mut KdlError,
+    threads: usize,
+) -> usize {
+    let batch = Batch {
+        strings,
+        lengths,
+        docs,
+        errs,
+    };
+    let failed = AtomicUsize::new(0);
+    for_each_index(count, threads, |i| {
+        if !batch.parse(i) {
+            failed.fetch_add(1, Ordering::Relaxed);
+        }
+    });
+    failed.into_inner()
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use std::sync::atomic::AtomicBool;
+
+    fn parse_many(sources: &[&str], threads: usize) -> Vec<Result<usize, usize>> {
+        let mut strings: Vec<*const u8> = sources.iter().map(|s| s.as_ptr()).collect();
+        // Empty inputs may come without a buffer.
+        for (string, s) in strings.iter_mut().zip(sources) {
+            if s.is_empty() {
+                *string = ptr::null();
+            }
+        }
+        let lengths: Vec<usize> = sources.iter().map(|s| s.len()).collect();
+        let mut docs = vec![ptr::null_mut(); sources.len()];
+        let mut errs = vec![ptr::null_mut(); sources.len()];
+        let failed = unsafe {
+            KDL_Document_parse_many(
+                sources.len(),
+                strings.as_ptr(),
+                lengths.as_ptr(),
+                docs.as_mut_ptr(),
+                errs.as_mut_ptr(),
+                threads,
+            )
+        };
+        let results: Vec<_> = docs
+            .into_iter()
+            .zip(errs)
+            .map(|(doc, err)| match (doc.is_null(), err.is_null()) {
+                (false, true) => Ok(unsafe { Box::from_raw(doc) }.nodes().len()),
+                (true, false) => Err(unsafe { Box::from_raw(err) }.span.offset()),
+                _ => panic!("exactly one of the document and error is set"),
+            })
+            .collect();
+        assert_eq!(failed, results.iter().filter(|r| r.is_err()).count());
+        results
+    }
+
+    #[test]
+    fn each_input_gets_its_own_result() {
+        let sources = ["a\nb\n", "", "a 0x\n", "a { b; c }\n", "a \"", "a"];
+        let expected = [Ok(2), Ok(0), Err(2), Ok(1), Err(2), Ok(1)];
+        for threads in [1, 2, 4, 0] {
+            assert_eq!(parse_many(&sources, threads), expected);
+        }
+        assert_eq!(parse_many(&[], 0), []);
+    }
+
+    #[test]
+    fn every_index_runs_once() {
+        let ran: Vec<AtomicBool> = (0..1000).map(|_| AtomicBool::new(false)).collect();
+        for_each_index(ran.len(), 8, |i| {
+            assert!(!ran[i].swap(true, Ordering::Relaxed));
+        });
+        assert!(ran.iter().all(|ran| ran.load(Ordering::Relaxed)));
+    }
+}
@@ -0,0 +1,239 @@
+use crate::events::{self, report, Handler, KdlDiagnostic, KdlParseStatus, Stop, Value};
+use crate::flat::{KdlFlatColumns, KdlFlatDocument, KdlFlatPayload, KdlFlatRange, KdlFlatString};
+use std::{ptr, slice};
+
+const NONE: usize = usize::MAX;
+
+/// Gathers each depth's nodes and entries in columns of their own, in one
+/// pass. Breadth-first order is depth by depth, and within one depth it is
+/// document order, so appending the levels in turn gives the final columns;
+/// indices are relative to their level until then.
+struct Builder<'s> {
+    source: &'s str,
+    owned: Vec<Box<str>>,
+    levels: Vec<KdlFlatColumns<'static>>,
+    /// Open nodes, by index within their level.
+    stack: Vec<usize>,
+}
+
+impl<'s> Builder<'s> {
+    fn new(source: &'s str) -> Self {
+        Builder {
+            source,
+            owned: Vec::new(),
+            levels: Vec::new(),
+            stack: Vec::new(),
+        }
+    }
+
+    /// Borrows `s` if it points into the source, and copies it otherwise.
+    fn string(&mut self, s: &str) -> KdlFlatString {
+        let source = self.source.as_bytes().as_ptr_range();
+        if source.contains(&s.as_ptr()) || s.is_empty() {
+            KdlFlatString::new(s)
+        } else {
+            self.owned.push(s.into());
+            KdlFlatString::new(self.owned.last().unwrap())
+        }
+    }
+
+    fn opt_string(&mut self, s: Option<&str>) -> KdlFlatString {
+        s.map_or(KdlFlatString::NONE, |s| self.string(s))
+    }
+
+    /// Nodes so far at `depth`.
+    fn nodes_at(&self, depth: usize) -> usize {
+        self.levels
+            .get(depth)
+            .map_or(0, |level| level.node_name.len())
+    }
+
+    /// Appends the levels, making their indices absolute.
+    fn finish(self) -> Box<KdlFlatDocument<'static>> {
+        let root_count = self.nodes_at(0);
+        let mut flat = KdlFlatColumns::default();
+        // Where the levels above, this one and the one below begin.
+        let (mut parent_base, mut node_base) = (0, 0);
+        for mut level in self.levels {
+            let child_base = node_base + level.node_name.len();
+            let entry_base = flat.entry_name.len();
+            for parent in &mut level.node_parent {
+                if *parent != NONE {
+                    *parent += parent_base;
+                }
+            }
+            for children in &mut level.node_children {
+                children.begin += child_base;
+                children.end += child_base;
+            }
+            for entries in &mut level.node_entries {
+                entries.begin += entry_base;
+                entries.end += entry_base;
+            }
+            flat.node_name.append(&mut level.node_name);
+            flat.node_ty.append(&mut level.node_ty);
+            flat.node_parent.append(&mut level.node_parent);
+            flat.node_children.append(&mut level.node_children);
+            flat.node_entries.append(&mut level.node_entries);
+            flat.entry_name.append(&mut level.entry_name);
+            flat.entry_ty.append(&mut level.entry_ty);
+            flat.value_which.append(&mut level.value_which);
+            flat.value_payload.append(&mut level.value_payload);
+            (parent_base, node_base) = (node_base, child_base);
+        }
+        KdlFlatDocument::new(flat, root_count, self.owned)
+    }
+}
+
+impl Handler for Builder<'_> {
+    fn node_begin(&mut self, name: &str, ty: Option<&str>) -> bool {
+        let depth = self.stack.len();
+        if self.levels.len() == depth {
+            self.levels.push(KdlFlatColumns::default());
+        }
+        let name = self.string(name);
+        let ty = self.opt_string(ty);
+        let parent = self.stack.last().copied().unwrap_or(NONE);
+        let children = self.nodes_at(depth + 1);
+        let level = &mut self.levels[depth];
+        let (node, entry) = (level.node_name.len(), level.entry_name.len());
+        level.node_name.push(name);
+        level.node_ty.push(ty);
+        level.node_parent.push(parent);
+        level.node_entries.push(KdlFlatRange {
+            begin: entry,
+            end: entry,
+        });
+        level.node_children.push(KdlFlatRange {
+            begin: children,
+            end: children,
+        });
+        self.stack.push(node);
+        true
+    }
+
+    fn entry(&mut self, name: Option<&str>, ty: Option<&str>, value: Value<'_>) -> bool {
+        let name = self.opt_string(name);
+        let ty = self.opt_string(ty);
+        let payload = match value {
+            Value::String(s, _) => KdlFlatPayload {
+                string: self.string(s),
+            },
+            Value::Int(i, _) => KdlFlatPayload { integer: i },
+            Value::Float(f) => KdlFlatPayload { floating: f },
+            Value::Bool(b) => KdlFlatPayload { boolean: b },
+            Value::Null => KdlFlatPayload {
+                string: KdlFlatString::NONE,
+            },
+        };
+        let node = *self.stack.last().unwrap();
+        let level = &mut self.levels[self.stack.len() - 1];
+        level.entry_name.push(name);
+        level.entry_ty.push(ty);
+        level.value_which.push(value.which() as u8);
+        level.value_payload.push(payload);
+        level.node_entries[node].end = level.entry_name.len();
+        true
+    }
+
+    fn node_end(&mut self) -> bool {
+        let node = self.stack.pop().unwrap();
+        let depth = self.stack.len();
+        self.levels[depth].node_children[node].end = self.nodes_at(depth + 1);
+        true
+    }
+}
+
+/// Parses `bytes` into a flat document whose strings borrow from `bytes`.
+pub(crate) fn parse(bytes: &[u8]) -> Result<Box<KdlFlatDocument<'static>>, Stop> {
+    let s = events::utf8(bytes)?;
+    let mut builder = Builder::new(s);
+    events::parse(s, &mut builder).map(|()| builder.finish())
+}
+
+#[no_mangle]
+pub unsafe extern "C" fn KDL_Document_parse_borrowed(
+    s: *const u8,
+    len: usize,
+    flatptr: &mut *mut KdlFlatDocument<'static>,
+    error: Option<&mut KdlDiagnostic>,
+) -> bool {
+    let bytes = if len == 0 {
+        &[]
+    } else {
+        slice::from_raw_parts(s, len)
+    };
+    let (flat, result) = match parse(bytes) {
+        Ok(flat) => (Box::into_raw(flat), Ok(())),
+        Err(stop) => (ptr::null_mut(), Err(stop)),
+    };
+    *flatptr = flat;
+    report(result, error) == KdlParseStatus::Ok
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn build(s: &str) -> Box<KdlFlatDocument<'static>> {
+        parse(s.as_bytes()).ok().unwrap()
+    }
+
+    fn strings(column: &[KdlFlatString]) -> Vec<Option<&str>> {
+        column.iter().map(|s| unsafe { s.as_str() }).collect()
+    }
+
+    fn ranges(column: &[KdlFlatRange]) -> Vec<(usize, usize)> {
+        column.iter().map(|r| (r.begin, r.end)).collect()
+    }
+
+    #[test]
+    fn columns_are_breadth_first() {
+        let doc = build("a 1 { b 2; c { d 3 \"x\\ty\" } }\n(t)e k=5 { f }\n");
+        let flat = doc.columns();
+        assert_eq!(
+            strings(&flat.node_name),
+            [
+                Some("a"),
+                Some("e"),
+                Some("b"),
+                Some("c"),
+                Some("f"),
+                Some("d")
+            ]
+        );
+        assert_eq!(strings(&flat.node_ty)[1], Some("t"));
+        assert_eq!(flat.node_parent, [NONE, NONE, 0, 0, 1, 3]);
+        assert_eq!(
+            ranges(&flat.node_children),
+            [(2, 4), (4, 5), (5, 5), (5, 6), (6, 6), (6, 6)]
+        );
+        assert_eq!(
+            ranges(&flat.node_entries),
+            [(0, 1), (1, 2), (2, 3), (3, 3), (3, 3), (3, 5)]
+        );
+        assert_eq!(
+            strings(&flat.entry_name),
+            [None, Some("k"), None, None, None]
+        );
+        let ints: Vec<i64> = [0, 1, 2, 3]
+            .iter()
+            .map(|&e| unsafe { flat.value_payload[e].integer })
+            .collect();
+        assert_eq!(ints, [1, 5, 2, 3]);
+        assert_eq!(
+            unsafe { flat.value_payload[4].string.as_str() },
+            Some("x\ty")
+        );
+    }
+
+    #[test]
+    fn empty_input() {
+        let doc = build("");
+        let flat = doc.columns();
+        assert!(flat.node_name.is_empty() && flat.entry_name.is_empty());
+        let mut out = ptr::null_mut();
+        assert!(unsafe { KDL_Document_parse_borrowed(ptr::null(), 0, &mut out, None) });
+        drop(unsafe { Box::from_raw(out) });
+    }
+}
@@ -0,0 +1,273 @@
+use crate::events::{
+    self, is_newline, Cursor, Handler, KdlDiagnostic, Machine, Stop, NEWLINE_STARTS,
+};
+use crate::parallel::terminators;
+use crate::scan::find;
+use crate::stats;
+use kdl::*;
+use std::{ptr, slice, str};
+
+/// Errors found in a document, in order of offset.
+pub struct KdlErrorList {
+    items: Vec<KdlDiagnostic>,
+}
+
+/// Checks `s` without building it. With `recover`, checking resumes after
+/// each top-level node that fails, so one pass finds an error in every
+/// failing node; otherwise it stops at the first.
+pub(crate) fn check(bytes: &[u8], recover: bool) -> Vec<KdlDiagnostic> {
+    match events::utf8(bytes) {
+        Ok(s) => check_str(s, recover),
+        Err(Stop::Error(diag)) => vec![diag],
+        Err(_) => unreachable!(),
+    }
+}
+
+/// Counts open nodes, stopping the parser as each top-level node ends.
+#[derive(Default)]
+struct TopLevel {
+    depth: usize,
+}
+
+impl Handler for TopLevel {
+    fn node_begin(&mut self, _name: &str, _ty: Option<&str>) -> bool {
+        self.depth += 1;
+        true
+    }
+
+    fn node_end(&mut self) -> bool {
+        self.depth -= 1;
+        self.depth > 0
+    }
+}
+
+fn check_str(s: &str, recover: bool) -> Vec<KdlDiagnostic> {
+    if !recover {
+        return match events::parse(s, &mut ()) {
+            Err(Stop::Error(diag)) => vec![diag],
+            _ => Vec::new(),
+        };
+    }
+    let bounds = terminators(s.as_bytes(), 1);
+    let mut items = Vec::new();
+    let mut cur = Cursor::new(s, 0, true);
+    let mut machine = Machine::default();
+    // Each pass ends at the first top-level terminator, where the parser is
+    // in a clean state and the next pass goes on from, or at an error. After
+    // an error, the next pass starts at the first split point past both the
+    // error and where the parser had got to, so no text is parsed twice. Split
+    // points only say where to resume: a pass is never cut short by one the
+    // error has made wrong, such as one inside a string that never closes.
+    loop {
+        match machine.run(&mut cur, &mut TopLevel::default()) {
+            Ok(_) => break,
+            Err(Stop::Stopped) => debug_assert!(machine.at_top_level()),
+            Err(Stop::Error(diag)) => {
+                let past = diag.offset.max(cur.pos);
+                items.push(diag);
+                match bounds.get(bounds.partition_point(|&end| end <= past)) {
+                    Some(&end) if end < s.len() => cur.pos = end,
+                    _ => break,
+                }
+                machine = Machine::default();
+            }
+            Err(Stop::Incomplete) => unreachable!(),
+        }
+    }
+    items
+}
+
+/// Line start offsets of a document, for finding the line and column of an
+/// offset without scanning from the start.
+pub struct KdlLineIndex {
+    starts: Vec<usize>,
+}
+
+/// A 1-based line, and 1-based byte column within it.
+#[repr(C)]
+#[derive(Clone, Copy)]
+pub struct KdlLocation {
+    line: usize,
+    column: usize,
+}
+
+impl KdlLineIndex {
+    /// Records where each line starts, treating CRLF as one newline.
+    fn new(s: &str) -> Self {
+        let mut starts = vec![0];
+        let mut i = 0;
+        while let Some(n) = find(&s.as_bytes()[i..], NEWLINE_STARTS) {
+            i += n;
+            let c = s[i..].chars().next().unwrap();
+            i += c.len_utf8();
+            if is_newline(c) {
+                if c == '\r' && s.as_bytes().get(i) == Some(&b'\n') {
+                    i += 1;
+                }
+                starts.push(i);
+            }
+        }
+        KdlLineIndex { starts }
+    }
+
+    fn locate(&self, offset: usize) -> KdlLocation {
+        let line = self.starts.partition_point(|&start| start <= offset);
+        KdlLocation {
+            line,
+            column: offset - self.starts[line - 1] + 1,
+        }
+    }
+}
+
+#[no_mangle]
+pub unsafe extern "C" fn KDL_Document_check(
+    s: *const u8,
+    len: usize,
+    recover: bool,
+) -> Box<KdlErrorList> {
+    let bytes = if len == 0 {
+        &[]
+    } else {
+        slice::from_raw_parts(s, len)
+    };
+    Box::new(KdlErrorList {
+        items: check(bytes, recover),
+    })
+}
+
+#[no_mangle]
+pub unsafe extern "C" fn KDL_Document_parse_checked(
+    s: *const u8,
+    len: usize,
+    docptr: &mut *mut KdlDocument,
+    error: Option<&mut KdlDiagnostic>,
+) -> bool {
+    *docptr = ptr::null_mut();
+    let bytes = if len == 0 {
+        &[]
+    } else {
+        slice::from_raw_parts(s, len)
+    };
+    let diag = match events::utf8(bytes) {
+        // The event parser rejects a document first, so a failure never
+        // builds a `KdlError`, which holds a copy of the whole input.
+        Ok(s) => match check_str(s, false).pop() {
+            Some(diag) => diag,
+            None => match stats::record(len, Default::default(), |timing| {
+                timing.parse(|| s.parse::<KdlDocument>())
+            }) {
+                Ok(doc) => {
+                    *docptr = Box::into_raw(doc);
+                    return true;
+                }
+                Err(err) => KdlDiagnostic::from_error(&err),
+            },
+        },
+        Err(Stop::Error(diag)) => diag,
+        Err(_) => unreachable!(),
+    };
+    if let Some(error) = error {
+        *error = diag;
+    }
+    false
+}
+
+#[no_mangle]
+pub extern "C" fn KDL_ErrorList_free(_list: Box<KdlErrorList>) {}
+
+#[no_mangle]
+pub extern "C" fn KDL_ErrorList_items(
+    list: &KdlErrorList,
+    len: &mut usize,
+) -> *const KdlDiagnostic {
+    *len = list.items.len();
+    list.items.as_ptr()
+}
+
+#[no_mangle]
+pub unsafe extern "C" fn KDL_LineIndex_new(s: *const u8, len: usize) -> Box<KdlLineIndex> {
+    let bytes = if len == 0 {
+        &[]
+    } else {
+        slice::from_raw_parts(s, len)
+    };
+    Box::new(KdlLineIndex::new(str::from_utf8_unchecked(bytes)))
+}
+
+#[no_mangle]
+pub extern "C" fn KDL_LineIndex_free(_index: Box<KdlLineIndex>) {}
+
+#[no_mangle]
+pub extern "C" fn KDL_LineIndex_locate(index: &KdlLineIndex, offset: usize) -> KdlLocation {
+    index.locate(offset)
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn offsets(s: &str) -> Vec<usize> {
+        check(s.as_bytes(), true).iter().map(|d| d.offset).collect()
+    }
+
+    #[test]
+    fn recovery_finds_an_error_in_each_failing_node() {
+        assert_eq!(offsets("a 0x\nb 1\nc {\n    d 0x\n}\ne 1=\n"), [2, 19, 27]);
+        assert_eq!(offsets("a 1\nb 2\n"), []);
+    }
+
+    #[test]
+    fn recovery_resumes_after_each_failing_node() {
+        let s = "a 1 { b; }\nc 0x\n".repeat(1000);
+        let expected: Vec<usize> = (0..1000).map(|i| i * 16 + 13).collect();
+        assert_eq!(offsets(&s), expected);
+        // An error inside a children block resumes after the whole node.
+        assert_eq!(offsets("a {\n    b 0x\n    c 0x\n}\nd 0x\n"), [10, 26]);
+    }
+
+    #[test]
+    fn recovery_does_not_cascade() {
+        // Nothing after an unclosed string, comment or block is reported.
+        assert_eq!(offsets("a \"unclosed\nb 0x\nc {\n"), [2]);
+        assert_eq!(offsets("a {\n    b 1\nc 0x\n").len(), 1);
+        assert_eq!(offsets("a /* unclosed\nb 0x\n").len(), 1);
+        // Split points only see `\n`, so one falls inside this string, after
+        // the comment ends at the carriage return; the document is valid.
+        assert_eq!(offsets("a // note\rb \"x\ny\"\nc 1\n"), []);
+    }
+
+    #[test]
+    fn parse_checked_reports_the_first_error() {
+        let s = "a 1\nb \"x\\q\"\nc 0x\n";
+        let (mut doc, mut diag) = (ptr::null_mut(), KdlDiagnostic::new(0, 0, ""));
+        let ok =
+            unsafe { KDL_Document_parse_checked(s.as_ptr(), s.len(), &mut doc, Some(&mut diag)) };
+        assert!(!ok && doc.is_null());
+        assert_eq!(diag.offset, 8);
+
+        let s = "a 1\nb \"x\"\n";
+        assert!(unsafe { KDL_Document_parse_checked(s.as_ptr(), s.len(), &mut doc, None) });
+        assert_eq!(unsafe { Box::from_raw(doc) }.nodes().len(), 2);
+    }
+
+    #[test]
+    fn lines_end_at_every_kind_of_newline() {
+        let s = "a\r\nb\rc\u{85}d\u{2028}e\nf";
+        let index = KdlLineIndex::new(s);
+        let at = |needle: char| {
+            let location = KDL_LineIndex_locate(&index, s.find(needle).unwrap());
+            (location.line, location.column)
+        };
+        assert_eq!(
+            ['a', 'b', 'c', 'd', 'e', 'f'].map(at),
+            [(1, 1), (2, 1), (3, 1), (4, 1), (5, 1), (6, 1)]
+        );
+        // The CR of a CRLF, and the bytes of a longer newline, stay on its line.
+        let location = KDL_LineIndex_locate(&index, 2);
+        assert_eq!((location.line, location.column), (1, 3));
+        let location = KDL_LineIndex_locate(&index, s.find('\u{2028}').unwrap() + 2);
+        assert_eq!((location.line, location.column), (4, 4));
+        let location = KDL_LineIndex_locate(&index, s.len());
+        assert_eq!((location.line, location.column), (6, 2));
+    }
+}
@@ -0,0 +1,512 @@
+use crate::flat::KdlFlatString;
+use crate::stats;
+use crate::writer::push_ident;
+use kdl::*;
+use std::collections::HashMap;
+
+/// 64-bit FNV-1a, fed a fixed encoding of content, so that hashes are the
+/// same on every platform, in every process and in every version of this
+/// library that keeps the encoding: integers are little-endian, strings
+/// are preceded by their length, and each value by a tag for its kind.
+struct Fnv(u64);
+
+impl Fnv {
+    fn new() -> Self {
+        Fnv(0xCBF2_9CE4_8422_2325)
+    }
+
+    fn bytes(&mut self, bytes: &[u8]) {
+        for &b in bytes {
+            self.0 = (self.0 ^ b as u64).wrapping_mul(0x0000_0100_0000_01B3);
+        }
+    }
+
+    fn u8(&mut self, n: u8) {
+        self.bytes(&[n]);
+    }
+
+    fn u64(&mut self, n: u64) {
+        self.bytes(&n.to_le_bytes());
+    }
+
+    fn str(&mut self, s: &str) {
+        self.u64(s.len() as u64);
+        self.bytes(s.as_bytes());
+    }
+
+    /// An absent identifier, distinct from any present one.
+    fn ident(&mut self, identifier: Option<&KdlIdentifier>) {
+        match identifier {
+            Some(identifier) => {
+                self.u8(1);
+                self.str(identifier.value());
+            }
+            None => self.u8(0),
+        }
+    }
+
+    /// What a value means rather than how it was written: an integer is the
+    /// same in any radix, and a string whether raw or quoted.
+    fn value(&mut self, value: &KdlValue) {
+        match value {
+            KdlValue::String(s) | KdlValue::RawString(s) => {
+                self.u8(0);
+                self.str(s);
+            }
+            KdlValue::Base2(i) | KdlValue::Base8(i) | KdlValue::Base10(i) | KdlValue::Base16(i) => {
+                self.u8(1);
+                self.u64(*i as u64);
+            }
+            KdlValue::Base10Float(f) => {
+                self.u8(2);
+                self.u64(f.to_bits());
+            }
+            KdlValue::Bool(b) => {
+                self.u8(3);
+                self.u8(*b as u8);
+            }
+            KdlValue::Null => self.u8(4),
+        }
+    }
+}
+
+fn value_eq(a: &KdlValue, b: &KdlValue) -> bool {
+    match (a, b) {
+        (
+            KdlValue::String(a) | KdlValue::RawString(a),
+            KdlValue::String(b) | KdlValue::RawString(b),
+        ) => a == b,
+        (KdlValue::Base10Float(a), KdlValue::Base10Float(b)) => a.to_bits() == b.to_bits(),
+        (KdlValue::Bool(a), KdlValue::Bool(b)) => a == b,
+        (KdlValue::Null, KdlValue::Null) => true,
+        (a, b) => match (int(a), int(b)) {
+            (Some(a), Some(b)) => a == b,
+            _ => false,
+        },
+    }
+}
+
+fn int(value: &KdlValue) -> Option<i64> {
+    match *value {
+        KdlValue::Base2(i) | KdlValue::Base8(i) | KdlValue::Base10(i) | KdlValue::Base16(i) => {
+            Some(i)
+        }
+        _ => None,
+    }
+}
+
+fn ident(identifier: Option<&KdlIdentifier>) -> Option<&str> {
+    identifier.map(KdlIdentifier::value)
+}
+
+fn head_eq(a: &KdlNode, b: &KdlNode) -> bool {
+    a.name().value() == b.name().value()
+        && ident(a.ty()) == ident(b.ty())
+        && a.entries().len() == b.entries().len()
+        && a.entries().iter().zip(b.entries()).all(|(a, b)| {
+            ident(a.name()) == ident(b.name())
+                && ident(a.ty()) == ident(b.ty())
+                && value_eq(a.value(), b.value())
+        })
+}
+
+/// Content hashes of a document and of every node in it, in preorder, each
+/// with the number of nodes in its subtree, so that a node's children, and
+/// its next sibling, can be found by position. Formatting and comments are
+/// ignored, and a node with an empty children block hashes as one with none.
+pub(crate) struct Subtrees {
+    root: u64,
+    nodes: Vec<(u64, usize)>,
+    /// If indexed, the address of every node with its position, by address.
+    addresses: Option<Vec<(usize, usize)>>,
+}
+
+impl Subtrees {
+    pub(crate) fn new(doc: &KdlDocument) -> Self {
+        Self::build(doc, false)
+    }
+
+    /// Like `new`, also indexing nodes by address for `node_hash`.
+    pub(crate) fn indexed(doc: &KdlDocument) -> Self {
+        Self::build(doc, true)
+    }
+
+    fn build(doc: &KdlDocument, indexed: bool) -> Self {
+        let mut subtrees = Subtrees {
+            root: 0,
+            nodes: Vec::new(),
+            addresses: indexed.then(Vec::new),
+        };
+        subtrees.root = subtrees.document(Some(doc));
+        if let Some(addresses) = &mut subtrees.addresses {
+            addresses.sort_unstable();
+        }
+        subtrees
+    }
+
+    /// The hash of `node`, if indexed and it is in the hashed document.
+    pub(crate) fn node_hash(&self, node: &KdlNode) -> Option<u64> {
+        let addresses = self.addresses.as_ref()?;
+        let address = node as *const KdlNode as usize;
+        let i = addresses
+            .binary_search_by_key(&address, |&(address, _)| address)
+            .ok()?;
+        Some(self.nodes[addresses[i].1].0)
+    }
+
+    fn node(&mut self, node: &KdlNode) -> u64 {
+        let at = self.nodes.len();
+        self.nodes.push((0, 0));
+        if let Some(addresses) = &mut self.addresses {
+            addresses.push((node as *const KdlNode as usize, at));
+        }
+        let mut h = Fnv::new();
+        h.str(node.name().value());
+        h.ident(node.ty());
+        h.u64(node.entries().len() as u64);
+        for entry in node.entries() {
+            h.ident(entry.name());
+            h.ident(entry.ty());
+            h.value(entry.value());
+        }
+        h.u64(self.document(node.children()));
+        self.nodes[at] = (h.0, self.nodes.len() - at);
+        h.0
+    }
+
+    fn document(&mut self, doc: Option<&KdlDocument>) -> u64 {
+        let nodes = doc.map_or(&[][..], KdlDocument::nodes);
+        let mut h = Fnv::new();
+        h.u64(nodes.len() as u64);
+        for node in nodes {
+            h.u64(self.node(node));
+        }
+        h.0
+    }
+
+    /// The positions of the nodes of a document whose first node is at `at`.
+    fn positions(&self, nodes: &[KdlNode], mut at: usize) -> impl Iterator<Item = usize> + '_ {
+        (0..nodes.len()).map(move |_| {
+            let here = at;
+            at += self.nodes[here].1;
+            here
+        })
+    }
+}
+
+#[repr(C)]
+#[derive(Clone, Copy, Debug, PartialEq, Eq)]
+pub enum KdlChangeKind {
+    Added,
+    Removed,
+    Changed,
+}
+
+/// A node that differs between two documents.
+#[repr(C)]
+pub struct KdlChange {
+    kind: KdlChangeKind,
+    /// The node in the old document, unless added.
+    old_node: *const KdlNode,
+    /// The node in the new document, unless removed.
+    new_node: *const KdlNode,
+    /// Names from the root to the node, in query syntax.
+    path: KdlFlatString,
+}
+
+pub struct KdlDiff {
+    changes: Vec<KdlChange>,
+    /// Backing for each change's path.
+    paths: Vec<String>,
+}
+
+struct Differ<'a> {
+    old: &'a Subtrees,
+    new: &'a Subtrees,
+    diff: KdlDiff,
+}
+
+impl Differ<'_> {
+    fn push(
+        &mut self,
+        kind: KdlChangeKind,
+        old: Option<&KdlNode>,
+        new: Option<&KdlNode>,
+        path: &mut Vec<u8>,
+        name: &str,
+    ) {
+        let base = path.len();
+        if !path.is_empty() {
+            path.push(b'/');
+        }
+        push_ident(path, name);
+        // Names are UTF-8 and quoting only adds ASCII.
+        let joined = unsafe { String::from_utf8_unchecked(path.clone()) };
+        path.truncate(base);
+        self.diff.changes.push(KdlChange {
+            kind,
+            old_node: old.map_or(std::ptr::null(), |node| node),
+            new_node: new.map_or(std::ptr::null(), |node| node),
+            path: KdlFlatString::new(&joined),
+        });
+        self.diff.paths.push(joined);
+    }
+
+    /// Compares a pair of nodes, at positions `o` and `n`, whose hashes
+    /// differ unless the subtrees match.
+    fn pair(&mut self, old: &KdlNode, o: usize, new: &KdlNode, n: usize, path: &mut Vec<u8>) {
+        if self.old.nodes[o].0 == self.new.nodes[n].0 {
+            return;
+        }
+        if !head_eq(old, new) {
+            let name = old.name().value();
+            return self.push(KdlChangeKind::Changed, Some(old), Some(new), path, name);
+        }
+        let base = path.len();
+        if !path.is_empty() {
+            path.push(b'/');
+        }
+        push_ident(path, old.name().value());
+        self.documents(old.children(), o + 1, new.children(), n + 1, path);
+        path.truncate(base);
+    }
+
+    /// Pairs up nodes by name and position among same-named siblings, then
+    /// compares each pair. Siblings are walked in step while their names
+    /// agree, which pairs them as well, so that only where the documents
+    /// diverge are nodes looked up by name.
+    fn documents(
+        &mut self,
+        old: Option<&KdlDocument>,
+        old_at: usize,
+        new: Option<&KdlDocument>,
+        new_at: usize,
+        path: &mut Vec<u8>,
+    ) {
+        let old = old.map_or(&[][..], KdlDocument::nodes);
+        let new = new.map_or(&[][..], KdlDocument::nodes);
+        let (old_subtrees, new_subtrees) = (self.old, self.new);
+        let mut old_at = old_subtrees.positions(old, old_at);
+        let mut new_at = new_subtrees.positions(new, new_at);
+        let mut same = 0;
+        while same < old.len()
+            && same < new.len()
+            && old[same].name().value() == new[same].name().value()
+        {
+            let (o, n) = (old_at.next().unwrap(), new_at.next().unwrap());
+            self.pair(&old[same], o, &new[same], n, path);
+            same += 1;
+        }
+        if same == old.len() && same == new.len() {
+            return;
+        }
+
+        // Names seen so far occur equally often on both sides, so counting
+        // from here pairs the rest as counting from the start would.
+        let (old, new) = (&old[same..], &new[same..]);
+        let mut unmatched = HashMap::<(&str, usize), (&KdlNode, usize)>::with_capacity(new.len());
+        let mut seen = HashMap::<&str, usize>::new();
+        for (node, n) in new.iter().zip(new_at) {
+            let name = node.name().value();
+            let k = seen.entry(name).or_default();
+            unmatched.insert((name, *k), (node, n));
+            *k += 1;
+        }
+        seen.clear();
+        for (node, o) in old.iter().zip(old_at) {
+            let name = node.name().value();
+            let k = seen.entry(name).or_default();
+            let key = (name, *k);
+            *k += 1;
+            match unmatched.remove(&key) {
+                None => self.push(KdlChangeKind::Removed, Some(node), None, path, name),
+                Some((other, n)) => self.pair(node, o, other, n, path),
+            }
+        }
+
+        // Whatever is left was added, reported in document order.
+        seen.clear();
+        for node in new {
+            let name = node.name().value();
+            let k = seen.entry(name).or_default();
+            let key = (name, *k);
+            *k += 1;
+            if unmatched.contains_key(&key) {
+                self.push(KdlChangeKind::Added, None, Some(node), path, name);
+            }
+        }
+    }
+}
+
+pub(crate) fn diff(old: &KdlDocument, new: &KdlDocument) -> KdlDiff {
+    let (old_subtrees, new_subtrees) = (stats::subtrees(old), stats::subtrees(new));
+    let mut differ = Differ {
+        old: &old_subtrees,
+        new: &new_subtrees,
+        diff: KdlDiff {
+            changes: Vec::new(),
+            paths: Vec::new(),
+        },
+    };
+    if old_subtrees.root != new_subtrees.root {
+        differ.documents(Some(old), 0, Some(new), 0, &mut Vec::new());
+    }
+    differ.diff
+}
+
+#[no_mangle]
+pub extern "C" fn KDL_Document_hash(doc: &KdlDocument) -> u64 {
+    stats::subtrees(doc).root
+}
+
+#[no_mangle]
+pub extern "C" fn KDL_Node_hash(node: &KdlNode) -> u64 {
+    stats::node_hash(node).unwrap_or_else(|| {
+        Subtrees {
+            root: 0,
+            nodes: Vec::new(),
+            addresses: None,
+        }
+        .node(node)
+    })
+}
+
+#[no_mangle]
+pub extern "C" fn KDL_Document_diff(old: &KdlDocument, new: &KdlDocument) -> Box<KdlDiff> {
+    Box::new(diff(old, new))
+}
+
+#[no_mangle]
+pub extern "C" fn KDL_Diff_free(_diff: Box<KdlDiff>) {}
+
+#[no_mangle]
+pub extern "C" fn KDL_Diff_changes(diff: &KdlDiff, len: &mut usize) -> *const KdlChange {
+    *len = diff.changes.len();
+    diff.changes.as_ptr()
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::document::{KDL_Document_free, KDL_Document_parse};
+    use std::ptr;
+    use std::sync::Arc;
+
+    fn parse(text: &str) -> KdlDocument {
+        text.parse().unwrap()
+    }
+
+    fn changes(old: &str, new: &str) -> Vec<(KdlChangeKind, String)> {
+        let diff = diff(&parse(old), &parse(new));
+        diff.changes
+            .iter()
+            .zip(diff.paths)
+            .map(|(change, path)| (change.kind, path))
+            .collect()
+    }
+
+    #[test]
+    fn hashes_are_stable_and_ignore_formatting() {
+        // FNV-1a of a zero count, pinned so any change to the encoding is deliberate.
+        assert_eq!(KDL_Document_hash(&parse("")), 0xA8C7_F832_281A_39C5);
+        let a = parse("a 0x10 \"s\" {\n    b k=true\n}\n");
+        let b = parse("/* c */ a 16 r\"s\" { b k=true; }");
+        assert_eq!(KDL_Document_hash(&a), KDL_Document_hash(&b));
+        assert_eq!(KDL_Node_hash(&a.nodes()[0]), KDL_Node_hash(&b.nodes()[0]));
+        assert_ne!(
+            KDL_Document_hash(&a),
+            KDL_Document_hash(&parse("a 16 \"t\""))
+        );
+        // An absent type is not an empty one.
+        assert_ne!(
+            KDL_Document_hash(&parse("a 1")),
+            KDL_Document_hash(&parse("a (\"\")1"))
+        );
+    }
+
+    #[test]
+    fn subtrees_are_in_preorder() {
+        let doc = parse("a {\n    b\n    c {\n        d\n    }\n}\ne\n");
+        let subtrees = Subtrees::new(&doc);
+        let sizes: Vec<usize> = subtrees.nodes.iter().map(|&(_, size)| size).collect();
+        assert_eq!(sizes, [4, 1, 2, 1, 1]);
+        assert_eq!(subtrees.nodes[0].0, KDL_Node_hash(&doc.nodes()[0]));
+        assert_eq!(subtrees.nodes[4].0, KDL_Node_hash(&doc.nodes()[1]));
+        let children = doc.nodes()[0].children().unwrap().nodes();
+        assert_eq!(subtrees.positions(children, 1).collect::<Vec<_>>(), [1, 2]);
+    }
+
+    #[test]
+    fn diffs_pair_siblings_in_step_then_by_name() {
+        let old = "a 1\nb {\n    c 1\n    c 2\n}\nd\ne\n";
+        assert!(changes(old, old).is_empty());
+        assert_eq!(
+            changes(old, "a 1\nb {\n    c 1\n    c 3\n}\nd\ne\n"),
+            [(KdlChangeKind::Changed, "b/c".to_owned())]
+        );
+        assert_eq!(
+            changes(old, "a 2\nb {\n    c 1\n    c 2\n}\nx\ne\nd\n"),
+            [
+                (KdlChangeKind::Changed, "a".to_owned()),
+                (KdlChangeKind::Added, "x".to_owned()),
+            ]
+        );
+        assert_eq!(
+            changes(old, "b {\n    c 1\n    c 2\n}\na 1\nd\n"),
+            [(KdlChangeKind::Removed, "e".to_owned())]
+        );
+    }
+
+    #[test]
+    fn parsed_documents_keep_their_hashes_until_freed() {
+        let text = "a 1 {\n    b 2\n}\n";
+        let (mut doc, mut err) = (ptr::null_mut(), ptr::null_mut());
+        assert!(unsafe { KDL_Document_parse(text.as_ptr(), text.len(), &mut doc, &mut err) });
+        let first = stats::subtrees(unsafe { &*doc });
+        assert!(Arc::ptr_eq(&first, &stats::subtrees(unsafe { &*doc })));
+        stats::changed(doc);
+        let second = stats::subtrees(unsafe { &*doc });
+        assert!(!Arc::ptr_eq(&first, &second));
+        assert_eq!(first.root, second.root);
+        unsafe { KDL_Document_free(doc) };
+        assert_eq!(Arc::strong_count(&second), 1);
+
+        // Documents that are not tracked, like children blocks, are not cached.
+        let doc = parse(text);
+        let children = doc.nodes()[0].children().unwrap();
+        assert!(!Arc::ptr_eq(
+            &stats::subtrees(children),
+            &stats::subtrees(children)
+        ));
+    }
+
+    #[test]
+    fn node_hashes_come_from_cached_subtrees() {
+        let text = "a 1 {\n    b 2\n    c {\n        d\n    }\n}\ne\n";
+        let (mut doc, mut err) = (ptr::null_mut(), ptr::null_mut());
+        assert!(unsafe { KDL_Document_parse(text.as_ptr(), text.len(), &mut doc, &mut err) });
+        let doc_ref = unsafe { &*doc };
+        let a = &doc_ref.nodes()[0];
+        let c = &a.children().unwrap().nodes()[1];
+        let expected = KDL_Node_hash(c);
+        assert!(stats::node_hash(c).is_none());
+
+        KDL_Document_hash(doc_ref);
+        for node in [a, c, &doc_ref.nodes()[1]] {
+            let cached = stats::node_hash(node).unwrap();
+            assert_eq!(cached, Subtrees::new(doc_ref).node(node));
+            assert_eq!(KDL_Node_hash(node), cached);
+        }
+        assert_eq!(KDL_Node_hash(c), expected);
+        // A node of another document is hashed afresh.
+        let other = parse(text);
+        assert!(stats::node_hash(&other.nodes()[0]).is_none());
+        assert_eq!(KDL_Node_hash(&other.nodes()[0]), KDL_Node_hash(a));
+
+        stats::changed(doc);
+        assert!(stats::node_hash(c).is_none());
+        KDL_Document_hash(doc_ref);
+        assert!(stats::node_hash(c).is_some());
+        unsafe { KDL_Document_free(doc) };
+    }
+}
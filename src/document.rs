@@ -1,8 +1,15 @@
+use crate::{arena, stats};
 use kdl::*;
 use std::{ptr, slice, str};
 
 #[no_mangle]
-pub extern "C" fn KDL_Document_free(_doc: Box<KdlDocument>) {}
+pub unsafe extern "C" fn KDL_Document_free(doc: *mut KdlDocument) {
+    stats::forget(doc);
+    // A document parsed into an arena goes with it, and it may be gone.
+    if !arena::owns(doc) {
+        drop(Box::from_raw(doc));
+    }
+}
 
 #[no_mangle]
 pub unsafe extern "C" fn KDL_Document_parse(
@@ -12,15 +19,17 @@ pub unsafe extern "C" fn KDL_Document_parse(
     errptr: &mut *mut KdlError,
 ) -> bool {
     let s = str::from_utf8_unchecked(slice::from_raw_parts(s, len));
-    match s.parse() {
+    match stats::record(len, Default::default(), |timing| {
+        timing.parse(|| s.parse::<KdlDocument>())
+    }) {
         Ok(doc) => {
-            *docptr = Box::into_raw(Box::new(doc));
+            *docptr = Box::into_raw(doc);
             *errptr = ptr::null_mut();
             true
         }
         Err(err) => {
             *docptr = ptr::null_mut();
-            *errptr = Box::into_raw(Box::new(err));
+            *errptr = Box::into_raw(err);
             false
         }
     }
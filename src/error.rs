@@ -1,8 +1,14 @@
+use crate::arena;
 use kdl::*;
 use std::ptr;
 
 #[no_mangle]
-pub unsafe extern "C" fn KDL_Error_free(_error: Box<KdlError>) {}
+pub unsafe extern "C" fn KDL_Error_free(error: *mut KdlError) {
+    // An error from parsing into an arena goes with it, and it may be gone.
+    if !arena::owns(error) {
+        drop(Box::from_raw(error));
+    }
+}
 
 #[no_mangle]
 pub extern "C" fn KDL_Error_input(error: &KdlError, len: &mut usize) -> *const u8 {
@@ -0,0 +1,1406 @@
+use crate::flat::{KdlFlatPayload, KdlFlatString};
+use crate::scan::find;
+use crate::value::KdlValueWhich;
+use std::{ffi::c_void, slice, str};
+
+/// A value as seen by a [`Handler`], borrowing from the input or a scratch buffer.
+#[derive(Clone, Copy)]
+pub enum Value<'a> {
+    String(&'a str, KdlValueWhich),
+    Int(i64, KdlValueWhich),
+    Float(f64),
+    Bool(bool),
+    Null,
+}
+
+impl Value<'_> {
+    pub fn which(&self) -> KdlValueWhich {
+        match *self {
+            Value::String(_, which) | Value::Int(_, which) => which,
+            Value::Float(_) => KdlValueWhich::Base10Float,
+            Value::Bool(_) => KdlValueWhich::Bool,
+            Value::Null => KdlValueWhich::Null,
+        }
+    }
+
+    fn payload(&self) -> KdlFlatPayload {
+        match *self {
+            Value::String(s, _) => KdlFlatPayload {
+                string: KdlFlatString::new(s),
+            },
+            Value::Int(i, _) => KdlFlatPayload { integer: i },
+            Value::Float(f) => KdlFlatPayload { floating: f },
+            Value::Bool(b) => KdlFlatPayload { boolean: b },
+            Value::Null => KdlFlatPayload {
+                string: KdlFlatString::NONE,
+            },
+        }
+    }
+}
+
+/// Receives parse events. Returning `false` from any method stops the parse.
+pub trait Handler {
+    fn node_begin(&mut self, _name: &str, _ty: Option<&str>) -> bool {
+        true
+    }
+    fn entry(&mut self, _name: Option<&str>, _ty: Option<&str>, _value: Value<'_>) -> bool {
+        true
+    }
+    fn children_begin(&mut self) -> bool {
+        true
+    }
+    fn children_end(&mut self) -> bool {
+        true
+    }
+    fn node_end(&mut self) -> bool {
+        true
+    }
+}
+
+/// Discards all events; parsing only checks syntax.
+impl Handler for () {}
+
+#[repr(C)]
+#[derive(Clone, Copy)]
+pub struct KdlDiagnostic {
+    pub offset: usize,
+    pub length: usize,
+    pub label: KdlFlatString,
+    pub help: KdlFlatString,
+}
+
+impl KdlDiagnostic {
+    pub(crate) fn new(offset: usize, length: usize, label: &'static str) -> Self {
+        KdlDiagnostic {
+            offset,
+            length,
+            label: KdlFlatString::new(label),
+            help: KdlFlatString::NONE,
+        }
+    }
+
+    pub(crate) fn from_error(err: &kdl::KdlError) -> Self {
+        KdlDiagnostic {
+            offset: err.span.offset(),
+            length: err.span.len(),
+            label: KdlFlatString::opt(err.label),
+            help: KdlFlatString::opt(err.help),
+        }
+    }
+
+    fn help(mut self, help: &'static str) -> Self {
+        self.help = KdlFlatString::new(help);
+        self
+    }
+
+    const NONE: Self = KdlDiagnostic {
+        offset: 0,
+        length: 0,
+        label: KdlFlatString::NONE,
+        help: KdlFlatString::NONE,
+    };
+}
+
+#[repr(C)]
+#[derive(Clone, Copy, PartialEq, Eq)]
+pub enum KdlParseStatus {
+    Ok = 0,
+    Error,
+    Stopped,
+}
+
+#[derive(Clone, Copy)]
+pub(crate) enum Stop {
+    /// The window ended before the current item did.
+    Incomplete,
+    Error(KdlDiagnostic),
+    /// The handler asked to stop.
+    Stopped,
+}
+
+type Res<T> = Result<T, Stop>;
+
+pub(crate) fn is_newline(c: char) -> bool {
+    matches!(
+        c,
+        '\n' | '\r' | '\u{85}' | '\u{0C}' | '\u{2028}' | '\u{2029}'
+    )
+}
+
+/// Bytes that can start a newline: `\n`, `\r`, U+000C, and the UTF-8 lead
+/// bytes of U+0085, U+2028 and U+2029.
+pub(crate) const NEWLINE_STARTS: &[u8] = b"\n\r\x0C\xC2\xE2";
+
+pub(crate) fn is_space(c: char) -> bool {
+    matches!(
+        c,
+        '\t' | ' ' | '\u{A0}' | '\u{1680}' | '\u{2000}'
+            ..='\u{200A}' | '\u{202F}' | '\u{205F}' | '\u{3000}' | '\u{FEFF}'
+    )
+}
+
+pub(crate) fn is_ident_char(c: char) -> bool {
+    !is_newline(c)
+        && !is_space(c)
+        && !matches!(
+            c,
+            '\\' | '/' | '(' | ')' | '{' | '}' | '<' | '>' | ';' | '[' | ']' | '=' | ',' | '"'
+        )
+}
+
+/// Position within a window of valid UTF-8 input.
+pub(crate) struct Cursor<'a> {
+    pub s: &'a str,
+    pub pos: usize,
+    /// Absolute offset of `s` within the whole input.
+    pub base: usize,
+    /// Whether the input ends with this window.
+    pub eof: bool,
+}
+
+impl<'a> Cursor<'a> {
+    pub fn new(s: &'a str, base: usize, eof: bool) -> Self {
+        Cursor {
+            s,
+            pos: 0,
+            base,
+            eof,
+        }
+    }
+
+    fn rest(&self) -> &'a str {
+        &self.s[self.pos..]
+    }
+
+    fn end(&self) -> Res<()> {
+        if self.eof {
+            Ok(())
+        } else {
+            Err(Stop::Incomplete)
+        }
+    }
+
+    pub fn peek(&self) -> Res<Option<char>> {
+        match self.rest().chars().next() {
+            Some(c) => Ok(Some(c)),
+            None => self.end().map(|()| None),
+        }
+    }
+
+    fn peek_byte(&self) -> Res<Option<u8>> {
+        match self.rest().as_bytes().first() {
+            Some(&b) => Ok(Some(b)),
+            None => self.end().map(|()| None),
+        }
+    }
+
+    fn bump(&mut self, c: char) {
+        self.pos += c.len_utf8();
+    }
+
+    fn starts_with(&self, pat: &str) -> Res<bool> {
+        let rest = self.rest();
+        if rest.len() < pat.len() && pat.starts_with(rest) {
+            self.end().map(|()| false)
+        } else {
+            Ok(rest.starts_with(pat))
+        }
+    }
+
+    fn eat(&mut self, pat: &str) -> Res<bool> {
+        let hit = self.starts_with(pat)?;
+        if hit {
+            self.pos += pat.len();
+        }
+        Ok(hit)
+    }
+
+    fn error<T>(&self, start: usize, label: &'static str) -> Res<T> {
+        Err(self.diag(start, label))
+    }
+
+    fn diag(&self, start: usize, label: &'static str) -> Stop {
+        let len = self
+            .pos
+            .max(start + 1)
+            .min(self.s.len())
+            .saturating_sub(start);
+        Stop::Error(KdlDiagnostic::new(self.base + start, len, label))
+    }
+
+    fn error_help<T>(&self, start: usize, label: &'static str, help: &'static str) -> Res<T> {
+        match self.diag(start, label) {
+            Stop::Error(diag) => Err(Stop::Error(diag.help(help))),
+            stop => Err(stop),
+        }
+    }
+}
+
+/// Skips `/* */` comments (which nest), assuming the cursor is at `/*`.
+fn block_comment(cur: &mut Cursor) -> Res<()> {
+    let start = cur.pos;
+    cur.pos += 2;
+    let mut depth = 1;
+    loop {
+        let rest = cur.rest().as_bytes();
+        match find(rest, b"*/") {
+            None => {
+                cur.pos += rest.len();
+                cur.end()?;
+                return cur.error(start, "unclosed comment");
+            }
+            Some(ix) => cur.pos += ix,
+        }
+        if cur.eat("*/")? {
+            depth -= 1;
+            if depth == 0 {
+                return Ok(());
+            }
+        } else if cur.eat("/*")? {
+            depth += 1;
+        } else {
+            cur.pos += 1;
+        }
+    }
+}
+
+/// Skips a run of `ws` (spaces and block comments), returning whether any was found.
+/// A run cut off by the end of the window is committed as far as it got.
+pub(crate) fn ws(cur: &mut Cursor) -> Res<bool> {
+    let start = cur.pos;
+    loop {
+        let step = match cur.peek() {
+            Ok(Some(c)) if is_space(c) => {
+                cur.bump(c);
+                Ok(())
+            }
+            Ok(Some('/')) => match cur.starts_with("/*") {
+                Ok(true) => {
+                    let mark = cur.pos;
+                    block_comment(cur).map_err(|stop| {
+                        cur.pos = mark;
+                        stop
+                    })
+                }
+                Ok(false) => break,
+                Err(stop) => Err(stop),
+            },
+            Ok(_) => break,
+            Err(stop) => Err(stop),
+        };
+        match step {
+            Ok(()) => {}
+            Err(Stop::Incomplete) if cur.pos > start => break,
+            Err(stop) => return Err(stop),
+        }
+    }
+    Ok(cur.pos > start)
+}
+
+/// Consumes one newline (treating CRLF as one), returning whether one was found.
+pub(crate) fn newline(cur: &mut Cursor) -> Res<bool> {
+    match cur.peek()? {
+        Some('\r') => {
+            cur.pos += 1;
+            if cur.peek_byte()? == Some(b'\n') {
+                cur.pos += 1;
+            }
+            Ok(true)
+        }
+        Some(c) if is_newline(c) => {
+            cur.bump(c);
+            Ok(true)
+        }
+        _ => Ok(false),
+    }
+}
+
+/// Skips a `//` comment and the newline ending it, assuming the cursor is at `//`.
+pub(crate) fn line_comment(cur: &mut Cursor) -> Res<()> {
+    cur.pos += 2;
+    loop {
+        let rest = cur.rest().as_bytes();
+        cur.pos += find(rest, NEWLINE_STARTS).unwrap_or(rest.len());
+        match cur.peek()? {
+            None => return Ok(()),
+            Some(c) if is_newline(c) => {
+                newline(cur)?;
+                return Ok(());
+            }
+            Some(c) => cur.bump(c),
+        }
+    }
+}
+
+/// Skips a line continuation, assuming the cursor is at `\`.
+fn escline(cur: &mut Cursor) -> Res<()> {
+    let start = cur.pos;
+    cur.pos += 1;
+    while ws(cur)? {}
+    if cur.starts_with("//")? {
+        line_comment(cur)
+    } else if newline(cur)? {
+        Ok(())
+    } else {
+        cur.error_help(
+            start,
+            "invalid line continuation",
+            "A `\\` must be followed by a newline or a `//` comment.",
+        )
+    }
+}
+
+/// Where the text of a parsed string lives.
+#[derive(Clone, Copy)]
+pub(crate) enum Text {
+    Input(usize, usize),
+    Scratch,
+}
+
+pub(crate) fn resolve<'a>(input: &'a str, scratch: &'a str, text: Text) -> &'a str {
+    match text {
+        Text::Input(start, end) => &input[start..end],
+        Text::Scratch => scratch,
+    }
+}
+
+/// Parses the rest of a `"` string, decoding escapes into `scratch` only if present.
+pub(crate) fn escaped_string(cur: &mut Cursor, scratch: &mut String) -> Res<Text> {
+    let start = cur.pos;
+    cur.pos += 1;
+    let body = cur.pos;
+    let rest = cur.rest().as_bytes();
+    match find(rest, b"\"\\") {
+        Some(ix) if rest[ix] == b'"' => {
+            cur.pos += ix + 1;
+            return Ok(Text::Input(body, body + ix));
+        }
+        Some(ix) => cur.pos += ix,
+        None => {
+            cur.pos += rest.len();
+            cur.end()?;
+            return cur.error(start, "unclosed string");
+        }
+    }
+    scratch.clear();
+    scratch.push_str(&cur.s[body..cur.pos]);
+    loop {
+        match cur.peek()? {
+            None => return cur.error(start, "unclosed string"),
+            Some('"') => {
+                cur.pos += 1;
+                return Ok(Text::Scratch);
+            }
+            Some('\\') => {
+                let escape = cur.pos;
+                cur.pos += 1;
+                let c = match cur.peek()? {
+                    None => return cur.error(start, "unclosed string"),
+                    Some('n') => '\n',
+                    Some('r') => '\r',
+                    Some('t') => '\t',
+                    Some('\\') => '\\',
+                    Some('/') => '/',
+                    Some('"') => '"',
+                    Some('b') => '\u{08}',
+                    Some('f') => '\u{0C}',
+                    Some('u') => {
+                        cur.pos += 1;
+                        if !cur.eat("{")? {
+                            return cur.error(escape, "invalid unicode escape");
+                        }
+                        let digits = cur.pos;
+                        while cur.peek_byte()?.map_or(false, |b| b.is_ascii_hexdigit()) {
+                            cur.pos += 1;
+                        }
+                        let hex = &cur.s[digits..cur.pos];
+                        if hex.is_empty() || hex.len() > 6 || !cur.eat("}")? {
+                            return cur.error(escape, "invalid unicode escape");
+                        }
+                        match u32::from_str_radix(hex, 16).ok().and_then(char::from_u32) {
+                            Some(c) => {
+                                scratch.push(c);
+                                continue;
+                            }
+                            None => return cur.error(escape, "invalid unicode escape"),
+                        }
+                    }
+                    _ => return cur.error_help(
+                        escape,
+                        "invalid escape",
+                        "Valid escapes are \\n, \\r, \\t, \\\\, \\/, \\\", \\b, \\f and \\u{XXXX}.",
+                    ),
+                };
+                cur.pos += 1;
+                scratch.push(c);
+            }
+            Some(_) => {
+                let from = cur.pos;
+                let rest = cur.rest().as_bytes();
+                let ix = find(rest, b"\"\\").unwrap_or(rest.len());
+                cur.pos += ix;
+                scratch.push_str(&cur.s[from..cur.pos]);
+            }
+        }
+    }
+}
+
+/// Returns the number of `#`s if the cursor is at a raw string.
+fn raw_string_start(cur: &Cursor) -> Res<Option<usize>> {
+    let rest = cur.rest().as_bytes();
+    if rest.first() != Some(&b'r') {
+        return Ok(None);
+    }
+    let hashes = rest[1..].iter().take_while(|&&b| b == b'#').count();
+    match rest.get(1 + hashes) {
+        Some(b'"') => Ok(Some(hashes)),
+        Some(_) => Ok(None),
+        None => cur.end().map(|()| None),
+    }
+}
+
+fn raw_string(cur: &mut Cursor, hashes: usize) -> Res<Text> {
+    let start = cur.pos;
+    cur.pos += hashes + 2;
+    let body = cur.pos;
+    let mut from = body;
+    loop {
+        let rest = &cur.s.as_bytes()[from..];
+        match find(rest, b"\"") {
+            None => {
+                cur.pos = cur.s.len();
+                cur.end()?;
+                return cur.error(start, "unclosed raw string");
+            }
+            Some(ix) => {
+                let quote = from + ix;
+                let tail = &cur.s.as_bytes()[quote + 1..];
+                let closing = tail.iter().take(hashes).take_while(|&&b| b == b'#').count();
+                if closing == hashes {
+                    cur.pos = quote + 1 + hashes;
+                    return Ok(Text::Input(body, quote));
+                }
+                if closing == tail.len() {
+                    cur.pos = cur.s.len();
+                    cur.end()?;
+                }
+                from = quote + 1;
+            }
+        }
+    }
+}
+
+/// Parses a string, or returns `None` if the cursor is not at one.
+fn string(cur: &mut Cursor, scratch: &mut String) -> Res<Option<(Text, KdlValueWhich)>> {
+    if cur.peek_byte()? == Some(b'"') {
+        return Ok(Some((escaped_string(cur, scratch)?, KdlValueWhich::String)));
+    }
+    match raw_string_start(cur)? {
+        Some(hashes) => Ok(Some((raw_string(cur, hashes)?, KdlValueWhich::RawString))),
+        None => Ok(None),
+    }
+}
+
+fn is_number_start(cur: &Cursor) -> Res<bool> {
+    let rest = cur.rest().as_bytes();
+    match rest.first() {
+        Some(b) if b.is_ascii_digit() => Ok(true),
+        Some(b'+' | b'-') => match rest.get(1) {
+            Some(b) => Ok(b.is_ascii_digit()),
+            None => cur.end().map(|()| false),
+        },
+        Some(_) => Ok(false),
+        None => cur.end().map(|()| false),
+    }
+}
+
+/// Parses a bare identifier, which may turn out to be a keyword.
+fn bare_identifier(cur: &mut Cursor) -> Res<Option<Text>> {
+    let start = cur.pos;
+    match cur.peek()? {
+        Some(c) if is_ident_char(c) && !c.is_ascii_digit() => {}
+        _ => return Ok(None),
+    }
+    if is_number_start(cur)? {
+        return Ok(None);
+    }
+    loop {
+        match cur.peek()? {
+            Some(c) if is_ident_char(c) => cur.bump(c),
+            _ => return Ok(Some(Text::Input(start, cur.pos))),
+        }
+    }
+}
+
+fn keyword(s: &str) -> Option<Value<'static>> {
+    match s {
+        "true" => Some(Value::Bool(true)),
+        "false" => Some(Value::Bool(false)),
+        "null" => Some(Value::Null),
+        _ => None,
+    }
+}
+
+/// Parses an identifier (bare or string), which must not be a keyword.
+fn identifier(cur: &mut Cursor, scratch: &mut String) -> Res<Text> {
+    let start = cur.pos;
+    if let Some((text, _)) = string(cur, scratch)? {
+        return Ok(text);
+    }
+    match bare_identifier(cur)? {
+        Some(Text::Input(from, to)) if keyword(&cur.s[from..to]).is_none() => {
+            Ok(Text::Input(from, to))
+        }
+        Some(_) => cur.error_help(
+            start,
+            "keywords cannot be used as identifiers",
+            "Quote the identifier to use it as a name.",
+        ),
+        None => cur.error(start, "expected identifier"),
+    }
+}
+
+/// Parses a `(type)` annotation, if present.
+fn annotation(cur: &mut Cursor, scratch: &mut String) -> Res<Option<Text>> {
+    if cur.peek_byte()? != Some(b'(') {
+        return Ok(None);
+    }
+    let start = cur.pos;
+    cur.pos += 1;
+    let ty = identifier(cur, scratch)?;
+    if cur.peek_byte()? != Some(b')') {
+        return cur.error(start, "unclosed type annotation");
+    }
+    cur.pos += 1;
+    Ok(Some(ty))
+}
+
+fn digits(cur: &mut Cursor, valid: impl Fn(u8) -> bool) -> Res<bool> {
+    if !cur.peek_byte()?.map_or(false, &valid) {
+        return Ok(false);
+    }
+    while cur.peek_byte()?.map_or(false, |b| b == b'_' || valid(b)) {
+        cur.pos += 1;
+    }
+    Ok(true)
+}
+
+/// Powers of ten that are exact as `f64`.
+const POW10: [f64; 23] = [
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15, 1e16,
+    1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+];
+
+/// Accumulates a run of decimal digits onto `n`, returning where the run ends.
+fn accumulate(s: &[u8], mut i: usize, n: &mut u64) -> Option<usize> {
+    while let Some(&b) = s.get(i).filter(|b| b.is_ascii_digit()) {
+        *n = n.checked_mul(10)?.checked_add((b - b'0') as u64)?;
+        i += 1;
+    }
+    Some(i)
+}
+
+/// Converts a plain `[+-]digits[.digits]` number in one pass, when it has no
+/// underscores or exponent and its value is exact: any `i64`, or a float with
+/// at most 2^53 as its digits and 22 decimals, which one division rounds
+/// correctly. Returns its length and value; anything else takes the general
+/// path, which finds the same end and value.
+fn plain_decimal(s: &[u8]) -> Option<(usize, Value<'static>)> {
+    let negative = s.first() == Some(&b'-');
+    let start = matches!(s.first(), Some(b'-' | b'+')) as usize;
+    let mut mantissa = 0;
+    let mut i = accumulate(s, start, &mut mantissa)?;
+    if i == start {
+        return None;
+    }
+    let mut decimals = 0;
+    if s.get(i) == Some(&b'.') {
+        let fraction = i + 1;
+        i = accumulate(s, fraction, &mut mantissa)?;
+        decimals = i - fraction;
+        if decimals == 0 {
+            return None;
+        }
+    }
+    if i == s.len() || matches!(s[i], b'_' | b'.') || s[i].is_ascii_alphanumeric() {
+        return None;
+    }
+    if decimals == 0 {
+        let value = if negative {
+            0i64.checked_sub_unsigned(mantissa)?
+        } else {
+            i64::try_from(mantissa).ok()?
+        };
+        return Some((i, Value::Int(value, KdlValueWhich::Base10)));
+    }
+    if mantissa > 1 << 53 || decimals >= POW10.len() {
+        return None;
+    }
+    let value = mantissa as f64 / POW10[decimals];
+    Some((i, Value::Float(if negative { -value } else { value })))
+}
+
+/// Parses a number, assuming the cursor is at one.
+fn number(cur: &mut Cursor, scratch: &mut String) -> Res<Value<'static>> {
+    let start = cur.pos;
+    if let Some((len, value)) = plain_decimal(cur.rest().as_bytes()) {
+        cur.pos += len;
+        return Ok(value);
+    }
+    let negative = cur.eat("-")?;
+    if !negative {
+        cur.eat("+")?;
+    }
+    let radix = if cur.eat("0x")? {
+        Some((16, KdlValueWhich::Base16))
+    } else if cur.eat("0o")? {
+        Some((8, KdlValueWhich::Base8))
+    } else if cur.eat("0b")? {
+        Some((2, KdlValueWhich::Base2))
+    } else {
+        None
+    };
+    if let Some((radix, which)) = radix {
+        let body = cur.pos;
+        if !digits(cur, |b| (b as char).is_digit(radix))? {
+            return cur.error(start, "invalid number");
+        }
+        scratch.clear();
+        if negative {
+            scratch.push('-');
+        }
+        scratch.extend(cur.s[body..cur.pos].chars().filter(|&c| c != '_'));
+        return match i64::from_str_radix(scratch, radix) {
+            Ok(i) => Ok(Value::Int(i, which)),
+            Err(_) => cur.error(start, "invalid integer"),
+        };
+    }
+
+    digits(cur, |b| b.is_ascii_digit())?;
+    let mut float = false;
+    if cur.peek_byte()? == Some(b'.') {
+        cur.pos += 1;
+        if !digits(cur, |b| b.is_ascii_digit())? {
+            return cur.error(start, "invalid number");
+        }
+        float = true;
+    }
+    if matches!(cur.peek_byte()?, Some(b'e' | b'E')) {
+        cur.pos += 1;
+        if !cur.eat("-")? {
+            cur.eat("+")?;
+        }
+        if !digits(cur, |b| b.is_ascii_digit())? {
+            return cur.error(start, "invalid number");
+        }
+        float = true;
+    }
+    let text = &cur.s[start..cur.pos];
+    let text = if text.contains('_') {
+        scratch.clear();
+        scratch.extend(text.chars().filter(|&c| c != '_'));
+        scratch.as_str()
+    } else {
+        text
+    };
+    if float {
+        match text.parse() {
+            Ok(f) => Ok(Value::Float(f)),
+            Err(_) => cur.error(start, "invalid float"),
+        }
+    } else {
+        match text.parse() {
+            Ok(i) => Ok(Value::Int(i, KdlValueWhich::Base10)),
+            Err(_) => cur.error(start, "invalid integer"),
+        }
+    }
+}
+
+/// A value whose string text (if any) has not been resolved yet.
+enum RawValue {
+    Text(Text, KdlValueWhich),
+    Other(Value<'static>),
+}
+
+fn value(cur: &mut Cursor, scratch: &mut String) -> Res<RawValue> {
+    let start = cur.pos;
+    if let Some((text, which)) = string(cur, scratch)? {
+        return Ok(RawValue::Text(text, which));
+    }
+    if is_number_start(cur)? {
+        return number(cur, scratch).map(RawValue::Other);
+    }
+    match bare_identifier(cur)? {
+        Some(Text::Input(from, to)) => match keyword(&cur.s[from..to]) {
+            Some(value) => Ok(RawValue::Other(value)),
+            None => cur.error_help(
+                start,
+                "identifiers cannot be used as values",
+                "Quote the value to make it a string.",
+            ),
+        },
+        _ => cur.error(start, "expected value"),
+    }
+}
+
+#[derive(Clone, Copy, PartialEq, Eq)]
+enum State {
+    /// Between nodes, at the top level or inside a children block.
+    Nodes,
+    /// After a node's name or one of its entries.
+    Body,
+    /// After a node's children block.
+    AfterChildren,
+}
+
+#[derive(Clone, Copy)]
+struct Frame {
+    /// The node is slashdashed (or inside a slashdashed node).
+    suppressed: bool,
+    /// The node's children block is slashdashed.
+    children_suppressed: bool,
+}
+
+/// Event-driven KDL parser whose memory use is proportional to nesting depth.
+///
+/// The parser works on windows of input: every item (a name, an entry, a comment,
+/// ...) is parsed fully before any event is emitted for it, so an item cut off by
+/// the end of a window is simply retried once more input arrives.
+pub struct Machine {
+    state: State,
+    stack: Vec<Frame>,
+    /// Absolute offset of a pending `/-`.
+    slashdash: Option<usize>,
+    /// Whether whitespace preceded the pending `/-`.
+    slashdash_spaced: bool,
+    /// Whether node-space separates the current position from the previous item.
+    spaced: bool,
+    scratch: [String; 3],
+}
+
+impl Default for Machine {
+    fn default() -> Self {
+        Machine {
+            state: State::Nodes,
+            stack: Vec::new(),
+            slashdash: None,
+            slashdash_spaced: false,
+            spaced: false,
+            scratch: Default::default(),
+        }
+    }
+}
+
+fn emit(go: bool) -> Res<()> {
+    if go {
+        Ok(())
+    } else {
+        Err(Stop::Stopped)
+    }
+}
+
+impl Machine {
+    /// Current nesting depth, counting open nodes.
+    pub fn depth(&self) -> usize {
+        self.stack.len()
+    }
+
+    /// Whether the parser is between top-level nodes.
+    pub fn at_top_level(&self) -> bool {
+        self.stack.is_empty() && self.state == State::Nodes && self.slashdash.is_none()
+    }
+
+    /// Parses as many whole items from `cur` as possible, returning `Ok(true)` once
+    /// the end of input has been reached. On `Err(Stop::Incomplete)`, `cur.pos` is
+    /// the offset from which to resume with more input.
+    pub(crate) fn run(&mut self, cur: &mut Cursor, handler: &mut impl Handler) -> Res<bool> {
+        loop {
+            let mark = cur.pos;
+            match self.item(cur, handler) {
+                Ok(true) => return Ok(true),
+                Ok(false) => {}
+                Err(Stop::Incomplete) => {
+                    cur.pos = mark;
+                    return Err(Stop::Incomplete);
+                }
+                Err(stop) => return Err(stop),
+            }
+        }
+    }
+
+    fn no_slashdash(&self) -> Res<()> {
+        match self.slashdash {
+            Some(offset) => Err(Stop::Error(
+                KdlDiagnostic::new(offset, 2, "dangling slashdash")
+                    .help("A `/-` must be followed by a node, an entry or a children block."),
+            )),
+            None => Ok(()),
+        }
+    }
+
+    fn parent_suppressed(&self) -> bool {
+        self.stack
+            .last()
+            .map_or(false, |it| it.suppressed || it.children_suppressed)
+    }
+
+    fn end_node(&mut self, handler: &mut impl Handler) -> Res<()> {
+        self.no_slashdash()?;
+        let frame = self.stack.pop().expect("node is open");
+        self.state = State::Nodes;
+        emit(frame.suppressed || handler.node_end())
+    }
+
+    /// Parses one item, returning whether the end of input was reached.
+    fn item(&mut self, cur: &mut Cursor, handler: &mut impl Handler) -> Res<bool> {
+        let start = cur.pos;
+        match self.state {
+            State::Nodes => match cur.peek()? {
+                None => {
+                    self.no_slashdash()?;
+                    if self.stack.is_empty() {
+                        return Ok(true);
+                    }
+                    cur.error(start, "unclosed children block")
+                }
+                Some(c) if is_newline(c) => {
+                    self.no_slashdash()?;
+                    newline(cur).map(|_| false)
+                }
+                Some(c) if is_space(c) => ws(cur).map(|_| false),
+                Some('/') if cur.starts_with("//")? => {
+                    self.no_slashdash()?;
+                    line_comment(cur).map(|()| false)
+                }
+                Some('/') if cur.starts_with("/*")? => ws(cur).map(|_| false),
+                Some('/') if cur.starts_with("/-")? => {
+                    self.no_slashdash()?;
+                    cur.pos += 2;
+                    self.slashdash = Some(cur.base + start);
+                    Ok(false)
+                }
+                Some('\\') if self.slashdash.is_some() => escline(cur).map(|()| false),
+                Some('}') => {
+                    self.no_slashdash()?;
+                    let Some(frame) = self.stack.last_mut() else {
+                        return cur.error(start, "unexpected `}`");
+                    };
+                    cur.pos += 1;
+                    let suppressed = frame.suppressed || frame.children_suppressed;
+                    frame.children_suppressed = false;
+                    self.state = State::AfterChildren;
+                    emit(suppressed || handler.children_end()).map(|()| false)
+                }
+                Some(_) => {
+                    let parent_suppressed = self.parent_suppressed();
+                    let [name, ty, _] = &mut self.scratch;
+                    let ty_text = annotation(cur, ty)?;
+                    let name_text = identifier(cur, name)?;
+                    let suppressed = self.slashdash.take().is_some() || parent_suppressed;
+                    self.stack.push(Frame {
+                        suppressed,
+                        children_suppressed: false,
+                    });
+                    self.state = State::Body;
+                    self.spaced = false;
+                    let name = resolve(cur.s, name, name_text);
+                    let ty = ty_text.map(|it| resolve(cur.s, ty, it));
+                    emit(suppressed || handler.node_begin(name, ty)).map(|()| false)
+                }
+            },
+            State::Body | State::AfterChildren => {
+                let after_children = self.state == State::AfterChildren;
+                match cur.peek()? {
+                    None => self.end_node(handler).map(|()| false),
+                    Some(c) if is_newline(c) => {
+                        newline(cur)?;
+                        self.end_node(handler).map(|()| false)
+                    }
+                    Some(';') => {
+                        cur.pos += 1;
+                        self.end_node(handler).map(|()| false)
+                    }
+                    Some('}') if self.stack.len() > 1 => self.end_node(handler).map(|()| false),
+                    Some('}') => cur.error(start, "unexpected `}`"),
+                    Some(c) if is_space(c) => {
+                        ws(cur)?;
+                        self.spaced = true;
+                        Ok(false)
+                    }
+                    Some('\\') => {
+                        escline(cur)?;
+                        self.spaced = true;
+                        Ok(false)
+                    }
+                    Some('/') if cur.starts_with("//")? => {
+                        line_comment(cur)?;
+                        self.end_node(handler).map(|()| false)
+                    }
+                    Some('/') if cur.starts_with("/*")? => {
+                        ws(cur)?;
+                        self.spaced = true;
+                        Ok(false)
+                    }
+                    _ if after_children => cur.error_help(
+                        start,
+                        "expected node terminator",
+                        "Nothing may follow a node's children block on the same line.",
+                    ),
+                    Some('/') if cur.starts_with("/-")? => {
+                        self.no_slashdash()?;
+                        cur.pos += 2;
+                        self.slashdash = Some(cur.base + start);
+                        self.slashdash_spaced = self.spaced;
+                        self.spaced = false;
+                        Ok(false)
+                    }
+                    Some('{') => {
+                        cur.pos += 1;
+                        let children_suppressed = self.slashdash.take().is_some();
+                        let frame = self.stack.last_mut().expect("node is open");
+                        frame.children_suppressed = children_suppressed;
+                        let suppressed = frame.suppressed || children_suppressed;
+                        self.state = State::Nodes;
+                        emit(suppressed || handler.children_begin()).map(|()| false)
+                    }
+                    Some(_) => {
+                        let spaced = if self.slashdash.is_some() {
+                            self.slashdash_spaced
+                        } else {
+                            self.spaced
+                        };
+                        if !spaced {
+                            return cur.error(start, "expected whitespace before entry");
+                        }
+                        self.entry(cur, handler).map(|()| false)
+                    }
+                }
+            }
+        }
+    }
+
+    fn entry(&mut self, cur: &mut Cursor, handler: &mut impl Handler) -> Res<()> {
+        let start = cur.pos;
+        let [name, ty, value_scratch] = &mut self.scratch;
+        let mut name_text = None;
+        let mut ty_text = annotation(cur, ty)?;
+        let value_raw = if ty_text.is_some() {
+            value(cur, value_scratch)?
+        } else {
+            let key = if let Some((text, which)) = string(cur, value_scratch)? {
+                if cur.peek_byte()? == Some(b'=') {
+                    // the string was a property name after all
+                    std::mem::swap(name, value_scratch);
+                    Some(text)
+                } else {
+                    return self.emit_entry(cur, handler, None, None, RawValue::Text(text, which));
+                }
+            } else if is_number_start(cur)? {
+                None
+            } else {
+                match bare_identifier(cur)? {
+                    Some(Text::Input(from, to)) => {
+                        let word = &cur.s[from..to];
+                        if cur.peek_byte()? == Some(b'=') {
+                            if keyword(word).is_some() {
+                                return cur.error_help(
+                                    start,
+                                    "keywords cannot be used as identifiers",
+                                    "Quote the property name.",
+                                );
+                            }
+                            Some(Text::Input(from, to))
+                        } else if let Some(value) = keyword(word) {
+                            return self.emit_entry(
+                                cur,
+                                handler,
+                                None,
+                                None,
+                                RawValue::Other(value),
+                            );
+                        } else {
+                            return cur.error_help(
+                                start,
+                                "identifiers cannot be used as values",
+                                "Quote the value to make it a string, or add `=` to make it a property.",
+                            );
+                        }
+                    }
+                    _ => return cur.error(start, "expected entry"),
+                }
+            };
+            match key {
+                Some(key) => {
+                    cur.pos += 1;
+                    name_text = Some(key);
+                    ty_text = annotation(cur, ty)?;
+                    value(cur, value_scratch)?
+                }
+                None => RawValue::Other(number(cur, value_scratch)?),
+            }
+        };
+        self.emit_entry(cur, handler, name_text, ty_text, value_raw)
+    }
+
+    fn emit_entry(
+        &mut self,
+        cur: &Cursor,
+        handler: &mut impl Handler,
+        name: Option<Text>,
+        ty: Option<Text>,
+        value: RawValue,
+    ) -> Res<()> {
+        let suppressed =
+            self.slashdash.take().is_some() || self.stack.last().map_or(false, |it| it.suppressed);
+        self.spaced = false;
+        if suppressed {
+            return Ok(());
+        }
+        let [name_scratch, ty_scratch, value_scratch] = &self.scratch;
+        let name = name.map(|it| resolve(cur.s, name_scratch, it));
+        let ty = ty.map(|it| resolve(cur.s, ty_scratch, it));
+        let value = match value {
+            RawValue::Text(text, which) => {
+                Value::String(resolve(cur.s, value_scratch, text), which)
+            }
+            RawValue::Other(value) => value,
+        };
+        emit(handler.entry(name, ty, value))
+    }
+}
+
+pub(crate) fn utf8(bytes: &[u8]) -> Result<&str, Stop> {
+    str::from_utf8(bytes).map_err(|err| {
+        Stop::Error(KdlDiagnostic::new(
+            err.valid_up_to(),
+            err.error_len().unwrap_or(1),
+            "invalid UTF-8",
+        ))
+    })
+}
+
+/// Parses a whole input held in memory, without copying it.
+pub(crate) fn parse(s: &str, handler: &mut impl Handler) -> Result<(), Stop> {
+    let mut cur = Cursor::new(s, 0, true);
+    Machine::default().run(&mut cur, handler).map(|_| ())
+}
+
+/// Incremental parser fed with chunks of input.
+#[derive(Default)]
+pub struct KdlEventParser {
+    machine: Machine,
+    /// Unconsumed input, starting at absolute offset `offset`.
+    buf: Vec<u8>,
+    offset: usize,
+    /// `buf[..valid]` is known to be valid UTF-8.
+    valid: usize,
+    failed: Option<Stop>,
+}
+
+impl KdlEventParser {
+    fn validate(&mut self, eof: bool) -> Result<(), Stop> {
+        match str::from_utf8(&self.buf[self.valid..]) {
+            Ok(_) => self.valid = self.buf.len(),
+            Err(err) => {
+                self.valid += err.valid_up_to();
+                if err.error_len().is_some() || eof {
+                    return Err(Stop::Error(KdlDiagnostic::new(
+                        self.offset + self.valid,
+                        err.error_len().unwrap_or(1),
+                        "invalid UTF-8",
+                    )));
+                }
+            }
+        }
+        Ok(())
+    }
+
+    fn step(&mut self, eof: bool, handler: &mut impl Handler) -> Result<(), Stop> {
+        self.validate(eof)?;
+        let s = unsafe { str::from_utf8_unchecked(&self.buf[..self.valid]) };
+        let mut cur = Cursor::new(s, self.offset, eof);
+        let consumed = match self.machine.run(&mut cur, handler) {
+            Ok(_) => cur.pos,
+            Err(Stop::Incomplete) if !eof => cur.pos,
+            Err(Stop::Incomplete) => unreachable!("complete input cannot be incomplete"),
+            Err(stop) => return Err(stop),
+        };
+        self.buf.drain(..consumed);
+        self.valid -= consumed;
+        self.offset += consumed;
+        Ok(())
+    }
+
+    /// Parses `chunk`; once a parse fails, every later call fails the same way.
+    pub(crate) fn feed(
+        &mut self,
+        chunk: &[u8],
+        eof: bool,
+        handler: &mut impl Handler,
+    ) -> Result<(), Stop> {
+        if let Some(stop) = self.failed {
+            return Err(stop);
+        }
+        self.buf.extend_from_slice(chunk);
+        self.step(eof, handler)
+            .map_err(|stop| *self.failed.insert(stop))
+    }
+}
+
+#[repr(C)]
+pub struct KdlEventHandler {
+    user: *mut c_void,
+    node_begin: Option<unsafe extern "C" fn(*mut c_void, KdlFlatString, KdlFlatString) -> bool>,
+    entry: Option<
+        unsafe extern "C" fn(*mut c_void, KdlFlatString, KdlFlatString, u8, KdlFlatPayload) -> bool,
+    >,
+    children_begin: Option<unsafe extern "C" fn(*mut c_void) -> bool>,
+    children_end: Option<unsafe extern "C" fn(*mut c_void) -> bool>,
+    node_end: Option<unsafe extern "C" fn(*mut c_void) -> bool>,
+}
+
+impl Handler for &KdlEventHandler {
+    fn node_begin(&mut self, name: &str, ty: Option<&str>) -> bool {
+        self.node_begin.map_or(true, |f| unsafe {
+            f(self.user, KdlFlatString::new(name), KdlFlatString::opt(ty))
+        })
+    }
+
+    fn entry(&mut self, name: Option<&str>, ty: Option<&str>, value: Value<'_>) -> bool {
+        self.entry.map_or(true, |f| unsafe {
+            f(
+                self.user,
+                KdlFlatString::opt(name),
+                KdlFlatString::opt(ty),
+                value.which() as u8,
+                value.payload(),
+            )
+        })
+    }
+
+    fn children_begin(&mut self) -> bool {
+        self.children_begin
+            .map_or(true, |f| unsafe { f(self.user) })
+    }
+
+    fn children_end(&mut self) -> bool {
+        self.children_end.map_or(true, |f| unsafe { f(self.user) })
+    }
+
+    fn node_end(&mut self) -> bool {
+        self.node_end.map_or(true, |f| unsafe { f(self.user) })
+    }
+}
+
+pub(crate) fn report(
+    result: Result<(), Stop>,
+    error: Option<&mut KdlDiagnostic>,
+) -> KdlParseStatus {
+    let (status, diag) = match result {
+        Ok(()) => (KdlParseStatus::Ok, KdlDiagnostic::NONE),
+        Err(Stop::Error(diag)) => (KdlParseStatus::Error, diag),
+        Err(Stop::Stopped) => (KdlParseStatus::Stopped, KdlDiagnostic::NONE),
+        Err(Stop::Incomplete) => unreachable!("complete input cannot be incomplete"),
+    };
+    if let Some(error) = error {
+        *error = diag;
+    }
+    status
+}
+
+#[no_mangle]
+pub unsafe extern "C" fn KDL_Parse_events(
+    s: *const u8,
+    len: usize,
+    handler: &KdlEventHandler,
+    error: Option<&mut KdlDiagnostic>,
+) -> KdlParseStatus {
+    let bytes = if len == 0 {
+        &[]
+    } else {
+        slice::from_raw_parts(s, len)
+    };
+    let result = utf8(bytes).and_then(|s| parse(s, &mut { handler }));
+    report(result, error)
+}
+
+#[no_mangle]
+pub extern "C" fn KDL_EventParser_new() -> Box<KdlEventParser> {
+    Box::default()
+}
+
+#[no_mangle]
+pub extern "C" fn KDL_EventParser_free(_parser: Box<KdlEventParser>) {}
+
+#[no_mangle]
+pub unsafe extern "C" fn KDL_EventParser_feed(
+    parser: &mut KdlEventParser,
+    s: *const u8,
+    len: usize,
+    handler: &KdlEventHandler,
+    error: Option<&mut KdlDiagnostic>,
+) -> KdlParseStatus {
+    let chunk = if len == 0 {
+        &[]
+    } else {
+        slice::from_raw_parts(s, len)
+    };
+    report(parser.feed(chunk, false, &mut { handler }), error)
+}
+
+#[no_mangle]
+pub extern "C" fn KDL_EventParser_finish(
+    parser: &mut KdlEventParser,
+    handler: &KdlEventHandler,
+    error: Option<&mut KdlDiagnostic>,
+) -> KdlParseStatus {
+    report(parser.feed(&[], true, &mut { handler }), error)
+}
+
+#[cfg(test)]
+pub(crate) mod tests {
+    use super::*;
+
+    /// Writes each event as a line, so runs can be compared.
+    #[derive(Default)]
+    struct Recorder(Vec<String>);
+
+    impl Handler for Recorder {
+        fn node_begin(&mut self, name: &str, ty: Option<&str>) -> bool {
+            self.0.push(format!("node {ty:?} {name:?}"));
+            true
+        }
+        fn entry(&mut self, name: Option<&str>, ty: Option<&str>, value: Value<'_>) -> bool {
+            let value = match value {
+                Value::String(s, which) => format!("{} {s:?}", which as u8),
+                Value::Int(i, which) => format!("{} {i}", which as u8),
+                Value::Float(f) => format!("float {f:?}"),
+                Value::Bool(b) => format!("bool {b}"),
+                Value::Null => "null".to_owned(),
+            };
+            self.0.push(format!("entry {name:?} {ty:?} {value}"));
+            true
+        }
+        fn children_begin(&mut self) -> bool {
+            self.0.push("{".to_owned());
+            true
+        }
+        fn children_end(&mut self) -> bool {
+            self.0.push("}".to_owned());
+            true
+        }
+        fn node_end(&mut self) -> bool {
+            self.0.push(";".to_owned());
+            true
+        }
+    }
+
+    fn outcome(result: Result<(), Stop>) -> Result<(), (usize, usize, String)> {
+        match result {
+            Ok(()) => Ok(()),
+            Err(Stop::Error(diag)) => {
+                let label = unsafe { diag.label.as_str() }.unwrap_or("");
+                Err((diag.offset, diag.length, label.to_owned()))
+            }
+            Err(Stop::Stopped) => panic!("recorder never stops"),
+            Err(Stop::Incomplete) => panic!("complete input cannot be incomplete"),
+        }
+    }
+
+    fn one_shot(input: &[u8]) -> (Vec<String>, Result<(), (usize, usize, String)>) {
+        let mut recorder = Recorder::default();
+        let result = utf8(input).and_then(|s| parse(s, &mut recorder));
+        (recorder.0, outcome(result))
+    }
+
+    fn fed(chunks: &[&[u8]]) -> (Vec<String>, Result<(), (usize, usize, String)>) {
+        let mut recorder = Recorder::default();
+        let mut parser = KdlEventParser::default();
+        let mut result = Ok(());
+        for chunk in chunks {
+            result = result.and_then(|()| parser.feed(chunk, false, &mut recorder));
+        }
+        result = result.and_then(|()| parser.feed(&[], true, &mut recorder));
+        (recorder.0, outcome(result))
+    }
+
+    pub(crate) const VALID: &[&str] = &[
+        "",
+        "node",
+        "node 1 2.5 -3 0x1F 0o17 0b101 1_000 1.5e-3 true false null\n",
+        "(ty)node (u8)1 key=\"value\" k=(u)2; other\n",
+        r#"escapes "a\nb\tc\\d\"e\/f\b\f\u{e9}\u{1F600}" "plain""#,
+        r###"raw r"no \escapes" r#"has "quotes""# r##"a "# inside"##"###,
+        "parent {\n    child 1 {\n        grandchild\n    }\n    sibling; other\n}\n",
+        "/- skipped 1 2 { nested }\nkept /- 1 2 /- key=3 {\n  child\n}\n",
+        "node /-  {\n  gone\n}\nnext 1 /-   2 3 /-\tkey=4\n",
+        "// line comment\nnode /* block /* nested */ comment */ 1 // trailing\n",
+        "node 1 \\\n    2 \\ // escline comment\n    3\n",
+        "node\r\nother\u{85}third\u{2028}fourth\u{0C}fifth\r",
+        "caf\u{e9} \"\u{1F600}\" \u{3000}arg=\"\u{A0}\"\n",
+        "\"quoted name\" \"key with space\"=1\n",
+        "a;b;c{};d {}",
+    ];
+
+    /// Errors must be reported at the same place however the input is split.
+    pub(crate) const INVALID: &[&str] = &[
+        "node \"unclosed",
+        "node \"bad \\q escape\"",
+        "node r#\"unclosed raw\"",
+        "node {\n  child\n",
+        "node }",
+        "node 0x",
+        "node /* unclosed",
+        "node (ty",
+        "node key=",
+    ];
+
+    #[test]
+    fn feeding_matches_one_shot_at_every_split() {
+        let valid = VALID.iter().map(|s| (s, true));
+        for (input, ok) in valid.chain(INVALID.iter().map(|s| (s, false))) {
+            let input = input.as_bytes();
+            let expected = one_shot(input);
+            assert_eq!(
+                expected.1.is_ok(),
+                ok,
+                "{:?}: {:?}",
+                str::from_utf8(input),
+                expected.1
+            );
+            assert_eq!(fed(&[input]), expected, "{input:?} whole");
+            for at in 0..=input.len() {
+                let (a, b) = input.split_at(at);
+                assert_eq!(fed(&[a, b]), expected, "{input:?} split at {at}");
+            }
+            let bytes: Vec<&[u8]> = input.chunks(1).collect();
+            assert_eq!(fed(&bytes), expected, "{input:?} byte by byte");
+        }
+    }
+
+    #[test]
+    fn invalid_utf8_is_reported_at_every_split() {
+        // Events before the bad byte may already have been delivered when fed.
+        let input = b"node \"caf\xC3\xA9\" \xFF";
+        let (_, expected) = one_shot(input);
+        assert!(expected.is_err());
+        for at in 0..=input.len() {
+            let (a, b) = input.split_at(at);
+            assert_eq!(fed(&[a, b]).1, expected, "split at {at}");
+        }
+    }
+
+    #[test]
+    fn empty_input_from_c() {
+        let handler = KdlEventHandler {
+            user: std::ptr::null_mut(),
+            node_begin: None,
+            entry: None,
+            children_begin: None,
+            children_end: None,
+            node_end: None,
+        };
+        let status = unsafe { KDL_Parse_events(std::ptr::null(), 0, &handler, None) };
+        assert!(status == KdlParseStatus::Ok);
+    }
+}
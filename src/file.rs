@@ -0,0 +1,304 @@
+use crate::borrowed;
+use crate::events::{report, KdlDiagnostic, KdlParseStatus};
+use crate::flat::KdlFlatDocument;
+use crate::stats::{self, KdlParseTiming};
+use kdl::*;
+use std::os::raw::c_int;
+use std::{fs::File, io, ops::Deref, path::Path, ptr, slice, str, sync::Arc};
+
+/// A read-only mapping of a whole file.
+pub(crate) struct Mapping {
+    ptr: *const u8,
+    len: usize,
+}
+
+unsafe impl Send for Mapping {}
+unsafe impl Sync for Mapping {}
+
+impl Mapping {
+    pub(crate) fn open(path: &Path) -> io::Result<Mapping> {
+        let file = File::open(path)?;
+        let len = usize::try_from(file.metadata()?.len())
+            .map_err(|_| io::Error::from_raw_os_error(sys::FILE_TOO_LARGE))?;
+        if len == 0 {
+            // Neither platform maps empty files.
+            return Ok(Mapping {
+                ptr: ptr::NonNull::dangling().as_ptr(),
+                len,
+            });
+        }
+        let ptr = unsafe { sys::map(&file, len)? };
+        Ok(Mapping { ptr, len })
+    }
+}
+
+impl Deref for Mapping {
+    type Target = [u8];
+
+    fn deref(&self) -> &[u8] {
+        unsafe { slice::from_raw_parts(self.ptr, self.len) }
+    }
+}
+
+impl Drop for Mapping {
+    fn drop(&mut self) {
+        if self.len != 0 {
+            unsafe { sys::unmap(self.ptr, self.len) }
+        }
+    }
+}
+
+#[cfg(unix)]
+mod sys {
+    use std::os::raw::{c_int, c_long, c_void};
+    use std::{fs::File, io, os::unix::io::AsRawFd, ptr};
+
+    pub(super) const FILE_TOO_LARGE: c_int = 27; // EFBIG
+    pub(super) const INVALID_PATH: c_int = 22; // EINVAL
+
+    const PROT_READ: c_int = 1;
+    const MAP_PRIVATE: c_int = 2;
+    const MADV_SEQUENTIAL: c_int = 2;
+
+    extern "C" {
+        fn mmap(
+            addr: *mut c_void,
+            len: usize,
+            prot: c_int,
+            flags: c_int,
+            fd: c_int,
+            offset: c_long,
+        ) -> *mut c_void;
+        fn munmap(addr: *mut c_void, len: usize) -> c_int;
+        fn madvise(addr: *mut c_void, len: usize, advice: c_int) -> c_int;
+    }
+
+    pub(super) unsafe fn map(file: &File, len: usize) -> io::Result<*const u8> {
+        let ptr = mmap(
+            ptr::null_mut(),
+            len,
+            PROT_READ,
+            MAP_PRIVATE,
+            file.as_raw_fd(),
+            0,
+        );
+        if ptr as usize == usize::MAX {
+            return Err(io::Error::last_os_error());
+        }
+        // Only a hint; the parser reads front to back.
+        madvise(ptr, len, MADV_SEQUENTIAL);
+        Ok(ptr as *const u8)
+    }
+
+    pub(super) unsafe fn unmap(ptr: *const u8, len: usize) {
+        munmap(ptr as *mut c_void, len);
+    }
+}
+
+#[cfg(windows)]
+mod sys {
+    use std::os::raw::c_void;
+    use std::{fs::File, io, os::windows::io::AsRawHandle, ptr};
+
+    type HANDLE = *mut c_void;
+
+    pub(super) const FILE_TOO_LARGE: i32 = 223; // ERROR_FILE_TOO_LARGE
+    pub(super) const INVALID_PATH: i32 = 123; // ERROR_INVALID_NAME
+
+    const PAGE_READONLY: u32 = 0x02;
+    const FILE_MAP_READ: u32 = 0x04;
+
+    #[link(name = "kernel32")]
+    extern "system" {
+        fn CreateFileMappingW(
+            file: HANDLE,
+            attributes: *mut c_void,
+            protect: u32,
+            size_high: u32,
+            size_low: u32,
+            name: *const u16,
+        ) -> HANDLE;
+        fn MapViewOfFile(
+            mapping: HANDLE,
+            access: u32,
+            offset_high: u32,
+            offset_low: u32,
+            len: usize,
+        ) -> *mut c_void;
+        fn UnmapViewOfFile(base: *const c_void) -> i32;
+        fn CloseHandle(handle: HANDLE) -> i32;
+    }
+
+    pub(super) unsafe fn map(file: &File, len: usize) -> io::Result<*const u8> {
+        let mapping = CreateFileMappingW(
+            file.as_raw_handle() as HANDLE,
+            ptr::null_mut(),
+            PAGE_READONLY,
+            0,
+            0,
+            ptr::null(),
+        );
+        if mapping.is_null() {
+            return Err(io::Error::last_os_error());
+        }
+        let view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, len);
+        let result = if view.is_null() {
+            Err(io::Error::last_os_error())
+        } else {
+            Ok(view as *const u8)
+        };
+        // The view keeps the mapping object alive.
+        CloseHandle(mapping);
+        result
+    }
+
+    pub(super) unsafe fn unmap(ptr: *const u8, _len: usize) {
+        UnmapViewOfFile(ptr as *const c_void);
+    }
+}
+
+/// Maps the file at `path`, reporting any failure as an OS error code.
+fn open(path: &str, os_error: Option<&mut c_int>) -> Option<Mapping> {
+    let result = Mapping::open(Path::new(path));
+    if let Some(os_error) = os_error {
+        *os_error = match &result {
+            Ok(_) => 0,
+            // The standard library rejects some paths, e.g. with a NUL,
+            // before they reach the OS.
+            Err(err) => err.raw_os_error().unwrap_or(sys::INVALID_PATH),
+        };
+    }
+    result.ok()
+}
+
+/// The error for a file that could not be read, spanning its path.
+fn unreadable(path: &str) -> KdlError {
+    KdlError {
+        input: Arc::new(path.to_owned()),
+        span: (0, path.len()).into(),
+        label: Some("could not read file"),
+        help: None,
+        kind: KdlErrorKind::Context("readable file"),
+    }
+}
+
+pub(crate) fn invalid_utf8(bytes: &[u8], err: str::Utf8Error) -> KdlError {
+    // Lossy conversion keeps everything before the error at the same offset.
+    KdlError {
+        input: Arc::new(String::from_utf8_lossy(bytes).into_owned()),
+        span: (err.valid_up_to(), char::REPLACEMENT_CHARACTER.len_utf8()).into(),
+        label: Some("invalid UTF-8"),
+        help: None,
+        kind: KdlErrorKind::Context("valid UTF-8"),
+    }
+}
+
+#[no_mangle]
+pub unsafe extern "C" fn KDL_Document_parse_file(
+    path: *const u8,
+    path_len: usize,
+    docptr: &mut *mut KdlDocument,
+    errptr: &mut *mut KdlError,
+    os_error: Option<&mut c_int>,
+) -> bool {
+    *docptr = ptr::null_mut();
+    *errptr = ptr::null_mut();
+    let path = str::from_utf8_unchecked(slice::from_raw_parts(path, path_len));
+    let mut timing = KdlParseTiming::default();
+    let Some(mapping) = timing.read(|| open(path, os_error)) else {
+        *errptr = Box::into_raw(Box::new(unreadable(path)));
+        return false;
+    };
+    // Both the document and the error own their strings, so the mapping
+    // only needs to outlive the parse.
+    let result = stats::record(mapping.len(), timing, |timing| {
+        match timing.validate(|| str::from_utf8(&mapping)) {
+            Ok(s) => timing.parse(|| s.parse::<KdlDocument>()),
+            Err(err) => Err(invalid_utf8(&mapping, err)),
+        }
+    });
+    match result {
+        Ok(doc) => {
+            *docptr = Box::into_raw(doc);
+            true
+        }
+        Err(err) => {
+            *errptr = Box::into_raw(err);
+            false
+        }
+    }
+}
+
+#[no_mangle]
+pub unsafe extern "C" fn KDL_Document_parse_file_borrowed(
+    path: *const u8,
+    path_len: usize,
+    flatptr: &mut *mut KdlFlatDocument<'static>,
+    error: Option<&mut KdlDiagnostic>,
+    os_error: Option<&mut c_int>,
+) -> bool {
+    *flatptr = ptr::null_mut();
+    let path = str::from_utf8_unchecked(slice::from_raw_parts(path, path_len));
+    let Some(mapping) = open(path, os_error) else {
+        if let Some(error) = error {
+            *error = KdlDiagnostic::new(0, 0, "could not read file");
+        }
+        return false;
+    };
+    let result = borrowed::parse(&mapping).map(|mut flat| {
+        flat.keep_alive(mapping);
+        *flatptr = Box::into_raw(flat);
+    });
+    report(result, error) == KdlParseStatus::Ok
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    const MISSING: &str = "/nonexistent/kdlxx/missing.kdl";
+
+    #[test]
+    fn unreadable_file_always_reports_an_error() {
+        for os_error in [None, Some(&mut -1)] {
+            let mut doc = ptr::null_mut();
+            let mut err = ptr::null_mut();
+            let ok = unsafe {
+                KDL_Document_parse_file(
+                    MISSING.as_ptr(),
+                    MISSING.len(),
+                    &mut doc,
+                    &mut err,
+                    os_error,
+                )
+            };
+            assert!(!ok && doc.is_null() && !err.is_null());
+            let err = unsafe { Box::from_raw(err) };
+            assert_eq!(err.input.as_str(), MISSING);
+        }
+
+        let mut os_error = 0;
+        let mut diag = KdlDiagnostic::new(1, 1, "unset");
+        let mut flat = ptr::null_mut();
+        let ok = unsafe {
+            KDL_Document_parse_file_borrowed(
+                MISSING.as_ptr(),
+                MISSING.len(),
+                &mut flat,
+                Some(&mut diag),
+                Some(&mut os_error),
+            )
+        };
+        assert!(!ok && flat.is_null());
+        let kind = io::Error::from_raw_os_error(os_error).kind();
+        assert_eq!(kind, io::ErrorKind::NotFound);
+        assert_eq!((diag.offset, diag.length), (0, 0));
+    }
+
+    #[test]
+    fn non_os_errors_have_os_codes() {
+        let mut os_error = 0;
+        assert!(open("nul\0in/path", Some(&mut os_error)).is_none());
+        assert_eq!(os_error, sys::INVALID_PATH);
+    }
+}
@@ -0,0 +1,245 @@
+use crate::file::Mapping;
+use crate::value::which;
+use kdl::*;
+use std::{ptr, slice, str};
+
+#[repr(C)]
+#[derive(Clone, Copy)]
+pub struct KdlFlatString {
+    data: *const u8,
+    len: usize,
+}
+
+impl KdlFlatString {
+    pub(crate) const NONE: Self = KdlFlatString {
+        data: ptr::null(),
+        len: 0,
+    };
+
+    pub(crate) fn new(s: &str) -> Self {
+        KdlFlatString {
+            data: s.as_ptr(),
+            len: s.len(),
+        }
+    }
+
+    pub(crate) fn opt(s: Option<&str>) -> Self {
+        s.map_or(Self::NONE, Self::new)
+    }
+
+    /// The string, or `None` if `data` is null. It must be valid UTF-8 and outlive `'a`.
+    pub(crate) unsafe fn as_str<'a>(&self) -> Option<&'a str> {
+        if self.data.is_null() {
+            None
+        } else {
+            Some(str::from_utf8_unchecked(slice::from_raw_parts(
+                self.data, self.len,
+            )))
+        }
+    }
+
+    fn ident(ident: Option<&KdlIdentifier>) -> Self {
+        ident.map_or(Self::NONE, |it| Self::new(it.value()))
+    }
+}
+
+#[repr(C)]
+#[derive(Clone, Copy)]
+pub struct KdlFlatRange {
+    pub(crate) begin: usize,
+    pub(crate) end: usize,
+}
+
+#[repr(C)]
+#[derive(Clone, Copy)]
+pub union KdlFlatPayload {
+    pub(crate) integer: i64,
+    pub(crate) floating: f64,
+    pub(crate) boolean: bool,
+    pub(crate) string: KdlFlatString,
+}
+
+impl KdlFlatPayload {
+    fn new(value: &KdlValue) -> Self {
+        match value {
+            KdlValue::RawString(s) | KdlValue::String(s) => KdlFlatPayload {
+                string: KdlFlatString::new(s),
+            },
+            KdlValue::Base2(i) | KdlValue::Base8(i) | KdlValue::Base10(i) | KdlValue::Base16(i) => {
+                KdlFlatPayload { integer: *i }
+            }
+            KdlValue::Base10Float(f) => KdlFlatPayload { floating: *f },
+            KdlValue::Bool(b) => KdlFlatPayload { boolean: *b },
+            KdlValue::Null => KdlFlatPayload {
+                string: KdlFlatString::NONE,
+            },
+        }
+    }
+}
+
+#[repr(C)]
+pub struct KdlFlatView {
+    root_count: usize,
+    node_count: usize,
+    node: *const *const KdlNode,
+    node_name: *const KdlFlatString,
+    node_ty: *const KdlFlatString,
+    node_parent: *const usize,
+    node_children: *const KdlFlatRange,
+    node_entries: *const KdlFlatRange,
+    entry_count: usize,
+    entry_name: *const KdlFlatString,
+    entry_ty: *const KdlFlatString,
+    value_which: *const u8,
+    value_payload: *const KdlFlatPayload,
+}
+
+/// Columnar copy of a document's structure, borrowing its strings.
+///
+/// Nodes are laid out breadth-first, so the top-level nodes are `0..root_count`
+/// and every node's direct children occupy one contiguous index range.
+/// Documents parsed without building a `KdlDocument` leave `node` empty.
+#[derive(Default)]
+pub struct KdlFlatColumns<'a> {
+    pub(crate) node: Vec<&'a KdlNode>,
+    pub(crate) node_name: Vec<KdlFlatString>,
+    pub(crate) node_ty: Vec<KdlFlatString>,
+    pub(crate) node_parent: Vec<usize>,
+    pub(crate) node_children: Vec<KdlFlatRange>,
+    pub(crate) node_entries: Vec<KdlFlatRange>,
+    pub(crate) entry_name: Vec<KdlFlatString>,
+    pub(crate) entry_ty: Vec<KdlFlatString>,
+    pub(crate) value_which: Vec<u8>,
+    pub(crate) value_payload: Vec<KdlFlatPayload>,
+}
+
+impl<'a> KdlFlatColumns<'a> {
+    fn new(doc: &'a KdlDocument) -> Self {
+        let mut flat = KdlFlatColumns::default();
+        flat.node.extend(doc.nodes());
+        flat.node_parent.resize(flat.node.len(), usize::MAX);
+        let mut ix = 0;
+        while let Some(&node) = flat.node.get(ix) {
+            flat.node_name.push(KdlFlatString::new(node.name().value()));
+            flat.node_ty.push(KdlFlatString::ident(node.ty()));
+
+            let begin = flat.entry_name.len();
+            for entry in node.entries() {
+                flat.entry_name.push(KdlFlatString::ident(entry.name()));
+                flat.entry_ty.push(KdlFlatString::ident(entry.ty()));
+                flat.value_which.push(which(entry.value()) as u8);
+                flat.value_payload.push(KdlFlatPayload::new(entry.value()));
+            }
+            let end = flat.entry_name.len();
+            flat.node_entries.push(KdlFlatRange { begin, end });
+
+            let begin = flat.node.len();
+            if let Some(children) = node.children() {
+                flat.node.extend(children.nodes());
+            }
+            let end = flat.node.len();
+            flat.node_parent.resize(end, ix);
+            flat.node_children.push(KdlFlatRange { begin, end });
+
+            ix += 1;
+        }
+        flat
+    }
+
+    fn view(&self, root_count: usize) -> KdlFlatView {
+        KdlFlatView {
+            root_count,
+            node_count: self.node_name.len(),
+            node: if self.node.is_empty() {
+                ptr::null()
+            } else {
+                self.node.as_ptr().cast()
+            },
+            node_name: self.node_name.as_ptr(),
+            node_ty: self.node_ty.as_ptr(),
+            node_parent: self.node_parent.as_ptr(),
+            node_children: self.node_children.as_ptr(),
+            node_entries: self.node_entries.as_ptr(),
+            entry_count: self.entry_name.len(),
+            entry_name: self.entry_name.as_ptr(),
+            entry_ty: self.entry_ty.as_ptr(),
+            value_which: self.value_which.as_ptr(),
+            value_payload: self.value_payload.as_ptr(),
+        }
+    }
+}
+
+pub struct KdlFlatDocument<'a> {
+    view: KdlFlatView,
+    _columns: KdlFlatColumns<'a>,
+    /// Strings that could not borrow from the source.
+    _owned: Vec<Box<str>>,
+    /// The source, when the flat document is responsible for keeping it alive.
+    _source: Option<Mapping>,
+}
+
+impl<'a> KdlFlatDocument<'a> {
+    pub(crate) fn new(
+        columns: KdlFlatColumns<'a>,
+        root_count: usize,
+        owned: Vec<Box<str>>,
+    ) -> Box<Self> {
+        Box::new(KdlFlatDocument {
+            view: columns.view(root_count),
+            _columns: columns,
+            _owned: owned,
+            _source: None,
+        })
+    }
+
+    pub(crate) fn keep_alive(&mut self, source: Mapping) {
+        self._source = Some(source);
+    }
+
+    #[cfg(test)]
+    pub(crate) fn columns(&self) -> &KdlFlatColumns<'a> {
+        &self._columns
+    }
+}
+
+#[no_mangle]
+pub extern "C" fn KDL_Document_flatten(doc: &KdlDocument) -> Box<KdlFlatDocument<'_>> {
+    KdlFlatDocument::new(KdlFlatColumns::new(doc), doc.nodes().len(), Vec::new())
+}
+
+#[no_mangle]
+pub extern "C" fn KDL_FlatDocument_free(_flat: Box<KdlFlatDocument<'_>>) {}
+
+#[no_mangle]
+pub extern "C" fn KDL_FlatDocument_view_v1<'a>(flat: &'a KdlFlatDocument<'_>) -> &'a KdlFlatView {
+    &flat.view
+}
+
+// The layouts above are version 1 of `KDL_LAYOUT_VERSION` in kdl.h, which
+// `KDL_FlatDocument_view_v1` is named for. Change either together, along
+// with these assertions and the matching ones in `kdl::layout`.
+const _: () = {
+    use std::mem::{align_of, offset_of, size_of};
+    const WORD: usize = size_of::<usize>();
+    assert!(size_of::<KdlFlatString>() == 2 * WORD);
+    assert!(offset_of!(KdlFlatString, len) == WORD);
+    assert!(size_of::<KdlFlatRange>() == 2 * WORD);
+    assert!(offset_of!(KdlFlatRange, end) == WORD);
+    assert!(size_of::<KdlFlatPayload>() == if 2 * WORD > 8 { 2 * WORD } else { 8 });
+    assert!(align_of::<KdlFlatPayload>() >= WORD);
+    // Every column of the view is one word, in declaration order.
+    assert!(size_of::<KdlFlatView>() == 13 * WORD);
+    assert!(offset_of!(KdlFlatView, root_count) == 0);
+    assert!(offset_of!(KdlFlatView, node_count) == WORD);
+    assert!(offset_of!(KdlFlatView, node) == 2 * WORD);
+    assert!(offset_of!(KdlFlatView, node_name) == 3 * WORD);
+    assert!(offset_of!(KdlFlatView, node_ty) == 4 * WORD);
+    assert!(offset_of!(KdlFlatView, node_parent) == 5 * WORD);
+    assert!(offset_of!(KdlFlatView, node_children) == 6 * WORD);
+    assert!(offset_of!(KdlFlatView, node_entries) == 7 * WORD);
+    assert!(offset_of!(KdlFlatView, entry_count) == 8 * WORD);
+    assert!(offset_of!(KdlFlatView, entry_name) == 9 * WORD);
+    assert!(offset_of!(KdlFlatView, entry_ty) == 10 * WORD);
+    assert!(offset_of!(KdlFlatView, value_which) == 11 * WORD);
+    assert!(offset_of!(KdlFlatView, value_payload) == 12 * WORD);
+};
@@ -0,0 +1,286 @@
+use crate::symbol::{AddressMap, KdlSymbol, SymbolMap, Table};
+use kdl::*;
+use std::{collections::HashMap, ptr, slice, str};
+
+pub struct KdlDocumentIndex<'a> {
+    root: &'a KdlDocument,
+    /// Every node and property name in the document, and no others.
+    symbols: Table<'a>,
+    /// The symbol of each node and property name identifier, by address.
+    names: AddressMap<KdlIdentifier, KdlSymbol>,
+    nodes: HashMap<*const KdlDocument, SymbolMap<Vec<&'a KdlNode>>>,
+    props: HashMap<*const KdlNode, SymbolMap<&'a KdlEntry>>,
+}
+
+impl<'a> KdlDocumentIndex<'a> {
+    fn new(root: &'a KdlDocument) -> Self {
+        let mut index = KdlDocumentIndex {
+            root,
+            symbols: Table::default(),
+            names: AddressMap::default(),
+            nodes: HashMap::new(),
+            props: HashMap::new(),
+        };
+        index.insert(root);
+        index
+    }
+
+    fn insert(&mut self, doc: &'a KdlDocument) {
+        let mut nodes =
+            SymbolMap::<Vec<_>>::with_capacity_and_hasher(doc.nodes().len(), Default::default());
+        for node in doc.nodes() {
+            nodes.entry(self.name(node.name())).or_default().push(node);
+            let mut props = SymbolMap::default();
+            for entry in node.entries() {
+                if let Some(name) = entry.name() {
+                    // like `KdlNode::get`, the last property with a given name wins
+                    props.insert(self.name(name), entry);
+                }
+            }
+            if !props.is_empty() {
+                self.props.insert(node, props);
+            }
+            if let Some(children) = node.children() {
+                self.insert(children);
+            }
+        }
+        self.nodes.insert(doc, nodes);
+    }
+
+    fn name(&mut self, name: &'a KdlIdentifier) -> KdlSymbol {
+        let symbol = self.symbols.intern(name.value());
+        self.names.insert(name, symbol);
+        symbol
+    }
+
+    fn all(&self, doc: Option<&KdlDocument>, name: KdlSymbol) -> &[&'a KdlNode] {
+        let doc: *const KdlDocument = doc.unwrap_or(self.root);
+        self.nodes
+            .get(&doc)
+            .and_then(|nodes| nodes.get(&name))
+            .map_or(&[], Vec::as_slice)
+    }
+
+    fn prop(&self, node: &KdlNode, name: KdlSymbol) -> Option<&'a KdlEntry> {
+        self.props
+            .get(&(node as *const KdlNode))
+            .and_then(|props| props.get(&name))
+            .copied()
+    }
+
+    /// The symbol for a name passed in; 0, matching nothing, for a name
+    /// that is nowhere in the document.
+    unsafe fn lookup(&self, s: *const u8, len: usize) -> KdlSymbol {
+        let name = if len == 0 {
+            ""
+        } else {
+            str::from_utf8_unchecked(slice::from_raw_parts(s, len))
+        };
+        self.symbols.find(name).unwrap_or(0)
+    }
+}
+
+fn head<T>(items: &[T], count: &mut usize) -> *const T {
+    *count = items.len();
+    if items.is_empty() {
+        ptr::null()
+    } else {
+        items.as_ptr()
+    }
+}
+
+#[no_mangle]
+pub extern "C" fn KDL_Document_index(doc: &KdlDocument) -> Box<KdlDocumentIndex<'_>> {
+    Box::new(KdlDocumentIndex::new(doc))
+}
+
+#[no_mangle]
+pub extern "C" fn KDL_DocumentIndex_free(_index: Box<KdlDocumentIndex<'_>>) {}
+
+#[no_mangle]
+pub unsafe extern "C" fn KDL_DocumentIndex_get<'a>(
+    index: &KdlDocumentIndex<'a>,
+    doc: Option<&KdlDocument>,
+    s: *const u8,
+    len: usize,
+) -> Option<&'a KdlNode> {
+    KDL_DocumentIndex_get_symbol(index, doc, index.lookup(s, len))
+}
+
+#[no_mangle]
+pub extern "C" fn KDL_DocumentIndex_get_symbol<'a>(
+    index: &KdlDocumentIndex<'a>,
+    doc: Option<&KdlDocument>,
+    name: KdlSymbol,
+) -> Option<&'a KdlNode> {
+    index.all(doc, name).first().copied()
+}
+
+#[no_mangle]
+pub unsafe extern "C" fn KDL_DocumentIndex_get_all<'a>(
+    index: &KdlDocumentIndex<'a>,
+    doc: Option<&KdlDocument>,
+    s: *const u8,
+    len: usize,
+    count: &mut usize,
+) -> *const &'a KdlNode {
+    KDL_DocumentIndex_get_all_symbol(index, doc, index.lookup(s, len), count)
+}
+
+#[no_mangle]
+pub extern "C" fn KDL_DocumentIndex_get_all_symbol<'a>(
+    index: &KdlDocumentIndex<'a>,
+    doc: Option<&KdlDocument>,
+    name: KdlSymbol,
+    count: &mut usize,
+) -> *const &'a KdlNode {
+    head(index.all(doc, name), count)
+}
+
+#[no_mangle]
+pub unsafe extern "C" fn KDL_DocumentIndex_get_arg<'a>(
+    index: &KdlDocumentIndex<'a>,
+    doc: Option<&KdlDocument>,
+    s: *const u8,
+    len: usize,
+) -> Option<&'a KdlValue> {
+    KDL_DocumentIndex_get_arg_symbol(index, doc, index.lookup(s, len))
+}
+
+#[no_mangle]
+pub extern "C" fn KDL_DocumentIndex_get_arg_symbol<'a>(
+    index: &KdlDocumentIndex<'a>,
+    doc: Option<&KdlDocument>,
+    name: KdlSymbol,
+) -> Option<&'a KdlValue> {
+    let node = index.all(doc, name).first()?;
+    node.get(0).map(KdlEntry::value)
+}
+
+#[no_mangle]
+pub unsafe extern "C" fn KDL_DocumentIndex_get_prop<'a>(
+    index: &KdlDocumentIndex<'a>,
+    node: &KdlNode,
+    s: *const u8,
+    len: usize,
+) -> Option<&'a KdlEntry> {
+    index.prop(node, index.lookup(s, len))
+}
+
+#[no_mangle]
+pub extern "C" fn KDL_DocumentIndex_get_prop_symbol<'a>(
+    index: &KdlDocumentIndex<'a>,
+    node: &KdlNode,
+    name: KdlSymbol,
+) -> Option<&'a KdlEntry> {
+    index.prop(node, name)
+}
+
+#[no_mangle]
+pub unsafe extern "C" fn KDL_DocumentIndex_symbol(
+    index: &KdlDocumentIndex<'_>,
+    s: *const u8,
+    len: usize,
+) -> KdlSymbol {
+    index.lookup(s, len)
+}
+
+/// Node and property names of the indexed document are found by address;
+/// any other identifier falls back to a lookup by its string.
+#[no_mangle]
+pub extern "C" fn KDL_DocumentIndex_name_symbol(
+    index: &KdlDocumentIndex<'_>,
+    name: &KdlIdentifier,
+) -> KdlSymbol {
+    match index.names.get(&(name as *const KdlIdentifier)) {
+        Some(&symbol) => symbol,
+        None => index.symbols.find(name.value()).unwrap_or(0),
+    }
+}
+
+#[no_mangle]
+pub extern "C" fn KDL_DocumentIndex_symbol_name(
+    index: &KdlDocumentIndex<'_>,
+    symbol: KdlSymbol,
+    len: &mut usize,
+) -> *const u8 {
+    match index.symbols.name(symbol) {
+        Some(name) => {
+            *len = name.len();
+            name.as_ptr()
+        }
+        None => {
+            *len = 0;
+            ptr::null()
+        }
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn symbol(index: &KdlDocumentIndex<'_>, name: &str) -> KdlSymbol {
+        unsafe { KDL_DocumentIndex_symbol(index, name.as_ptr(), name.len()) }
+    }
+
+    #[test]
+    fn symbols_belong_to_their_index() {
+        let a: KdlDocument = "x k=1\ny {\n    x\n}\n".parse().unwrap();
+        let b: KdlDocument = "y\nz\n".parse().unwrap();
+        let (a_index, b_index) = (KdlDocumentIndex::new(&a), KdlDocumentIndex::new(&b));
+
+        let x = symbol(&a_index, "x");
+        assert_ne!(x, 0);
+        assert_eq!(symbol(&a_index, "k"), a_index.symbols.find("k").unwrap());
+        assert_eq!(symbol(&a_index, "z"), 0);
+        assert_eq!(symbol(&b_index, "x"), 0);
+        assert_eq!(a_index.symbols.name(x), Some("x"));
+        assert_eq!(a_index.symbols.name(0), None);
+
+        let y = KDL_DocumentIndex_get_symbol(&a_index, None, symbol(&a_index, "y")).unwrap();
+        let mut count = 0;
+        KDL_DocumentIndex_get_all_symbol(&a_index, y.children(), x, &mut count);
+        assert_eq!(count, 1);
+        let k = symbol(&a_index, "k");
+        let first = KDL_DocumentIndex_get_symbol(&a_index, None, x).unwrap();
+        assert_eq!(
+            KDL_DocumentIndex_get_prop_symbol(&a_index, first, k).map(KdlEntry::value),
+            Some(&KdlValue::Base10(1))
+        );
+        let name = unsafe { KDL_DocumentIndex_get(&a_index, None, ptr::null(), 0) };
+        assert!(name.is_none());
+    }
+
+    #[test]
+    fn identifiers_map_to_their_symbols() {
+        let a: KdlDocument = "x k=1\ny {\n    x k=2\n}\n".parse().unwrap();
+        let b: KdlDocument = "x k=3\nz\n".parse().unwrap();
+        let index = KdlDocumentIndex::new(&a);
+
+        let (x, k) = (symbol(&index, "x"), symbol(&index, "k"));
+        let y = &a.nodes()[1];
+        assert_eq!(
+            KDL_DocumentIndex_name_symbol(&index, a.nodes()[0].name()),
+            x
+        );
+        assert_eq!(
+            KDL_DocumentIndex_name_symbol(&index, y.name()),
+            symbol(&index, "y")
+        );
+        let nested = &y.children().unwrap().nodes()[0];
+        assert_eq!(KDL_DocumentIndex_name_symbol(&index, nested.name()), x);
+        let prop = nested.entries()[0].name().unwrap();
+        assert_eq!(KDL_DocumentIndex_name_symbol(&index, prop), k);
+
+        // identifiers from elsewhere are looked up by name
+        assert_eq!(
+            KDL_DocumentIndex_name_symbol(&index, b.nodes()[0].name()),
+            x
+        );
+        assert_eq!(
+            KDL_DocumentIndex_name_symbol(&index, b.nodes()[1].name()),
+            0
+        );
+    }
+}
@@ -0,0 +1,415 @@
+use crate::parallel::{skip_block_comment, skip_raw_string, skip_string, terminators};
+use crate::reparse::{has_node, shift_document, shift_node};
+use kdl::*;
+use std::ops::Range;
+use std::sync::{Arc, OnceLock};
+use std::{mem, ptr, slice, str};
+
+/// A document whose children blocks are parsed on first access.
+pub struct KdlLazyDocument {
+    nodes: Vec<KdlLazyNode>,
+}
+
+/// A node parsed without its children block.
+pub struct KdlLazyNode {
+    node: KdlNode,
+    children: Option<Children>,
+}
+
+/// A children block, located in `source` until it is first parsed.
+struct Children {
+    source: Arc<String>,
+    range: Range<usize>,
+    parsed: OnceLock<Result<KdlLazyDocument, KdlError>>,
+}
+
+impl Children {
+    fn get(&self) -> &Result<KdlLazyDocument, KdlError> {
+        self.parsed
+            .get_or_init(|| parse(&self.source, self.range.clone()))
+    }
+}
+
+/// Finds the first children block outside strings and comments, returning
+/// the offsets of its braces, or `Err` if braces are unbalanced.
+fn children_block(s: &[u8]) -> Result<Option<(usize, usize)>, ()> {
+    let mut depth = 0usize;
+    let mut open = 0;
+    let mut i = 0;
+    while i < s.len() {
+        match s[i] {
+            b'"' => i = skip_string(s, i + 1),
+            b'r' => i = skip_raw_string(s, i).unwrap_or(i + 1),
+            b'/' if s.get(i + 1) == Some(&b'/') => {
+                i = s[i..]
+                    .iter()
+                    .position(|&b| b == b'\n')
+                    .map_or(s.len(), |n| i + n);
+            }
+            b'/' if s.get(i + 1) == Some(&b'*') => i = skip_block_comment(s, i + 2),
+            b'{' => {
+                if depth == 0 {
+                    open = i;
+                }
+                depth += 1;
+                i += 1;
+            }
+            b'}' => {
+                depth = depth.checked_sub(1).ok_or(())?;
+                if depth == 0 {
+                    return Ok(Some((open, i)));
+                }
+                i += 1;
+            }
+            _ => i += 1,
+        }
+    }
+    if depth == 0 {
+        Ok(None)
+    } else {
+        Err(())
+    }
+}
+
+/// Parses `s`, which must hold exactly `count` nodes and starts at `base`
+/// in the source, moving the nodes' spans there.
+fn parse_nodes(s: &str, base: usize, count: usize) -> Option<Vec<KdlNode>> {
+    let mut doc = s.parse::<KdlDocument>().ok()?;
+    let mut nodes = mem::take(doc.nodes_mut());
+    for node in &mut nodes {
+        shift_node(node, base as isize);
+    }
+    (nodes.len() == count).then_some(nodes)
+}
+
+/// Gives `node`, found in `chunk`, the span a parse of the whole document
+/// would: from `from`, where the text leading up to it starts, to the end of
+/// `chunk`, which takes in its children block and terminator. The text
+/// between `from` and `chunk` goes in front of its leading text.
+fn widen(node: &mut KdlNode, source: &str, from: usize, chunk: Range<usize>) {
+    if from < chunk.start {
+        let leading = source[from..chunk.start].to_owned() + node.leading().unwrap_or("");
+        node.set_leading(leading);
+    }
+    let start = from.min(node.span().offset());
+    node.set_span((start, chunk.end - start));
+}
+
+impl KdlLazyDocument {
+    /// Wraps an already parsed document, whose children are then ready.
+    fn ready(source: &Arc<String>, mut doc: KdlDocument) -> Self {
+        let nodes = mem::take(doc.nodes_mut())
+            .into_iter()
+            .map(|node| KdlLazyNode::ready(source, node))
+            .collect();
+        KdlLazyDocument { nodes }
+    }
+
+    /// Splits `source[range]` into top-level nodes, parsing each without its
+    /// children block. Returns `None` if anything is out of the ordinary.
+    fn split(source: &Arc<String>, range: Range<usize>) -> Option<Self> {
+        let s = &source[range.clone()];
+        let mut bounds = terminators(s.as_bytes(), 1);
+        if bounds.last() != Some(&s.len()) {
+            bounds.push(s.len());
+        }
+        let mut nodes = Vec::with_capacity(bounds.len());
+        let mut start = 0;
+        // Where the text leading up to the next node starts.
+        let mut leading = range.start;
+        for end in bounds {
+            let chunk = &s[start..end];
+            let base = range.start + start;
+            let extent = base..range.start + end;
+            start = end;
+            if !has_node(chunk) {
+                // Comments and slashdashed nodes, which are checked in full.
+                parse_nodes(chunk, base, 0)?;
+                continue;
+            }
+            let from = mem::replace(&mut leading, extent.end);
+            match children_block(chunk.as_bytes()).ok()? {
+                // A slashdashed block is rare enough to parse outright.
+                Some((open, _)) if chunk[..open].trim_end().ends_with("/-") => {
+                    let mut node = parse_nodes(chunk, base, 1)?.pop()?;
+                    widen(&mut node, source, from, extent);
+                    nodes.push(KdlLazyNode::ready(source, node));
+                }
+                Some((open, close)) => {
+                    let tail = &chunk[close + 1..];
+                    let tail = tail.strip_suffix(';').unwrap_or(tail);
+                    if tail.contains("/-") {
+                        return None;
+                    }
+                    parse_nodes(tail, 0, 0)?;
+                    let mut node = parse_nodes(&chunk[..open], base, 1)?.pop()?;
+                    widen(&mut node, source, from, extent);
+                    nodes.push(KdlLazyNode {
+                        node,
+                        children: Some(Children {
+                            source: source.clone(),
+                            range: base + open + 1..base + close,
+                            parsed: OnceLock::new(),
+                        }),
+                    });
+                }
+                None => {
+                    let mut node = parse_nodes(chunk, base, 1)?.pop()?;
+                    widen(&mut node, source, from, extent);
+                    nodes.push(KdlLazyNode {
+                        node,
+                        children: None,
+                    });
+                }
+            }
+        }
+        Some(KdlLazyDocument { nodes })
+    }
+}
+
+impl KdlLazyNode {
+    fn ready(source: &Arc<String>, mut node: KdlNode) -> Self {
+        let children = node.children_mut().take().map(|doc| Children {
+            source: source.clone(),
+            range: 0..0,
+            parsed: OnceLock::from(Ok(KdlLazyDocument::ready(source, doc))),
+        });
+        KdlLazyNode { node, children }
+    }
+}
+
+/// Parses `source[range]` lazily. Wherever splitting fails, the range is
+/// parsed in full instead, so errors are those of a full parse of the range,
+/// located within `source`.
+fn parse(source: &Arc<String>, range: Range<usize>) -> Result<KdlLazyDocument, KdlError> {
+    match KdlLazyDocument::split(source, range.clone()) {
+        Some(doc) => Ok(doc),
+        None => parse_full(source, range),
+    }
+}
+
+/// Parses `source[range]` in full, with spans and errors located in `source`.
+fn parse_full(source: &Arc<String>, range: Range<usize>) -> Result<KdlLazyDocument, KdlError> {
+    match source[range.clone()].parse() {
+        Ok(mut doc) => {
+            shift_document(&mut doc, range.start as isize);
+            Ok(KdlLazyDocument::ready(source, doc))
+        }
+        Err(err) => Err(KdlError {
+            input: source.clone(),
+            span: (range.start + err.span.offset(), err.span.len()).into(),
+            ..err
+        }),
+    }
+}
+
+#[no_mangle]
+pub unsafe extern "C" fn KDL_Document_parse_lazy(
+    s: *const u8,
+    len: usize,
+    docptr: &mut *mut KdlLazyDocument,
+    errptr: &mut *mut KdlError,
+) -> bool {
+    let bytes = if len == 0 {
+        &[]
+    } else {
+        slice::from_raw_parts(s, len)
+    };
+    let source = Arc::new(str::from_utf8_unchecked(bytes).to_owned());
+    match parse(&source, 0..len) {
+        Ok(doc) => {
+            *docptr = Box::into_raw(Box::new(doc));
+            *errptr = ptr::null_mut();
+            true
+        }
+        Err(err) => {
+            *docptr = ptr::null_mut();
+            *errptr = Box::into_raw(Box::new(err));
+            false
+        }
+    }
+}
+
+#[no_mangle]
+pub extern "C" fn KDL_LazyDocument_free(_doc: Box<KdlLazyDocument>) {}
+
+#[no_mangle]
+pub extern "C" fn KDL_LazyDocument_nodes(
+    doc: &KdlLazyDocument,
+    len: &mut usize,
+) -> *const KdlLazyNode {
+    *len = doc.nodes.len();
+    doc.nodes.as_ptr()
+}
+
+#[no_mangle]
+pub unsafe extern "C" fn KDL_LazyDocument_get(
+    doc: &KdlLazyDocument,
+    s: *const u8,
+    len: usize,
+) -> Option<&KdlLazyNode> {
+    let name = str::from_utf8_unchecked(slice::from_raw_parts(s, len));
+    doc.nodes
+        .iter()
+        .find(|node| node.node.name().value() == name)
+}
+
+#[no_mangle]
+pub extern "C" fn KDL_LazyNode_node(node: &KdlLazyNode) -> &KdlNode {
+    &node.node
+}
+
+#[no_mangle]
+pub extern "C" fn KDL_LazyNode_has_children(node: &KdlLazyNode) -> bool {
+    node.children.is_some()
+}
+
+#[no_mangle]
+pub extern "C" fn KDL_LazyNode_children(
+    node: &KdlLazyNode,
+    docptr: &mut *const KdlLazyDocument,
+    errptr: &mut *const KdlError,
+) -> bool {
+    *docptr = ptr::null();
+    *errptr = ptr::null();
+    match node.children.as_ref().map(Children::get) {
+        None => true,
+        Some(Ok(doc)) => {
+            *docptr = doc;
+            true
+        }
+        Some(Err(err)) => {
+            *errptr = err;
+            false
+        }
+    }
+}
+
+#[no_mangle]
+pub static KDL_LazyNode_sizeof: usize = mem::size_of::<KdlLazyNode>();
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::document::KDL_Document_parse;
+    use std::thread;
+
+    /// Names, values and spans of every node in `doc`, in document order.
+    fn lazy_summary(doc: &KdlLazyDocument, out: &mut Vec<String>) {
+        for node in &doc.nodes {
+            summarize(&node.node, out);
+            let (mut children, mut err) = (ptr::null(), ptr::null());
+            assert!(KDL_LazyNode_children(node, &mut children, &mut err));
+            if let Some(children) = unsafe { children.as_ref() } {
+                lazy_summary(children, out);
+            }
+        }
+    }
+
+    fn summary(doc: &KdlDocument, out: &mut Vec<String>) {
+        for node in doc.nodes() {
+            summarize(node, out);
+            if let Some(children) = node.children() {
+                summary(children, out);
+            }
+        }
+    }
+
+    fn summarize(node: &KdlNode, out: &mut Vec<String>) {
+        let name = node.name();
+        out.push(format!(
+            "{} {:?} {:?}",
+            name.value(),
+            node.span(),
+            name.span()
+        ));
+        out.extend(
+            node.ty()
+                .map(|ty| format!("({}) {:?}", ty.value(), ty.span())),
+        );
+        for entry in node.entries() {
+            let name = entry.name().map(|name| (name.value(), *name.span()));
+            out.push(format!("{:?} {:?} {:?}", name, entry.value(), entry.span()));
+        }
+    }
+
+    fn parse_serial(s: &str) -> Result<KdlDocument, KdlError> {
+        let (mut doc, mut err) = (ptr::null_mut(), ptr::null_mut());
+        unsafe {
+            if KDL_Document_parse(s.as_ptr(), s.len(), &mut doc, &mut err) {
+                Ok(*Box::from_raw(doc))
+            } else {
+                Err(*Box::from_raw(err))
+            }
+        }
+    }
+
+    const SOURCES: &[&str] = &[
+        "a 1\nb k=2 {\n    c \"}\"; d {\n        e\n    }\n}\nf\n",
+        "// leading\n/-a {\n    x\n}\n  b 1 { c; }  // tail\n/* gap */\n(t)d {\n}\ne\n",
+        "a {\n    /-b { c; }\n    /- d\n    e { f { g; }; }\n}; h\n",
+        "a \\\n  1 {\n    b\n}\nc r#\"{\"#\n",
+        "a 1 /-{\n    b\n}\nc {\n    d /- {\n        e\n    }\n}\n",
+    ];
+
+    #[test]
+    fn split_and_full_parses_match_a_serial_parse() {
+        for s in SOURCES {
+            let mut expected = Vec::new();
+            summary(&parse_serial(s).unwrap(), &mut expected);
+            let source = Arc::new(s.to_string());
+            for doc in [
+                KdlLazyDocument::split(&source, 0..s.len()).unwrap(),
+                parse_full(&source, 0..s.len()).unwrap(),
+            ] {
+                let mut actual = Vec::new();
+                lazy_summary(&doc, &mut actual);
+                assert_eq!(actual, expected, "{s:?}");
+            }
+        }
+    }
+
+    #[test]
+    fn deferred_errors_are_located_in_the_source() {
+        let s = "a 1\nb {\n    c {\n        d k=\n    }\n}\n";
+        let source = Arc::new(s.to_owned());
+        let doc = parse(&source, 0..s.len()).unwrap();
+        let (mut children, mut err) = (ptr::null(), ptr::null());
+        assert!(KDL_LazyNode_children(
+            &doc.nodes[1],
+            &mut children,
+            &mut err
+        ));
+        let c = unsafe { &children.as_ref().unwrap().nodes[0] };
+        assert!(!KDL_LazyNode_children(c, &mut children, &mut err));
+        let err = unsafe { &*err };
+        assert_eq!(err.span, parse_serial(s).unwrap_err().span);
+        assert!(Arc::ptr_eq(&err.input, &source));
+    }
+
+    #[test]
+    fn children_are_parsed_once_across_threads() {
+        let s = "a {\n    b 1\n    c { d; }\n}\n";
+        let source = Arc::new(s.to_owned());
+        let doc = parse(&source, 0..s.len()).unwrap();
+        let node = &doc.nodes[0];
+        let children: Vec<usize> = thread::scope(|scope| {
+            let threads: Vec<_> = (0..8)
+                .map(|_| {
+                    scope.spawn(|| {
+                        let (mut children, mut err) = (ptr::null(), ptr::null());
+                        assert!(KDL_LazyNode_children(node, &mut children, &mut err));
+                        children as usize
+                    })
+                })
+                .collect();
+            threads.into_iter().map(|t| t.join().unwrap()).collect()
+        });
+        assert!(children.iter().all(|&c| c != 0 && c == children[0]));
+        let mut actual = Vec::new();
+        lazy_summary(&doc, &mut actual);
+        let mut expected = Vec::new();
+        summary(&parse_serial(s).unwrap(), &mut expected);
+        assert_eq!(actual, expected);
+    }
+}
@@ -4,9 +4,27 @@
     nonstandard_style
 )]
 
+pub mod arena;
+pub mod batch;
+pub mod borrowed;
+pub mod diagnostics;
+pub mod diff;
 pub mod document;
 pub mod entry;
 pub mod error;
+pub mod events;
+pub mod file;
+pub mod flat;
 pub mod identifier;
+pub mod index;
+pub mod lazy;
 pub mod node;
+pub mod parallel;
+pub mod query;
+pub mod reparse;
+pub mod scan;
+pub mod stats;
+pub mod symbol;
+pub mod validate;
 pub mod value;
+pub mod writer;
@@ -33,6 +33,77 @@ pub extern "C" fn KDL_Node_get_arg(node: &KdlNode, ix: usize) -> Option<&KdlEntr
     node.get(ix)
 }
 
+/// The outcome of copying a node's arguments into a caller's buffer.
+#[repr(C)]
+pub enum KdlArgsStatus {
+    Ok = 0,
+    /// There were more arguments than room for them.
+    Truncated,
+    /// An argument was not of the requested type.
+    Mistyped,
+}
+
+/// Converts every argument of `node` into `out`, as far as `capacity` allows.
+/// `count` receives the number of arguments, or the index of the first one
+/// that does not convert.
+unsafe fn args<T>(
+    node: &KdlNode,
+    out: *mut T,
+    capacity: usize,
+    count: &mut usize,
+    convert: impl Fn(&KdlValue) -> Option<T>,
+) -> KdlArgsStatus {
+    let mut n = 0;
+    for entry in node.entries().iter().filter(|entry| entry.name().is_none()) {
+        let Some(value) = convert(entry.value()) else {
+            *count = n;
+            return KdlArgsStatus::Mistyped;
+        };
+        if n < capacity {
+            out.add(n).write(value);
+        }
+        n += 1;
+    }
+    *count = n;
+    if n > capacity {
+        KdlArgsStatus::Truncated
+    } else {
+        KdlArgsStatus::Ok
+    }
+}
+
+/// Integers convert to `f64` too, as they do when binding a float field.
+#[no_mangle]
+pub unsafe extern "C" fn KDL_Node_args_f64(
+    node: &KdlNode,
+    out: *mut f64,
+    capacity: usize,
+    count: &mut usize,
+) -> KdlArgsStatus {
+    args(node, out, capacity, count, |value| match *value {
+        KdlValue::Base10Float(f) => Some(f),
+        KdlValue::Base2(i) | KdlValue::Base8(i) | KdlValue::Base10(i) | KdlValue::Base16(i) => {
+            Some(i as f64)
+        }
+        _ => None,
+    })
+}
+
+#[no_mangle]
+pub unsafe extern "C" fn KDL_Node_args_i64(
+    node: &KdlNode,
+    out: *mut i64,
+    capacity: usize,
+    count: &mut usize,
+) -> KdlArgsStatus {
+    args(node, out, capacity, count, |value| match *value {
+        KdlValue::Base2(i) | KdlValue::Base8(i) | KdlValue::Base10(i) | KdlValue::Base16(i) => {
+            Some(i)
+        }
+        _ => None,
+    })
+}
+
 #[no_mangle]
 pub extern "C" fn KDL_Node_children(node: &KdlNode) -> Option<&KdlDocument> {
     node.children()
@@ -0,0 +1,287 @@
+use crate::batch::{for_each_index, thread_count};
+use crate::reparse::shift_node;
+use crate::stats;
+use kdl::*;
+use std::sync::OnceLock;
+use std::{mem, ptr, slice, str};
+
+/// Chunks smaller than this are not worth a thread.
+const MIN_CHUNK: usize = 1 << 20;
+/// Chunks per thread, so that uneven chunks still balance.
+const CHUNKS_PER_THREAD: usize = 4;
+
+pub(crate) fn skip_string(s: &[u8], mut i: usize) -> usize {
+    while i < s.len() {
+        match s[i] {
+            b'\\' => i += 2,
+            b'"' => return i + 1,
+            _ => i += 1,
+        }
+    }
+    s.len()
+}
+
+/// Skips `r#*"…"#*` if one starts at `i`; returns `None` otherwise.
+pub(crate) fn skip_raw_string(s: &[u8], i: usize) -> Option<usize> {
+    let hashes = s[i + 1..].iter().take_while(|&&b| b == b'#').count();
+    let mut i = i + 1 + hashes;
+    if s.get(i) != Some(&b'"') {
+        return None;
+    }
+    i += 1;
+    while i < s.len() {
+        if s[i] == b'"'
+            && s[i + 1..]
+                .iter()
+                .take(hashes)
+                .take_while(|&&b| b == b'#')
+                .count()
+                == hashes
+        {
+            return Some(i + 1 + hashes);
+        }
+        i += 1;
+    }
+    Some(s.len())
+}
+
+pub(crate) fn skip_block_comment(s: &[u8], mut i: usize) -> usize {
+    let mut depth = 1;
+    while i < s.len() {
+        match (s[i], s.get(i + 1)) {
+            (b'/', Some(b'*')) => {
+                depth += 1;
+                i += 2;
+            }
+            (b'*', Some(b'/')) => {
+                depth -= 1;
+                i += 2;
+                if depth == 0 {
+                    return i;
+                }
+            }
+            _ => i += 1,
+        }
+    }
+    s.len()
+}
+
+/// Finds offsets just past top-level node terminators, at least `target`
+/// bytes apart, skipping strings, raw strings, comments and children blocks.
+///
+/// Only `\n` and `;` are considered: missing a split point is harmless, and a
+/// wrong one is caught when its chunk fails to parse.
+pub(crate) fn terminators(s: &[u8], target: usize) -> Vec<usize> {
+    let mut points = Vec::new();
+    let mut next = target;
+    let mut depth = 0usize;
+    let mut escline = false;
+    let mut i = 0;
+    while i < s.len() {
+        match s[i] {
+            b'"' => i = skip_string(s, i + 1),
+            b'r' => i = skip_raw_string(s, i).unwrap_or(i + 1),
+            b'/' if s.get(i + 1) == Some(&b'/') => {
+                // Leave the newline itself to terminate the node.
+                i = s[i..]
+                    .iter()
+                    .position(|&b| b == b'\n')
+                    .map_or(s.len(), |n| i + n);
+            }
+            b'/' if s.get(i + 1) == Some(&b'*') => i = skip_block_comment(s, i + 2),
+            b'\\' => {
+                escline = true;
+                i += 1;
+            }
+            b'{' => {
+                depth += 1;
+                i += 1;
+            }
+            b'}' => {
+                depth = depth.saturating_sub(1);
+                i += 1;
+            }
+            b @ (b'\n' | b';') => {
+                let terminates = depth == 0 && !escline;
+                if b == b'\n' {
+                    escline = false;
+                }
+                i += 1;
+                if terminates && i >= next {
+                    points.push(i);
+                    next = i + target;
+                }
+            }
+            _ => i += 1,
+        }
+    }
+    points
+}
+
+/// Like `terminators`, without the end of input.
+pub(crate) fn split_points(s: &[u8], target: usize) -> Vec<usize> {
+    let mut points = terminators(s, target);
+    if points.last() == Some(&s.len()) {
+        points.pop();
+    }
+    points
+}
+
+/// Appends the nodes of `chunks`, each with the offset it was parsed at, to
+/// `doc`, moving their spans from the chunk's text to the whole of `s`, and
+/// the whitespace and comments between chunks onto the node that follows
+/// them, as the serial parser does.
+fn stitch(
+    s: &str,
+    mut doc: KdlDocument,
+    chunks: impl Iterator<Item = (usize, KdlDocument)>,
+) -> KdlDocument {
+    let mut pending = doc.trailing().unwrap_or("").to_owned();
+    for (offset, mut chunk) in chunks {
+        pending.push_str(chunk.leading().unwrap_or(""));
+        let mut nodes = mem::take(chunk.nodes_mut());
+        for node in &mut nodes {
+            shift_node(node, offset as isize);
+        }
+        if let Some(first) = nodes.first_mut() {
+            if !pending.is_empty() {
+                // The node's span takes in its leading text, as it grows.
+                let span = first.span();
+                first.set_span((span.offset() - pending.len(), span.len() + pending.len()));
+                pending.push_str(first.leading().unwrap_or(""));
+                first.set_leading(mem::take(&mut pending));
+            }
+        }
+        pending.push_str(chunk.trailing().unwrap_or(""));
+        doc.nodes_mut().append(&mut nodes);
+    }
+    doc.set_trailing(pending);
+    doc.set_span((0, s.len()));
+    doc
+}
+
+/// Parses `s` in chunks split at top-level node boundaries, on up to
+/// `threads` threads. Any chunk failing reparses `s` serially, so errors are
+/// exactly those of the serial parser.
+pub(crate) fn parse(s: &str, threads: usize) -> Result<KdlDocument, KdlError> {
+    let threads = thread_count(threads);
+    let target = (s.len() / (threads * CHUNKS_PER_THREAD)).max(MIN_CHUNK);
+    parse_chunks(s, threads, target)
+}
+
+/// Like `parse`, in chunks of at least `target` bytes.
+fn parse_chunks(s: &str, threads: usize, target: usize) -> Result<KdlDocument, KdlError> {
+    let points = split_points(s.as_bytes(), target);
+    if threads == 1 || points.is_empty() {
+        return s.parse();
+    }
+
+    let bounds: Vec<usize> = [0].into_iter().chain(points).chain([s.len()]).collect();
+    let chunks: Vec<OnceLock<Result<KdlDocument, KdlError>>> =
+        bounds[1..].iter().map(|_| OnceLock::new()).collect();
+    for_each_index(chunks.len(), threads, |i| {
+        let _ = chunks[i].set(s[bounds[i]..bounds[i + 1]].parse());
+    });
+
+    let mut docs = Vec::with_capacity(chunks.len());
+    for chunk in chunks {
+        match chunk.into_inner() {
+            Some(Ok(doc)) => docs.push(doc),
+            _ => return s.parse(),
+        }
+    }
+    let mut docs = bounds.into_iter().zip(docs);
+    let (_, first) = docs.next().unwrap();
+    Ok(stitch(s, first, docs))
+}
+
+#[no_mangle]
+pub unsafe extern "C" fn KDL_Document_parse_parallel(
+    s: *const u8,
+    len: usize,
+    docptr: &mut *mut KdlDocument,
+    errptr: &mut *mut KdlError,
+    threads: usize,
+) -> bool {
+    let bytes = if len == 0 {
+        &[]
+    } else {
+        slice::from_raw_parts(s, len)
+    };
+    let s = str::from_utf8_unchecked(bytes);
+    match stats::record(len, Default::default(), |timing| {
+        timing.parse(|| parse(s, threads))
+    }) {
+        Ok(doc) => {
+            *docptr = Box::into_raw(doc);
+            *errptr = ptr::null_mut();
+            true
+        }
+        Err(err) => {
+            *docptr = ptr::null_mut();
+            *errptr = Box::into_raw(err);
+            false
+        }
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    /// Every span in `doc`, in document order.
+    fn spans(doc: &KdlDocument, out: &mut Vec<SourceSpan>) {
+        out.push(*doc.span());
+        for node in doc.nodes() {
+            out.push(*node.span());
+            out.push(*node.name().span());
+            out.extend(node.ty().map(|ty| *ty.span()));
+            for entry in node.entries() {
+                out.push(*entry.span());
+                out.extend(entry.name().map(|name| *name.span()));
+                out.extend(entry.ty().map(|ty| *ty.span()));
+            }
+            if let Some(children) = node.children() {
+                spans(children, out);
+            }
+        }
+    }
+
+    fn summary(doc: &KdlDocument) -> (String, Vec<SourceSpan>) {
+        let mut out = Vec::new();
+        spans(doc, &mut out);
+        (doc.to_string(), out)
+    }
+
+    const SOURCES: &[&str] = &[
+        // Strings, raw strings and comments holding terminators and braces.
+        "a \"x;\ny {\"\nb r#\"}\n\"# c=\"\\\"\"\n// c; }\nd /* { ; */ 1\n",
+        "/* a\n/* nested; */ }\n*/ a 1\n(t)b k=(u)2 {\n    c \"}\"; d\n}\n/-e {\n f\n}\ng\n",
+        "a \\\n  1\nb { c; d { e; }; }; f r\"\n\"\n  \n// trailing\n",
+        "a 1\nb 2\nc 3\n",
+        "\n\n  a;b;c\n",
+    ];
+
+    #[test]
+    fn chunks_match_a_serial_parse() {
+        for s in SOURCES {
+            let serial = s.parse::<KdlDocument>().unwrap();
+            for target in 1..8 {
+                let chunked = parse_chunks(s, 4, target).unwrap();
+                assert_eq!(summary(&chunked), summary(&serial), "{s:?} at {target}");
+            }
+        }
+    }
+
+    #[test]
+    fn errors_match_a_serial_parse() {
+        for s in ["a 1\nb 0x\nc 3\n", "a 1\nb {\n", "a 1\nb \"x\nc\n"] {
+            let serial = s.parse::<KdlDocument>().unwrap_err();
+            for target in 1..4 {
+                let chunked = parse_chunks(s, 4, target).unwrap_err();
+                assert_eq!(chunked.span, serial.span);
+                assert_eq!(chunked.label, serial.label);
+            }
+        }
+    }
+}
@@ -0,0 +1,267 @@
+use crate::events::{escaped_string, resolve, Cursor, Stop};
+use kdl::*;
+use std::{ptr, slice, str};
+
+#[repr(C)]
+pub struct KdlQueryMatch {
+    node: *const KdlNode,
+    entry: *const KdlEntry,
+    value: *const KdlValue,
+}
+
+struct Segment {
+    ty: Option<String>,
+    /// `None` matches any name (`*`).
+    name: Option<String>,
+}
+
+enum Terminal {
+    Arg(usize),
+    Prop(String),
+}
+
+/// A compiled path expression, e.g. `server/(tcp)listener/port[0]`.
+///
+/// ```text
+/// query    = segment *("/" segment) [terminal]
+/// segment  = ["(" name ")"] ("*" / name)
+/// terminal = "[" digits "]" / "@" name
+/// name     = bare / quoted
+/// ```
+///
+/// Quoted names take KDL string escapes. A syntax error is reported at the
+/// start of what failed to parse: the opening quote of an unclosed name, the
+/// backslash of a bad escape, or otherwise the unexpected byte.
+pub struct KdlQuery {
+    segments: Vec<Segment>,
+    terminal: Option<Terminal>,
+}
+
+struct Parser<'a> {
+    s: &'a str,
+    pos: usize,
+}
+
+impl<'a> Parser<'a> {
+    fn peek(&self) -> Option<u8> {
+        self.s.as_bytes().get(self.pos).copied()
+    }
+
+    fn eat(&mut self, b: u8) -> bool {
+        let hit = self.peek() == Some(b);
+        if hit {
+            self.pos += 1;
+        }
+        hit
+    }
+
+    fn expect(&mut self, b: u8) -> Result<(), usize> {
+        if self.eat(b) {
+            Ok(())
+        } else {
+            Err(self.pos)
+        }
+    }
+
+    fn name(&mut self) -> Result<String, usize> {
+        let start = self.pos;
+        if self.peek() == Some(b'"') {
+            let mut cur = Cursor::new(self.s, 0, true);
+            cur.pos = start;
+            let mut scratch = String::new();
+            return match escaped_string(&mut cur, &mut scratch) {
+                Ok(text) => {
+                    self.pos = cur.pos;
+                    Ok(resolve(self.s, &scratch, text).to_owned())
+                }
+                Err(Stop::Error(diag)) => Err(diag.offset),
+                Err(_) => Err(start),
+            };
+        }
+        let len = self.s[start..]
+            .find(['/', '[', ']', '@', '(', ')', '"'])
+            .unwrap_or(self.s.len() - start);
+        if len == 0 {
+            return Err(start);
+        }
+        self.pos += len;
+        Ok(self.s[start..self.pos].to_owned())
+    }
+
+    fn segment(&mut self) -> Result<Segment, usize> {
+        let ty = if self.eat(b'(') {
+            let ty = self.name()?;
+            self.expect(b')')?;
+            Some(ty)
+        } else {
+            None
+        };
+        let name = if self.eat(b'*') {
+            None
+        } else {
+            Some(self.name()?)
+        };
+        Ok(Segment { ty, name })
+    }
+
+    fn terminal(&mut self) -> Result<Option<Terminal>, usize> {
+        if self.eat(b'[') {
+            let start = self.pos;
+            while self.peek().map_or(false, |b| b.is_ascii_digit()) {
+                self.pos += 1;
+            }
+            let ix = self.s[start..self.pos].parse().map_err(|_| start)?;
+            self.expect(b']')?;
+            Ok(Some(Terminal::Arg(ix)))
+        } else if self.eat(b'@') {
+            Ok(Some(Terminal::Prop(self.name()?)))
+        } else {
+            Ok(None)
+        }
+    }
+
+    fn query(&mut self) -> Result<KdlQuery, usize> {
+        let mut segments = vec![self.segment()?];
+        while self.eat(b'/') {
+            segments.push(self.segment()?);
+        }
+        let terminal = self.terminal()?;
+        if self.pos != self.s.len() {
+            return Err(self.pos);
+        }
+        Ok(KdlQuery { segments, terminal })
+    }
+}
+
+impl Segment {
+    fn matches(&self, node: &KdlNode) -> bool {
+        self.name
+            .as_deref()
+            .map_or(true, |name| node.name().value() == name)
+            && self
+                .ty
+                .as_deref()
+                .map_or(true, |ty| node.ty().map(KdlIdentifier::value) == Some(ty))
+    }
+}
+
+impl KdlQuery {
+    fn run(&self, doc: &KdlDocument, depth: usize, out: &mut [KdlQueryMatch], count: &mut usize) {
+        let segment = &self.segments[depth];
+        for node in doc.nodes().iter().filter(|node| segment.matches(node)) {
+            if depth + 1 < self.segments.len() {
+                if let Some(children) = node.children() {
+                    self.run(children, depth + 1, out, count);
+                }
+                continue;
+            }
+            let entry = match &self.terminal {
+                None => None,
+                Some(Terminal::Arg(ix)) => match node.get(*ix) {
+                    None => continue,
+                    entry => entry,
+                },
+                Some(Terminal::Prop(name)) => match node.get(name.as_str()) {
+                    None => continue,
+                    entry => entry,
+                },
+            };
+            if let Some(slot) = out.get_mut(*count) {
+                *slot = KdlQueryMatch {
+                    node,
+                    entry: entry.map_or(ptr::null(), |it| it),
+                    value: entry.map_or(ptr::null(), |it| it.value()),
+                };
+            }
+            *count += 1;
+        }
+    }
+}
+
+#[no_mangle]
+pub unsafe extern "C" fn KDL_Query_compile(
+    s: *const u8,
+    len: usize,
+    queryptr: &mut *mut KdlQuery,
+    error_offset: &mut usize,
+) -> bool {
+    let s = str::from_utf8_unchecked(slice::from_raw_parts(s, len));
+    match (Parser { s, pos: 0 }).query() {
+        Ok(query) => {
+            *queryptr = Box::into_raw(Box::new(query));
+            *error_offset = 0;
+            true
+        }
+        Err(offset) => {
+            *queryptr = ptr::null_mut();
+            *error_offset = offset;
+            false
+        }
+    }
+}
+
+#[no_mangle]
+pub extern "C" fn KDL_Query_free(_query: Box<KdlQuery>) {}
+
+#[no_mangle]
+pub unsafe extern "C" fn KDL_Query_run(
+    query: &KdlQuery,
+    doc: &KdlDocument,
+    out: *mut KdlQueryMatch,
+    capacity: usize,
+) -> usize {
+    let out = if capacity == 0 {
+        &mut []
+    } else {
+        slice::from_raw_parts_mut(out, capacity)
+    };
+    let mut count = 0;
+    query.run(doc, 0, out, &mut count);
+    count
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn compile(s: &str) -> Result<KdlQuery, usize> {
+        Parser { s, pos: 0 }.query()
+    }
+
+    fn names(s: &str) -> Vec<Option<String>> {
+        let query = compile(s).unwrap_or_else(|at| panic!("{s:?} failed at {at}"));
+        query
+            .segments
+            .into_iter()
+            .map(|segment| segment.name)
+            .collect()
+    }
+
+    #[test]
+    fn quoted_names_decode_escapes() {
+        assert_eq!(names(r#""a\"b""#), [Some("a\"b".to_owned())]);
+        assert_eq!(
+            names(r#"x/"a\\b\n"/*"#),
+            [Some("x".to_owned()), Some("a\\b\n".to_owned()), None]
+        );
+        assert_eq!(names(r#""\u{e9}\/""#), [Some("\u{e9}/".to_owned())]);
+        assert_eq!(names(r#""plain""#), [Some("plain".to_owned())]);
+    }
+
+    #[test]
+    fn errors_are_at_the_start_of_what_failed() {
+        let error = |s| compile(s).err();
+        // Unclosed names, with or without a pending escape, at the opening quote.
+        assert_eq!(error(r#""ab"#), Some(0));
+        assert_eq!(error(r#"x/"ab\"#), Some(2));
+        assert_eq!(error(r#"x/"a\""#), Some(2));
+        // Bad escapes at their backslash.
+        assert_eq!(error(r#""a\qb""#), Some(2));
+        assert_eq!(error(r#""\u{110000}""#), Some(1));
+        // Anything else at the unexpected byte.
+        assert_eq!(error("a/"), Some(2));
+        assert_eq!(error("(t"), Some(2));
+        assert_eq!(error("a[x]"), Some(2));
+        assert_eq!(error("a]"), Some(1));
+    }
+}
@@ -0,0 +1,393 @@
+use crate::events::{is_newline, is_space};
+use crate::parallel::terminators;
+use crate::stats;
+use kdl::*;
+use std::{mem, ptr, slice, str};
+
+/// A byte range of the old source that an edit replaced.
+#[repr(C)]
+#[derive(Clone, Copy)]
+pub struct KdlEditRange {
+    offset: usize,
+    length: usize,
+}
+
+/// Whether a chunk between top-level terminators holds a node, rather than
+/// only whitespace, comments or a slashdashed node.
+pub(crate) fn has_node(chunk: &str) -> bool {
+    let mut rest = chunk;
+    loop {
+        if let Some(after) = rest.strip_prefix("//") {
+            rest = after.find('\n').map_or("", |n| &after[n..]);
+        } else if let Some(after) = rest.strip_prefix("/*") {
+            let mut depth = 1;
+            let mut i = 0;
+            let bytes = after.as_bytes();
+            while depth > 0 && i < bytes.len() {
+                match (bytes[i], bytes.get(i + 1)) {
+                    (b'/', Some(b'*')) => (depth, i) = (depth + 1, i + 2),
+                    (b'*', Some(b'/')) => (depth, i) = (depth - 1, i + 2),
+                    _ => i += 1,
+                }
+            }
+            rest = &after[i.min(bytes.len())..];
+        } else if rest.starts_with("/-") {
+            return false;
+        } else {
+            match rest.chars().next() {
+                None => return false,
+                Some(c) if is_space(c) || is_newline(c) => rest = &rest[c.len_utf8()..],
+                Some(_) => return true,
+            }
+        }
+    }
+}
+
+/// Moves `region`'s nodes into `doc` in place of `doc.nodes()[range]`, giving
+/// whitespace and comments outside any node to the node that follows, or to
+/// the document if none does, as a fresh parse would.
+fn splice(
+    doc: &mut KdlDocument,
+    range: std::ops::Range<usize>,
+    mut region: KdlDocument,
+    at_start: bool,
+    at_end: bool,
+) {
+    let mut pending = region.leading().unwrap_or("").to_owned();
+    if at_start {
+        doc.set_leading(mem::take(&mut pending));
+    }
+    let mut nodes = mem::take(region.nodes_mut()).into_iter();
+    let mut first = nodes.next();
+    if let Some(first) = &mut first {
+        if !pending.is_empty() {
+            pending.push_str(first.leading().unwrap_or(""));
+            first.set_leading(mem::take(&mut pending));
+        }
+    }
+    pending.push_str(region.trailing().unwrap_or(""));
+    if at_end {
+        doc.set_trailing(pending);
+    } else if !pending.is_empty() {
+        if let Some(next) = doc.nodes_mut().get_mut(range.end) {
+            pending.push_str(next.leading().unwrap_or(""));
+            next.set_leading(pending);
+        } else {
+            pending.push_str(doc.trailing().unwrap_or(""));
+            doc.set_trailing(pending);
+        }
+    }
+    doc.nodes_mut()
+        .splice(range, first.into_iter().chain(nodes));
+}
+
+/// Moves a span by `by` bytes.
+fn moved(span: &SourceSpan, by: isize) -> SourceSpan {
+    (span.offset().wrapping_add_signed(by), span.len()).into()
+}
+
+/// Grows a span by `by` bytes, for an edit within it.
+fn grown(span: &SourceSpan, by: isize) -> SourceSpan {
+    (span.offset(), span.len().wrapping_add_signed(by)).into()
+}
+
+fn shift_ident(identifier: &mut KdlIdentifier, by: isize) {
+    identifier.set_span(moved(identifier.span(), by));
+}
+
+fn shift_entry(entry: &mut KdlEntry, by: isize) {
+    if let Some(ty) = entry.ty_mut() {
+        shift_ident(ty, by);
+    }
+    if let Some(name) = entry.name() {
+        // A property's name can only be replaced along with the entry.
+        let mut name = name.clone();
+        shift_ident(&mut name, by);
+        let mut rebuilt = KdlEntry::new_prop(name, entry.value().clone());
+        *rebuilt.ty_mut() = entry.ty_mut().take();
+        if let Some(leading) = entry.leading() {
+            rebuilt.set_leading(leading);
+        }
+        if let Some(trailing) = entry.trailing() {
+            rebuilt.set_trailing(trailing);
+        }
+        if let Some(repr) = entry.value_repr() {
+            rebuilt.set_value_repr(repr);
+        }
+        rebuilt.set_span(*entry.span());
+        *entry = rebuilt;
+    }
+    entry.set_span(moved(entry.span(), by));
+}
+
+pub(crate) fn shift_node(node: &mut KdlNode, by: isize) {
+    node.set_span(moved(node.span(), by));
+    shift_ident(node.name_mut(), by);
+    if let Some(ty) = node.ty_mut() {
+        shift_ident(ty, by);
+    }
+    for entry in node.entries_mut() {
+        shift_entry(entry, by);
+    }
+    if let Some(children) = node.children_mut() {
+        shift_document(children, by);
+    }
+}
+
+pub(crate) fn shift_document(doc: &mut KdlDocument, by: isize) {
+    doc.set_span(moved(doc.span(), by));
+    for node in doc.nodes_mut() {
+        shift_node(node, by);
+    }
+}
+
+fn end(span: &SourceSpan) -> usize {
+    span.offset() + span.len()
+}
+
+/// The part of the source between a children block's braces, whether or
+/// not its span takes them in. A block's content never starts with `{`.
+fn inside(children: &KdlDocument, source: &str) -> std::ops::Range<usize> {
+    let span = children.span();
+    if source.as_bytes().get(span.offset()) == Some(&b'{') {
+        span.offset() + 1..end(span).saturating_sub(1)
+    } else {
+        span.offset()..end(span)
+    }
+}
+
+/// Where the unit of a node that starts at `from` ends: just past the
+/// terminator after it, or at `limit`, where the next unit starts. A unit
+/// is the node with any whitespace, comments and slashdashed nodes before
+/// it.
+fn unit_end(source: &str, from: usize, limit: usize) -> usize {
+    let text = &source[from..limit];
+    let mut chunk_start = 0;
+    for bound in terminators(text.as_bytes(), 1) {
+        if has_node(&text[chunk_start..bound]) {
+            return from + bound;
+        }
+        chunk_start = bound;
+    }
+    limit
+}
+
+/// Updates `doc`, parsed from `old`, to match `new`, which differs from `old`
+/// only in `edit`, as the caller vouches. The innermost children block that
+/// holds the edit is found by the nodes' spans, and only its nodes touching
+/// the edit are reparsed; spans after the edit move by the change in length.
+/// Anything unexpected falls back to parsing `new` in full.
+pub(crate) fn reparse(
+    doc: &mut KdlDocument,
+    old: &str,
+    new: &str,
+    edit: KdlEditRange,
+) -> Result<(), KdlError> {
+    let full = |doc: &mut KdlDocument| new.parse().map(|fresh| *doc = fresh);
+
+    let start = edit.offset;
+    let old_end = start.saturating_add(edit.length);
+    let delta = new.len() as isize - old.len() as isize;
+    if old_end > old.len() || (old_end as isize + delta) < start as isize {
+        return full(doc);
+    }
+
+    // The nodes, by index at each level, whose children blocks hold the edit.
+    let mut path = Vec::new();
+    let mut range = 0..old.len();
+    let mut container: &KdlDocument = doc;
+    loop {
+        let nodes = container.nodes();
+        let i = nodes.partition_point(|node| end(node.span()) <= start);
+        let Some(children) = nodes.get(i).and_then(KdlNode::children) else {
+            break;
+        };
+        let inner = inside(children, old);
+        if nodes[i].span().offset() > start || !(inner.start <= start && old_end <= inner.end) {
+            break;
+        }
+        path.push(i);
+        range = inner;
+        container = children;
+    }
+
+    let mut container: &mut KdlDocument = doc;
+    for &i in &path {
+        container = container.nodes_mut()[i].children_mut().as_mut().unwrap();
+    }
+    let nodes = container.nodes();
+    let len = nodes.len();
+    let unit_start = |i: usize| match i {
+        0 => range.start,
+        _ => unit_end(old, nodes[i - 1].span().offset(), nodes[i].span().offset()),
+    };
+
+    // Every unit the edit touches, even only at its boundary, with one to
+    // spare on either side, as spans need not cover whitespace around nodes.
+    let first = nodes
+        .partition_point(|node| end(node.span()) < start)
+        .saturating_sub(1);
+    let after = nodes.partition_point(|node| node.span().offset() <= old_end);
+    let (lo, through) = (unit_start(first.min(len)), (after + 1).min(len));
+    let hi = match nodes.get(through) {
+        Some(next) => unit_end(
+            old,
+            nodes[through - 1].span().offset(),
+            next.span().offset(),
+        ),
+        None => range.end,
+    };
+    if lo > start || hi < old_end {
+        return full(doc);
+    }
+    let at_start = lo == range.start;
+    let at_end = through == len;
+    let region = &new[lo..hi.wrapping_add_signed(delta)];
+
+    let mut parsed = match region.parse::<KdlDocument>() {
+        // The region must end where the unchanged text after it starts a new node.
+        Ok(parsed) if at_end || terminators(region.as_bytes(), 1).last() == Some(&region.len()) => {
+            parsed
+        }
+        _ => return full(doc),
+    };
+    for node in parsed.nodes_mut() {
+        shift_node(node, lo as isize);
+    }
+    for node in &mut container.nodes_mut()[through..] {
+        shift_node(node, delta);
+    }
+    splice(container, first..through, parsed, at_start, at_end);
+
+    // Everything around the edit grows with it, and what follows it moves.
+    let mut container: &mut KdlDocument = doc;
+    for &i in &path {
+        container.set_span(grown(container.span(), delta));
+        for node in &mut container.nodes_mut()[i + 1..] {
+            shift_node(node, delta);
+        }
+        let node = &mut container.nodes_mut()[i];
+        node.set_span(grown(node.span(), delta));
+        container = node.children_mut().as_mut().unwrap();
+    }
+    container.set_span(grown(container.span(), delta));
+    Ok(())
+}
+
+#[no_mangle]
+pub unsafe extern "C" fn KDL_Document_reparse(
+    doc: &mut KdlDocument,
+    old: *const u8,
+    old_len: usize,
+    new: *const u8,
+    new_len: usize,
+    edit: KdlEditRange,
+    errptr: &mut *mut KdlError,
+) -> bool {
+    let old = str::from_utf8_unchecked(slice::from_raw_parts(old, old_len));
+    let new = str::from_utf8_unchecked(slice::from_raw_parts(new, new_len));
+    stats::changed(doc);
+    match reparse(doc, old, new, edit) {
+        Ok(()) => {
+            *errptr = ptr::null_mut();
+            true
+        }
+        Err(err) => {
+            *errptr = Box::into_raw(Box::new(err));
+            false
+        }
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    const DOCS: &[&str] = &[
+        "",
+        "a\n",
+        "a 1 \"two\" k=3\nb {\n    c\n    d x=1 {\n        e\n    }\n}\nf; g\n",
+        "// lead\na {\n    /- b\n    c 1 /* note */ 2\n}\n\n/- d\ne (t)\"x\" k=(u)r#\"y\"#\n// tail\n",
+        "a { b { c { d; }; }; }\ne",
+    ];
+
+    const INSERTS: &[&str] = &["", "x", " 9", "\n", ";", "q {\n}\n", "\"", "{", "}", "/*"];
+
+    fn fresh(text: &str) -> Option<KdlDocument> {
+        text.parse().ok()
+    }
+
+    /// Compares node by node, so that a mismatch is reported where it is.
+    fn assert_same(got: &KdlDocument, want: &KdlDocument, context: &str) {
+        assert_eq!(got.span(), want.span(), "{context}");
+        assert_eq!(got.nodes().len(), want.nodes().len(), "{context}");
+        for (got, want) in got.nodes().iter().zip(want.nodes()) {
+            assert_eq!(
+                got.span(),
+                want.span(),
+                "{context}: {}",
+                want.name().value()
+            );
+            assert_eq!(got.name().span(), want.name().span(), "{context}");
+            for (got, want) in got.entries().iter().zip(want.entries()) {
+                assert_eq!(got.span(), want.span(), "{context}");
+                assert_eq!(
+                    got.name().map(|n| *n.span()),
+                    want.name().map(|n| *n.span())
+                );
+                assert_eq!(got.ty().map(|n| *n.span()), want.ty().map(|n| *n.span()));
+            }
+            match (got.children(), want.children()) {
+                (Some(got), Some(want)) => assert_same(got, want, context),
+                (got, want) => assert_eq!(got.is_some(), want.is_some(), "{context}"),
+            }
+        }
+        assert_eq!(got, want, "{context}");
+        assert_eq!(got.to_string(), want.to_string(), "{context}");
+    }
+
+    #[test]
+    fn reparsing_matches_a_fresh_parse() {
+        for old in DOCS {
+            let parsed = fresh(old).unwrap();
+            for offset in 0..=old.len() {
+                for length in 0..=2.min(old.len() - offset) {
+                    for insert in INSERTS {
+                        if length == 0 && insert.is_empty() {
+                            continue;
+                        }
+                        let new = format!("{}{insert}{}", &old[..offset], &old[offset + length..]);
+                        let edit = KdlEditRange { offset, length };
+                        let context = format!("{old:?} -> {new:?}");
+                        let mut doc = parsed.clone();
+                        match (reparse(&mut doc, old, &new, edit), fresh(&new)) {
+                            (Ok(()), Some(want)) => assert_same(&doc, &want, &context),
+                            (Err(_), None) => assert_eq!(doc, parsed, "{context}"),
+                            (got, _) => panic!("{context}: {got:?}"),
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    #[test]
+    fn only_the_enclosing_block_is_reparsed() {
+        let old = "a {\n    b 1\n}\nc {\n    d 1\n    e 2\n}\nf\n";
+        let mut doc = fresh(old).unwrap();
+        let untouched: *const KdlNode = &doc.nodes()[0].children().unwrap().nodes()[0];
+        let sibling: *const KdlNode = &doc.nodes()[1].children().unwrap().nodes()[1];
+        let offset = old.find("d 1").unwrap() + 2;
+        let new = format!("{}100{}", &old[..offset], &old[offset + 1..]);
+        reparse(&mut doc, old, &new, KdlEditRange { offset, length: 1 }).unwrap();
+        assert_same(&doc, &fresh(&new).unwrap(), "d 1 -> d 100");
+        assert!(std::ptr::eq(
+            untouched,
+            &doc.nodes()[0].children().unwrap().nodes()[0]
+        ));
+        assert!(std::ptr::eq(
+            sibling,
+            &doc.nodes()[1].children().unwrap().nodes()[1]
+        ));
+    }
+}
@@ -0,0 +1,126 @@
+//! Vectorized searches for the bytes that end a run of string, comment or
+//! whitespace text, using AVX2 or SSE2 where available.
+
+/// Returns the index of the first byte of `hay` that is one of `needles`.
+pub(crate) fn find(hay: &[u8], needles: &[u8]) -> Option<usize> {
+    #[cfg(target_arch = "x86_64")]
+    {
+        if hay.len() >= 32 && is_x86_feature_detected!("avx2") {
+            return unsafe { x86::find_avx2(hay, needles) };
+        }
+        if hay.len() >= 16 {
+            return unsafe { x86::find_sse2(hay, needles) };
+        }
+    }
+    scalar(hay, needles)
+}
+
+fn scalar(hay: &[u8], needles: &[u8]) -> Option<usize> {
+    hay.iter().position(|b| needles.contains(b))
+}
+
+#[cfg(target_arch = "x86_64")]
+mod x86 {
+    use super::scalar;
+    use std::arch::x86_64::*;
+
+    /// Compares `$width` bytes at a time against every needle, finishing the
+    /// last partial block with the scalar search.
+    macro_rules! find_with {
+        ($hay:ident, $needles:ident, $width:expr, $load:ident, $set1:ident, $cmpeq:ident, $or:ident, $zero:ident, $movemask:ident) => {{
+            let mut i = 0;
+            while i + $width <= $hay.len() {
+                let block = $load($hay.as_ptr().add(i) as *const _);
+                let mut hits = $zero();
+                for &needle in $needles {
+                    hits = $or(hits, $cmpeq(block, $set1(needle as i8)));
+                }
+                let mask = $movemask(hits) as u32;
+                if mask != 0 {
+                    return Some(i + mask.trailing_zeros() as usize);
+                }
+                i += $width;
+            }
+            scalar(&$hay[i..], $needles).map(|n| i + n)
+        }};
+    }
+
+    #[target_feature(enable = "avx2")]
+    pub(super) unsafe fn find_avx2(hay: &[u8], needles: &[u8]) -> Option<usize> {
+        find_with!(
+            hay,
+            needles,
+            32,
+            _mm256_loadu_si256,
+            _mm256_set1_epi8,
+            _mm256_cmpeq_epi8,
+            _mm256_or_si256,
+            _mm256_setzero_si256,
+            _mm256_movemask_epi8
+        )
+    }
+
+    /// SSE2 is part of the x86-64 baseline, so needs no detection.
+    pub(super) unsafe fn find_sse2(hay: &[u8], needles: &[u8]) -> Option<usize> {
+        find_with!(
+            hay,
+            needles,
+            16,
+            _mm_loadu_si128,
+            _mm_set1_epi8,
+            _mm_cmpeq_epi8,
+            _mm_or_si128,
+            _mm_setzero_si128,
+            _mm_movemask_epi8
+        )
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    /// Every placement of a needle, at every alignment and length, for each
+    /// search that this machine can run.
+    #[test]
+    fn vector_searches_match_the_scalar_search() {
+        let mut searches: Vec<(&str, fn(&[u8], &[u8]) -> Option<usize>)> = vec![("find", find)];
+        #[cfg(target_arch = "x86_64")]
+        {
+            searches.push(("sse2", |hay, needles| unsafe {
+                x86::find_sse2(hay, needles)
+            }));
+            if is_x86_feature_detected!("avx2") {
+                searches.push(("avx2", |hay, needles| unsafe {
+                    x86::find_avx2(hay, needles)
+                }));
+            }
+        }
+        let needles = b"\"\\\n";
+        // Room for every alignment of the longest haystack.
+        let mut buf = [b'a'; 32 + 100];
+        for offset in 0..32 {
+            for len in 0..100usize {
+                // No needle, then one at each position, with decoys after it.
+                for at in (0..=len).map(|at| at.checked_sub(1)) {
+                    buf.fill(b'a');
+                    if let Some(at) = at {
+                        buf[offset + at] = needles[at % needles.len()];
+                        for decoy in (at + 1..len).step_by(7) {
+                            buf[offset + decoy] = b'\n';
+                        }
+                    }
+                    // Needles and high bytes just outside must not be seen.
+                    buf[offset + len..].fill(b'"');
+                    buf[..offset].fill(0xFF);
+                    let hay = &buf[offset..offset + len];
+                    let expected = scalar(hay, needles);
+                    assert_eq!(expected, at);
+                    for (name, search) in &searches {
+                        assert_eq!(search(hay, needles), expected, "{name} at {offset}+{len}");
+                    }
+                }
+            }
+        }
+    }
+}
@@ -0,0 +1,521 @@
+use crate::arena;
+use crate::diff::Subtrees;
+use crate::events::KdlDiagnostic;
+use kdl::*;
+use std::cell::Cell;
+use std::collections::BTreeMap;
+use std::ffi::c_void;
+use std::mem;
+use std::sync::atomic::{AtomicBool, AtomicUsize, Ordering};
+use std::sync::{Arc, Mutex, MutexGuard, PoisonError, RwLock};
+use std::time::Instant;
+
+/// Heap activity on one thread, counted by the global allocator.
+#[derive(Clone, Copy, Default)]
+pub(crate) struct Heap {
+    allocations: usize,
+    allocated: usize,
+    freed: usize,
+}
+
+thread_local! {
+    static HEAP: Cell<Heap> = const {
+        Cell::new(Heap {
+            allocations: 0,
+            allocated: 0,
+            freed: 0,
+        })
+    };
+}
+
+/// Parses being recorded on any thread; while zero, allocations go
+/// uncounted.
+static COUNTING: AtomicUsize = AtomicUsize::new(0);
+
+pub(crate) fn heap() -> Heap {
+    HEAP.try_with(Cell::get).unwrap_or_default()
+}
+
+/// Adds `lent`, counted on a worker thread that has finished, to this
+/// thread's counts, so that work handed to workers counts as this thread's.
+pub(crate) fn credit(lent: Heap) {
+    let _ = HEAP.try_with(|heap| {
+        let mut h = heap.get();
+        h.allocations += lent.allocations;
+        h.allocated += lent.allocated;
+        h.freed += lent.freed;
+        heap.set(h);
+    });
+}
+
+pub(crate) fn on_alloc(size: usize) {
+    if COUNTING.load(Ordering::Relaxed) == 0 {
+        return;
+    }
+    let _ = HEAP.try_with(|heap| {
+        let mut h = heap.get();
+        h.allocations += 1;
+        h.allocated += size;
+        heap.set(h);
+    });
+}
+
+pub(crate) fn on_dealloc(size: usize) {
+    if COUNTING.load(Ordering::Relaxed) == 0 {
+        return;
+    }
+    let _ = HEAP.try_with(|heap| {
+        let mut h = heap.get();
+        h.freed += size;
+        heap.set(h);
+    });
+}
+
+/// Time spent in each phase of a parse, in nanoseconds.
+#[repr(C)]
+#[derive(Clone, Copy, Default)]
+pub struct KdlParseTiming {
+    /// Opening and mapping the input, for a file.
+    read_ns: u64,
+    /// Checking the input is UTF-8, where the caller does not vouch for it.
+    validate_ns: u64,
+    /// Building the document.
+    parse_ns: u64,
+    total_ns: u64,
+}
+
+impl KdlParseTiming {
+    pub(crate) fn read<R>(&mut self, f: impl FnOnce() -> R) -> R {
+        time(&mut self.read_ns, f)
+    }
+
+    pub(crate) fn validate<R>(&mut self, f: impl FnOnce() -> R) -> R {
+        time(&mut self.validate_ns, f)
+    }
+
+    pub(crate) fn parse<R>(&mut self, f: impl FnOnce() -> R) -> R {
+        time(&mut self.parse_ns, f)
+    }
+}
+
+fn time<R>(slot: &mut u64, f: impl FnOnce() -> R) -> R {
+    let start = Instant::now();
+    let result = f();
+    *slot += start.elapsed().as_nanos() as u64;
+    result
+}
+
+/// What was measured while parsing a document, and what has since been
+/// derived from it, kept until it is freed.
+#[derive(Default)]
+struct Recorded {
+    timing: KdlParseTiming,
+    retained: usize,
+    /// Hashes for diffing, computed on first use and dropped on change.
+    subtrees: Option<Arc<Subtrees>>,
+}
+
+const SHARDS: usize = 16;
+
+/// What was recorded, by document address, split so that threads parsing
+/// and freeing different documents seldom wait on one another. Ordered, so
+/// that an arena's documents can be dropped by address range.
+static RECORDED: [Mutex<BTreeMap<usize, Recorded>>; SHARDS] =
+    [const { Mutex::new(BTreeMap::new()) }; SHARDS];
+
+/// The node lists of documents whose subtrees are cached, by the address
+/// of their first node, each with the address just past its last node and
+/// the recorded document it belongs to.
+static OWNERS: Mutex<BTreeMap<usize, (usize, usize)>> = Mutex::new(BTreeMap::new());
+
+fn owners() -> MutexGuard<'static, BTreeMap<usize, (usize, usize)>> {
+    OWNERS.lock().unwrap_or_else(PoisonError::into_inner)
+}
+
+/// Calls `f` with the address range of every non-empty node list in `doc`.
+fn node_lists(doc: &KdlDocument, f: &mut impl FnMut(usize, usize)) {
+    let nodes = doc.nodes().as_ptr_range();
+    if !nodes.is_empty() {
+        f(nodes.start as usize, nodes.end as usize);
+    }
+    for node in doc.nodes() {
+        if let Some(children) = node.children() {
+            node_lists(children, f);
+        }
+    }
+}
+
+/// Stops looking up nodes in `subtrees`, cached for `doc`, which is about
+/// to change or go away.
+fn disown(doc: &KdlDocument, subtrees: Option<Arc<Subtrees>>) {
+    if subtrees.is_some() {
+        let mut owners = owners();
+        node_lists(doc, &mut |start, _| {
+            owners.remove(&start);
+        });
+    }
+}
+
+fn shard(key: usize) -> MutexGuard<'static, BTreeMap<usize, Recorded>> {
+    // Documents are at least this far apart, so neighbours spread out.
+    let index = (key / mem::size_of::<KdlDocument>()) % SHARDS;
+    RECORDED[index]
+        .lock()
+        .unwrap_or_else(PoisonError::into_inner)
+}
+
+#[repr(C)]
+#[derive(Clone, Copy, PartialEq, Eq)]
+pub enum KdlTraceKind {
+    ParseBegin,
+    ParseEnd,
+    Error,
+}
+
+#[repr(C)]
+pub struct KdlTraceEvent {
+    kind: KdlTraceKind,
+    /// Bytes of input.
+    length: usize,
+    /// For the end of a parse, and errors, the time since it began.
+    duration_ns: u64,
+    /// Allocations made since the parse began.
+    allocations: usize,
+    allocated_bytes: usize,
+    /// Bytes allocated and not freed since the parse began.
+    retained_bytes: usize,
+    /// For an error, where it is; otherwise null.
+    error: *const KdlDiagnostic,
+}
+
+type TraceCallback = unsafe extern "C" fn(user: *mut c_void, event: &KdlTraceEvent);
+
+/// Lets parsing skip tracing with one relaxed load while no callback is set.
+static TRACING: AtomicBool = AtomicBool::new(false);
+static TRACE: RwLock<Option<(TraceCallback, usize)>> = RwLock::new(None);
+
+fn trace(event: &KdlTraceEvent) {
+    if !TRACING.load(Ordering::Relaxed) {
+        return;
+    }
+    // Called outside the lock, so the callback may replace itself, and
+    // outside any arena, so what it allocates is its own.
+    let callback = *TRACE.read().unwrap_or_else(PoisonError::into_inner);
+    if let Some((callback, user)) = callback {
+        arena::outside(|| unsafe { callback(user as *mut c_void, event) });
+    }
+}
+
+/// Parses with `parse`, measuring time by phase and heap retained, which
+/// are kept for `KDL_Document_stats`, and reporting to any trace callback.
+/// `timing` holds phases already spent before the input was at hand. Heap
+/// is counted on this thread, and on the workers of `for_each_index`, which
+/// credit theirs to it; `parse` must not hand work to other threads.
+/// `parse` may box its result itself, as in an arena's scope; the
+/// bookkeeping here is always done outside any arena.
+pub(crate) fn record<D, E>(
+    length: usize,
+    mut timing: KdlParseTiming,
+    parse: impl FnOnce(&mut KdlParseTiming) -> Result<D, E>,
+) -> Result<Box<KdlDocument>, Box<KdlError>>
+where
+    D: Into<Box<KdlDocument>>,
+    E: Into<Box<KdlError>>,
+{
+    let mut event = KdlTraceEvent {
+        kind: KdlTraceKind::ParseBegin,
+        length,
+        duration_ns: 0,
+        allocations: 0,
+        allocated_bytes: 0,
+        retained_bytes: 0,
+        error: std::ptr::null(),
+    };
+    trace(&event);
+
+    // A thread sees its own count, so its allocations are all counted.
+    COUNTING.fetch_add(1, Ordering::Relaxed);
+    let before = heap();
+    let start = Instant::now();
+    let result = parse(&mut timing).map(Into::into).map_err(Into::into);
+    timing.total_ns = timing.read_ns + start.elapsed().as_nanos() as u64;
+    let after = heap();
+    COUNTING.fetch_sub(1, Ordering::Relaxed);
+
+    event.duration_ns = timing.total_ns - timing.read_ns;
+    event.allocations = after.allocations - before.allocations;
+    event.allocated_bytes = after.allocated - before.allocated;
+    event.retained_bytes = event
+        .allocated_bytes
+        .saturating_sub(after.freed - before.freed);
+    match &result {
+        Ok(doc) => {
+            let key = &**doc as *const KdlDocument as usize;
+            let entry = Recorded {
+                timing,
+                retained: event.retained_bytes,
+                subtrees: None,
+            };
+            arena::outside(|| shard(key).insert(key, entry));
+        }
+        Err(err) => {
+            let diag = KdlDiagnostic::from_error(err);
+            event.kind = KdlTraceKind::Error;
+            event.error = &diag;
+            trace(&event);
+            event.error = std::ptr::null();
+        }
+    }
+    event.kind = KdlTraceKind::ParseEnd;
+    trace(&event);
+    result
+}
+
+/// Drops what was recorded about a document that is being freed.
+pub(crate) fn forget(doc: *const KdlDocument) {
+    let key = doc as usize;
+    let recorded = shard(key).remove(&key);
+    if let Some(recorded) = recorded {
+        disown(unsafe { &*doc }, recorded.subtrees);
+    }
+}
+
+/// The subtree hashes of `doc`. For a document whose parse was recorded they
+/// are computed once, and go away with it; any other, such as a children
+/// block, is hashed afresh each time.
+pub(crate) fn subtrees(doc: &KdlDocument) -> Arc<Subtrees> {
+    let key = doc as *const KdlDocument as usize;
+    let cached = shard(key)
+        .get(&key)
+        .map(|recorded| recorded.subtrees.clone());
+    match cached {
+        Some(Some(subtrees)) => subtrees,
+        Some(None) => {
+            // Hashed without the lock; a racing thread only repeats the work.
+            let subtrees = arena::outside(|| Arc::new(Subtrees::indexed(doc)));
+            if let Some(recorded) = shard(key).get_mut(&key) {
+                recorded.subtrees = Some(subtrees.clone());
+            }
+            arena::outside(|| {
+                let mut owners = owners();
+                node_lists(doc, &mut |start, end| {
+                    owners.insert(start, (end, key));
+                });
+            });
+            subtrees
+        }
+        None => Arc::new(Subtrees::new(doc)),
+    }
+}
+
+/// The hash of `node`, if it is in a recorded document whose subtrees are
+/// cached.
+pub(crate) fn node_hash(node: &KdlNode) -> Option<u64> {
+    let address = node as *const KdlNode as usize;
+    let key = {
+        let owners = owners();
+        let (_, &(end, key)) = owners.range(..=address).next_back()?;
+        (address < end).then_some(key)?
+    };
+    let subtrees = shard(key).get(&key)?.subtrees.clone()?;
+    subtrees.node_hash(node)
+}
+
+/// Drops what was derived from a document whose content has changed. Call
+/// before changing it, while its nodes are where they were hashed.
+pub(crate) fn changed(doc: *const KdlDocument) {
+    let key = doc as usize;
+    let subtrees = shard(key)
+        .get_mut(&key)
+        .and_then(|recorded| recorded.subtrees.take());
+    disown(unsafe { &*doc }, subtrees);
+}
+
+/// Drops what was recorded about documents in `start..end`, memory that is
+/// being released without each of them being freed, as with an arena.
+pub(crate) fn forget_range(start: usize, end: usize) {
+    let mut dropped = Vec::new();
+    for shard in &RECORDED {
+        let mut shard = shard.lock().unwrap_or_else(PoisonError::into_inner);
+        while let Some((&key, _)) = shard.range(start..end).next() {
+            dropped.extend(shard.remove(&key).and_then(|recorded| recorded.subtrees));
+        }
+    }
+    if !dropped.is_empty() {
+        // The documents' memory may already be reused, so their node lists
+        // are found by owner instead.
+        owners().retain(|_, &mut (_, key)| !(start..end).contains(&key));
+    }
+}
+
+#[repr(C)]
+#[derive(Default)]
+pub struct KdlDocumentStats {
+    nodes: usize,
+    entries: usize,
+    /// Node names, and type annotations and property names wherever present.
+    identifiers: usize,
+    /// Nesting depth; top-level nodes are at depth 1.
+    max_depth: usize,
+    /// Bytes of identifiers and string values.
+    string_bytes: usize,
+    /// Heap bytes the document held when parsed, or 0 if not recorded.
+    heap_bytes: usize,
+    /// Time the parse took, or zeros if not recorded.
+    timing: KdlParseTiming,
+}
+
+impl KdlDocumentStats {
+    fn ident(&mut self, ident: Option<&KdlIdentifier>) {
+        if let Some(ident) = ident {
+            self.identifiers += 1;
+            self.string_bytes += ident.value().len();
+        }
+    }
+
+    fn walk(&mut self, doc: &KdlDocument, depth: usize) {
+        for node in doc.nodes() {
+            self.nodes += 1;
+            self.max_depth = self.max_depth.max(depth);
+            self.ident(Some(node.name()));
+            self.ident(node.ty());
+            for entry in node.entries() {
+                self.entries += 1;
+                self.ident(entry.name());
+                self.ident(entry.ty());
+                if let KdlValue::String(s) | KdlValue::RawString(s) = entry.value() {
+                    self.string_bytes += s.len();
+                }
+            }
+            if let Some(children) = node.children() {
+                self.walk(children, depth + 1);
+            }
+        }
+    }
+}
+
+#[no_mangle]
+pub extern "C" fn KDL_Document_stats(doc: &KdlDocument) -> KdlDocumentStats {
+    let mut stats = KdlDocumentStats::default();
+    stats.walk(doc, 1);
+    let key = doc as *const KdlDocument as usize;
+    if let Some(recorded) = shard(key).get(&key) {
+        stats.heap_bytes = recorded.retained;
+        stats.timing = recorded.timing;
+    }
+    stats
+}
+
+#[no_mangle]
+pub extern "C" fn KDL_set_trace_callback(callback: Option<TraceCallback>, user: *mut c_void) {
+    let mut trace = TRACE.write().unwrap_or_else(PoisonError::into_inner);
+    *trace = callback.map(|callback| (callback, user as usize));
+    TRACING.store(trace.is_some(), Ordering::Relaxed);
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::arena::{KDL_Arena_new, KDL_Document_parse_in, KdlArena};
+    use crate::batch::{for_each_index, KDL_Document_parse_many};
+    use crate::diagnostics::KDL_Document_parse_checked;
+    use crate::document::{KDL_Document_free, KDL_Document_parse};
+    use crate::parallel::KDL_Document_parse_parallel;
+    use std::ptr;
+    use std::sync::Barrier;
+
+    const TEXT: &str = "a 1 {\n    b \"two\" c=3\n}\nd\n";
+
+    fn parse_in(arena: &KdlArena) -> *mut KdlDocument {
+        let (mut doc, mut err) = (ptr::null_mut(), ptr::null_mut());
+        let ok =
+            unsafe { KDL_Document_parse_in(arena, TEXT.as_ptr(), TEXT.len(), &mut doc, &mut err) };
+        assert!(ok && err.is_null());
+        doc
+    }
+
+    fn recorded(doc: *const KdlDocument) -> bool {
+        shard(doc as usize).contains_key(&(doc as usize))
+    }
+
+    #[test]
+    fn parse_in_an_arena_free_it_and_parse_again() {
+        let arena = KDL_Arena_new();
+        let first = parse_in(&arena);
+        assert!(recorded(first));
+        // The arena goes without its document being freed.
+        drop(arena);
+        assert!(!recorded(first));
+
+        // Recording these must not touch memory the arena held.
+        let (mut doc, mut err) = (ptr::null_mut(), ptr::null_mut());
+        assert!(unsafe { KDL_Document_parse(TEXT.as_ptr(), TEXT.len(), &mut doc, &mut err) });
+        let stats = KDL_Document_stats(unsafe { &*doc });
+        assert_eq!((stats.nodes, stats.entries), (3, 3));
+        assert!(stats.timing.total_ns > 0);
+        unsafe { KDL_Document_free(doc) };
+
+        // A later arena reuses the memory, without inheriting what was
+        // recorded about the documents that were in it.
+        let arena = KDL_Arena_new();
+        let stale = arena.scope(|| Box::into_raw(Box::new(KdlDocument::new())));
+        assert!(!recorded(stale));
+        let second = parse_in(&arena);
+        assert!(recorded(second));
+        assert_eq!(KDL_Document_stats(unsafe { &*second }).nodes, 3);
+        drop(arena);
+        assert!(!recorded(second));
+    }
+
+    #[test]
+    fn every_parse_building_a_document_records_it() {
+        let (mut parallel, mut checked, mut err) =
+            (ptr::null_mut(), ptr::null_mut(), ptr::null_mut());
+        assert!(unsafe {
+            KDL_Document_parse_parallel(TEXT.as_ptr(), TEXT.len(), &mut parallel, &mut err, 4)
+        });
+        assert!(unsafe {
+            KDL_Document_parse_checked(TEXT.as_ptr(), TEXT.len(), &mut checked, None)
+        });
+
+        let strings = [TEXT.as_ptr(); 4];
+        let lengths = [TEXT.len(); 4];
+        let (mut docs, mut errs) = ([ptr::null_mut(); 4], [ptr::null_mut(); 4]);
+        let failed = unsafe {
+            KDL_Document_parse_many(
+                4,
+                strings.as_ptr(),
+                lengths.as_ptr(),
+                docs.as_mut_ptr(),
+                errs.as_mut_ptr(),
+                2,
+            )
+        };
+        assert_eq!(failed, 0);
+        for doc in [parallel, checked].into_iter().chain(docs) {
+            assert!(recorded(doc));
+            let stats = KDL_Document_stats(unsafe { &*doc });
+            assert!(stats.heap_bytes > 0 && stats.timing.total_ns > 0);
+            unsafe { KDL_Document_free(doc) };
+        }
+    }
+
+    #[test]
+    fn workers_heap_counts_as_the_recording_threads() {
+        const SIZE: usize = 1 << 16;
+        let kept = Mutex::new(Vec::new());
+        // Each of the four threads takes one index, and keeps what it allocates.
+        let all = Barrier::new(4);
+        let doc = record::<_, KdlError>(0, Default::default(), |_| {
+            for_each_index(4, 4, |_| {
+                all.wait();
+                kept.lock().unwrap().push(vec![0u8; SIZE]);
+            });
+            Ok(KdlDocument::new())
+        })
+        .unwrap();
+        let doc = Box::into_raw(doc);
+        assert!(KDL_Document_stats(unsafe { &*doc }).heap_bytes >= 4 * SIZE);
+        unsafe { KDL_Document_free(doc) };
+    }
+}
@@ -0,0 +1,83 @@
+use std::collections::HashMap;
+use std::hash::{BuildHasherDefault, Hasher};
+
+/// An interned name. Symbols are numbered from 1, so 0 never names anything.
+pub type KdlSymbol = u32;
+
+/// Hashes symbols, which are small consecutive integers, with one multiply.
+#[derive(Default)]
+pub(crate) struct SymbolHasher(u64);
+
+impl Hasher for SymbolHasher {
+    fn write(&mut self, bytes: &[u8]) {
+        for &b in bytes {
+            self.write_u32(self.0 as u32 ^ b as u32);
+        }
+    }
+
+    fn write_u32(&mut self, n: u32) {
+        self.0 = (n as u64).wrapping_mul(0x9E37_79B9_7F4A_7C15);
+    }
+
+    fn finish(&self) -> u64 {
+        self.0
+    }
+}
+
+pub(crate) type SymbolMap<V> = HashMap<KdlSymbol, V, BuildHasherDefault<SymbolHasher>>;
+
+/// Hashes addresses with one multiply. Their low bits are alignment and
+/// always zero, so the well-mixed high half of the product is rotated down.
+#[derive(Default)]
+pub(crate) struct AddressHasher(u64);
+
+impl Hasher for AddressHasher {
+    fn write(&mut self, bytes: &[u8]) {
+        for &b in bytes {
+            self.write_usize(self.0 as usize ^ b as usize);
+        }
+    }
+
+    fn write_usize(&mut self, n: usize) {
+        self.0 = (n as u64)
+            .wrapping_mul(0x9E37_79B9_7F4A_7C15)
+            .rotate_left(32);
+    }
+
+    fn finish(&self) -> u64 {
+        self.0
+    }
+}
+
+pub(crate) type AddressMap<K, V> = HashMap<*const K, V, BuildHasherDefault<AddressHasher>>;
+
+/// Interned names, borrowed from the document they were found in. A table
+/// is filled while its owner is built and only read afterwards, so lookups
+/// need no lock, and it goes away with its owner.
+#[derive(Default)]
+pub(crate) struct Table<'a> {
+    ids: HashMap<&'a str, KdlSymbol>,
+    names: Vec<&'a str>,
+}
+
+impl<'a> Table<'a> {
+    pub(crate) fn intern(&mut self, name: &'a str) -> KdlSymbol {
+        if let Some(&id) = self.ids.get(name) {
+            return id;
+        }
+        self.names.push(name);
+        let id = self.names.len() as KdlSymbol;
+        self.ids.insert(name, id);
+        id
+    }
+
+    /// The symbol for `name`, if it was interned.
+    pub(crate) fn find(&self, name: &str) -> Option<KdlSymbol> {
+        self.ids.get(name).copied()
+    }
+
+    pub(crate) fn name(&self, symbol: KdlSymbol) -> Option<&'a str> {
+        let index = (symbol as usize).checked_sub(1)?;
+        self.names.get(index).copied()
+    }
+}
@@ -0,0 +1,237 @@
+use crate::events;
+use crate::file::invalid_utf8;
+use kdl::*;
+use std::{ptr, slice, str};
+
+/// Checks that `bytes` is a valid document without building it.
+///
+/// The event parser does the checking with nothing listening. Only when it
+/// rejects the input does the full parser run, so that the error is exactly
+/// the one `KDL_Document_parse` would give.
+pub(crate) fn validate(bytes: &[u8]) -> Result<(), KdlError> {
+    let s = str::from_utf8(bytes).map_err(|err| invalid_utf8(bytes, err))?;
+    match events::parse(s, &mut ()) {
+        Ok(()) => Ok(()),
+        Err(_) => s.parse::<KdlDocument>().map(|_| ()),
+    }
+}
+
+#[no_mangle]
+pub unsafe extern "C" fn KDL_Document_validate(
+    s: *const u8,
+    len: usize,
+    errptr: &mut *mut KdlError,
+) -> bool {
+    let bytes = if len == 0 {
+        &[]
+    } else {
+        slice::from_raw_parts(s, len)
+    };
+    match validate(bytes) {
+        Ok(()) => {
+            *errptr = ptr::null_mut();
+            true
+        }
+        Err(err) => {
+            *errptr = Box::into_raw(Box::new(err));
+            false
+        }
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::events::{tests as corpus, Stop};
+
+    /// Cases named after those in the kdl-org (v1) test suite, which is not
+    /// vendored here, with what a parser is expected to make of each.
+    const SUITE: &[(&str, &str)] = &[
+        ("all_escapes", r#"node "\"\\\/\b\f\n\r\t""#),
+        (
+            "all_node_fields",
+            "node \"arg\" prop=\"value\" {\n    inner_node\n}\n",
+        ),
+        ("arg_and_prop_same_name", "node \"arg\" arg=\"val\"\n"),
+        ("arg_false_type", "node (type)false\n"),
+        ("arg_float_type", "node (type)2.5\n"),
+        ("arg_hex_type", "node (type)0x10\n"),
+        ("arg_null_type", "node (type)null\n"),
+        ("arg_raw_string_type", "node (type)r\"str\"\n"),
+        ("asterisk_in_block_comment", "node /* * */\n"),
+        ("bare_emoji", "😁 \"happy!\"\n"),
+        ("binary_underscore", "node 0b1_0\n"),
+        ("blank_arg_type", "node (\"\")10\n"),
+        ("blank_node_type", "(\"\")node\n"),
+        ("block_comment_before_node_no_space", "/* hey*/node\n"),
+        ("block_comment_newline", "/* hey */\n"),
+        ("boolean_prop", "node prop1=true prop2=false\n"),
+        ("commented_child", "node \"arg\" /- {\n    inner_node\n}\n"),
+        ("commented_line", "// node_1\nnode_2\n"),
+        ("commented_node", "/- node_1\nnode_2\n"),
+        ("crlf_between_nodes", "node1\r\nnode2\r\n"),
+        ("empty_child_same_line", "node {}\n"),
+        ("empty_quoted_prop_key", "node \"\"=\"empty\"\n"),
+        ("esc_unicode_in_string", "node \"hello\\u{0a}world\"\n"),
+        (
+            "escline_line_comment",
+            "node \\   // comment\n    \"arg\" \\// comment\n    \"arg2\"\n",
+        ),
+        ("false_prefix_in_bare_id", "false_id\n"),
+        ("hex", "node 0xabcdef1234567\n"),
+        ("just_space", "   "),
+        ("leading_zero_binary", "node 0b01\n"),
+        ("multiline_comment", "node /*\nsome\ncomments\n*/ \"arg\"\n"),
+        ("negative_exponent", "node 1.0e-10\n"),
+        ("nested_comments", "node /*/* nested */*/ \"arg\"\n"),
+        ("octal", "node 0o76543210\n"),
+        ("quoted_node_name", "\"0node\"\n"),
+        ("raw_string_hash_no_esc", "node r#\"\\\"#\"#\n"),
+        ("raw_string_just_backslash", "node r\"\\\"\n"),
+        ("semicolon_after_child", "node {\n    childnode\n};\n"),
+        ("semicolon_separated", "node1;node2\n"),
+        (
+            "slashdash_arg_after_newline_esc",
+            "node \\\n    /- \"arg\" \"arg2\"\n",
+        ),
+        ("slashdash_negative_number", "node /--1.0 2.0\n"),
+        ("slashdash_only_node", "/-node\n"),
+        ("tab_space", "node\t\n"),
+        ("trailing_crlf", "node\r\n"),
+        ("underscore_in_fraction", "node 1.0_2\n"),
+        ("zero_arg", "node 0\n"),
+        // Rejected.
+        ("bare_arg", "node a\n"),
+        ("brackets_in_bare_id", "foo123[bar]foo \"weeee\"\n"),
+        ("chevrons_in_bare_id", "foo123<bar>foo \"weeee\"\n"),
+        ("comma_in_bare_id", "foo123,bar \"weeee\"\n"),
+        ("comment_in_arg_type", "node (type/**/)10\n"),
+        ("dot_zero", "node .0\n"),
+        ("empty_arg_type", "node ()10\n"),
+        ("illegal_char_in_binary", "node 0bx01\n"),
+        ("illegal_char_in_hex", "node 0x10g10\n"),
+        ("multiple_dots_in_float", "node 1.1.1\n"),
+        ("multiple_x_in_hex", "node 0xx10\n"),
+        ("no_digits_in_hex", "node 0x\n"),
+        ("null_node", "null\n"),
+        ("parens_in_bare_id", "foo123(bar)foo \"weeee\"\n"),
+        ("quote_in_bare_id", "foo123\"bar \"weeee\"\n"),
+        ("type_before_prop_key", "node (type)key=10\n"),
+        ("unbalanced_raw_hashes", "node r##\"foo\"#\n"),
+        ("underscore_at_start_of_hex", "node 0x_10\n"),
+    ];
+
+    /// Cases from the kdl-org (v1) test suite that have no expected output,
+    /// which every parser must reject. Validation passes whatever the event
+    /// parser accepts, so each is checked against it directly.
+    const MUST_REJECT: &[(&str, &str)] = &[
+        ("backslash_in_bare_id", "foo123\\bar \"weeee\"\n"),
+        ("bare_arg", "node a\n"),
+        ("brackets_in_bare_id", "foo123[bar]foo \"weeee\"\n"),
+        ("chevrons_in_bare_id", "foo123<bar>foo \"weeee\"\n"),
+        ("comma_in_bare_id", "foo123,bar \"weeee\"\n"),
+        ("comment_after_arg_type", "node (type)/* hey */10\n"),
+        ("comment_after_node_type", "(type)/* hey */node\n"),
+        ("comment_after_prop_type", "node key=(type)/* hey */10\n"),
+        ("comment_in_arg_type", "node (type/* hey */)10\n"),
+        ("comment_in_node_type", "(type/* hey */)node\n"),
+        ("comment_in_prop_type", "node key=(type/* hey */)10\n"),
+        ("dot_but_no_fraction", "node 1.\n"),
+        ("dot_but_no_fraction_before_exponent", "node 1.e7\n"),
+        ("dot_zero", "node .0\n"),
+        ("empty_arg_type", "node ()10\n"),
+        ("empty_node_type", "()node\n"),
+        ("empty_prop_type", "node key=()10\n"),
+        ("escline_not_at_line_end", "node \\ \"arg\"\n"),
+        ("escline_after_children", "node {} \\\nother\n"),
+        ("entry_after_children_escline", "node {} \\\n    \"arg\"\n"),
+        ("false_prop_key", "node false=1\n"),
+        ("illegal_char_in_binary", "node 0bx01\n"),
+        ("illegal_char_in_hex", "node 0x10g10\n"),
+        ("illegal_char_in_octal", "node 0o1234567890\n"),
+        ("just_space_in_arg_type", "node ( )false\n"),
+        ("just_space_in_node_type", "( )node\n"),
+        ("just_space_in_prop_type", "node key=( )0x10\n"),
+        ("just_type_no_arg", "node (type)\n"),
+        ("just_type_no_node_id", "(type)\n"),
+        ("just_type_no_prop", "node key=(type)\n"),
+        ("multiple_dots_in_float", "node 1.1.1\n"),
+        ("multiple_dots_in_float_before_exponent", "node 1.1.1e7\n"),
+        ("multiple_es_in_float", "node 1.0E10e10\n"),
+        ("multiple_x_in_hex", "node 0xx10\n"),
+        ("no_digits_in_hex", "node 0x\n"),
+        ("null_node", "null\n"),
+        ("null_prop_key", "node null=1\n"),
+        ("parens_in_bare_id", "foo123(bar)foo \"weeee\"\n"),
+        ("question_mark_before_number", "node ?15\n"),
+        ("quote_in_bare_id", "foo123\"bar \"weeee\"\n"),
+        ("slash_in_bare_id", "foo123/bar \"weeee\"\n"),
+        ("space_after_arg_type", "node (type) 10\n"),
+        ("space_after_node_type", "(type) node\n"),
+        ("space_after_prop_type", "node key=(type) false\n"),
+        ("space_in_arg_type", "node (type )false\n"),
+        ("space_in_node_type", "( type)node\n"),
+        ("space_in_prop_type", "node key=(type )false\n"),
+        ("true_prop_key", "node true=1\n"),
+        ("type_before_prop_key", "node (type)key=10\n"),
+        ("unbalanced_raw_hashes", "node r##\"foo\"#\n"),
+        ("underscore_at_start_of_fraction", "node 1._7\n"),
+        ("underscore_at_start_of_hex", "node 0x_10\n"),
+        ("underscore_before_number", "node _15\n"),
+        ("unclosed_children", "node {\n    child\n"),
+        ("unclosed_comment", "node /* hey\n"),
+        ("unclosed_raw_string", "node r#\"foo\"\n"),
+        ("unclosed_string", "node \"foo\n"),
+        ("unopened_children", "node\n}\n"),
+    ];
+
+    #[test]
+    fn invalid_suite_cases_are_rejected() {
+        let mut accepted = Vec::new();
+        for (name, input) in MUST_REJECT {
+            if events::parse(input, &mut ()).is_ok() {
+                accepted.push(format!("{name}: the event parser accepts {input:?}"));
+            }
+            if validate(input.as_bytes()).is_ok() {
+                accepted.push(format!("{name}: validation accepts {input:?}"));
+            }
+        }
+        assert!(accepted.is_empty(), "{}", accepted.join("\n"));
+    }
+
+    /// Where each parser rejects `input`, if it does.
+    fn outcomes(input: &str) -> (Result<(), usize>, Result<(), usize>) {
+        let events = match events::parse(input, &mut ()) {
+            Ok(()) => Ok(()),
+            Err(Stop::Error(diag)) => Err(diag.offset),
+            Err(_) => panic!("{input:?}: the event parser stopped short"),
+        };
+        let full = input
+            .parse::<KdlDocument>()
+            .map(|_| ())
+            .map_err(|err| err.span.offset());
+        (events, full)
+    }
+
+    #[test]
+    fn the_event_parser_agrees_with_the_full_parser() {
+        let corpus = corpus::VALID.iter().chain(corpus::INVALID);
+        let suite = SUITE.iter().map(|(_, input)| input);
+        let mut disagreements = Vec::new();
+        for input in corpus.chain(suite) {
+            let (events, full) = outcomes(input);
+            if events != full {
+                disagreements.push(format!("{input:?}: events {events:?}, kdl {full:?}"));
+            }
+        }
+        assert!(disagreements.is_empty(), "{}", disagreements.join("\n"));
+    }
+
+    #[test]
+    fn validation_reports_the_full_parser_error() {
+        for (_, input) in SUITE {
+            let full = input.parse::<KdlDocument>().map(|_| ());
+            assert_eq!(validate(input.as_bytes()), full, "{input:?}");
+        }
+    }
+}
@@ -2,6 +2,7 @@ use kdl::*;
 use std::ptr;
 
 #[repr(C)]
+#[derive(Clone, Copy)]
 pub enum KdlValueWhich {
     Null = 0x00,
     RawString = 0x10,
@@ -86,6 +87,10 @@ pub extern "C" fn KDL_Value_null(value: &KdlValue) -> bool {
 
 #[no_mangle]
 pub extern "C" fn KDL_Value_which(value: &KdlValue) -> KdlValueWhich {
+    which(value)
+}
+
+pub(crate) fn which(value: &KdlValue) -> KdlValueWhich {
     match value {
         KdlValue::RawString(_) => KdlValueWhich::RawString,
         KdlValue::String(_) => KdlValueWhich::String,
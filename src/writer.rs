@@ -0,0 +1,734 @@
+use crate::events::is_ident_char;
+use crate::flat::{KdlFlatPayload, KdlFlatString};
+use crate::value::KdlValueWhich;
+use kdl::*;
+use std::ffi::c_void;
+use std::fmt::{self, Write as _};
+use std::io::Write as _;
+use std::slice;
+
+/// Buffered output is handed to a sink once it grows past this.
+const FLUSH_THRESHOLD: usize = 64 * 1024;
+const INDENT: &[u8] = b"    ";
+
+/// Destination for a writer's output.
+#[repr(C)]
+pub struct KdlWriteSink {
+    user: *mut c_void,
+    write: Option<unsafe extern "C" fn(*mut c_void, *const u8, usize) -> bool>,
+}
+
+#[derive(Clone, Copy, PartialEq, Eq)]
+enum State {
+    /// Between nodes.
+    Nodes,
+    /// After a node's name, taking entries.
+    Header,
+    /// After a node's children block.
+    AfterChildren,
+}
+
+/// Streams KDL text, checking only that calls nest properly.
+pub struct KdlWriter {
+    buf: Vec<u8>,
+    sink: Option<KdlWriteSink>,
+    state: State,
+    depth: usize,
+    failed: bool,
+}
+
+fn needs_quotes(s: &str) -> bool {
+    let mut chars = s.chars();
+    let bare = match chars.next() {
+        None => false,
+        Some(c @ ('-' | '+')) => {
+            is_ident_char(c) && !chars.next().map_or(false, |c| c.is_ascii_digit())
+        }
+        Some(c) => is_ident_char(c) && !c.is_ascii_digit(),
+    };
+    !bare
+        || matches!(s, "true" | "false" | "null")
+        || s.chars().any(|c| !is_ident_char(c) || c.is_control())
+}
+
+fn push_string(buf: &mut Vec<u8>, s: &str) {
+    buf.reserve(s.len() + 2);
+    buf.push(b'"');
+    let bytes = s.as_bytes();
+    let mut start = 0;
+    for (i, &b) in bytes.iter().enumerate() {
+        let escape: &[u8] = match b {
+            b'"' => b"\\\"",
+            b'\\' => b"\\\\",
+            b'\n' => b"\\n",
+            b'\r' => b"\\r",
+            b'\t' => b"\\t",
+            0x08 => b"\\b",
+            0x0C => b"\\f",
+            0x00..=0x1F | 0x7F => b"",
+            _ => continue,
+        };
+        buf.extend_from_slice(&bytes[start..i]);
+        if escape.is_empty() {
+            let _ = write!(buf, "\\u{{{:x}}}", b);
+        } else {
+            buf.extend_from_slice(escape);
+        }
+        start = i + 1;
+    }
+    buf.extend_from_slice(&bytes[start..]);
+    buf.push(b'"');
+}
+
+fn push_raw_string(buf: &mut Vec<u8>, s: &str) {
+    // Enough hashes that no quote in `s` is followed by as many.
+    let bytes = s.as_bytes();
+    let hashes = bytes
+        .iter()
+        .enumerate()
+        .filter(|&(_, &b)| b == b'"')
+        .map(|(i, _)| 1 + bytes[i + 1..].iter().take_while(|&&b| b == b'#').count())
+        .max()
+        .unwrap_or(0);
+    buf.reserve(s.len() + 3 + 2 * hashes);
+    buf.push(b'r');
+    buf.extend(std::iter::repeat(b'#').take(hashes));
+    buf.push(b'"');
+    buf.extend_from_slice(bytes);
+    buf.push(b'"');
+    buf.extend(std::iter::repeat(b'#').take(hashes));
+}
+
+pub(crate) fn push_ident(buf: &mut Vec<u8>, s: &str) {
+    if needs_quotes(s) {
+        push_string(buf, s);
+    } else {
+        buf.extend_from_slice(s.as_bytes());
+    }
+}
+
+const DIGIT_PAIRS: &[u8; 200] = b"\
+    0001020304050607080910111213141516171819\
+    2021222324252627282930313233343536373839\
+    4041424344454647484950515253545556575859\
+    6061626364656667686970717273747576777879\
+    8081828384858687888990919293949596979899";
+
+fn push_int(buf: &mut Vec<u8>, i: i64, which: KdlValueWhich) {
+    let (prefix, radix): (&[u8], u64) = match which {
+        // Other radixes are read as a magnitude that must fit in an i64
+        // before the sign applies, which this one's does not.
+        _ if i == i64::MIN => (b"", 10),
+        KdlValueWhich::Base2 => (b"0b", 2),
+        KdlValueWhich::Base8 => (b"0o", 8),
+        KdlValueWhich::Base16 => (b"0x", 16),
+        _ => (b"", 10),
+    };
+    if i < 0 {
+        buf.push(b'-');
+    }
+    buf.extend_from_slice(prefix);
+    let mut n = i.unsigned_abs();
+    let mut digits = [0u8; 64];
+    let mut at = digits.len();
+    if radix == 10 {
+        while n >= 100 {
+            let pair = (n % 100) as usize * 2;
+            n /= 100;
+            at -= 2;
+            digits[at..at + 2].copy_from_slice(&DIGIT_PAIRS[pair..pair + 2]);
+        }
+        if n >= 10 {
+            let pair = n as usize * 2;
+            at -= 2;
+            digits[at..at + 2].copy_from_slice(&DIGIT_PAIRS[pair..pair + 2]);
+        } else {
+            at -= 1;
+            digits[at] = b'0' + n as u8;
+        }
+    } else {
+        loop {
+            at -= 1;
+            digits[at] = b"0123456789abcdef"[(n % radix) as usize];
+            n /= radix;
+            if n == 0 {
+                break;
+            }
+        }
+    }
+    buf.extend_from_slice(&digits[at..]);
+}
+
+impl KdlWriter {
+    fn new(sink: Option<KdlWriteSink>) -> Self {
+        KdlWriter {
+            buf: Vec::new(),
+            sink,
+            state: State::Nodes,
+            depth: 0,
+            failed: false,
+        }
+    }
+
+    /// Checks that a call is valid in the current state, and fails the writer otherwise.
+    fn expect(&mut self, ok: bool) -> bool {
+        self.failed |= !ok;
+        ok && !self.failed
+    }
+
+    fn indent(&mut self) {
+        for _ in 0..self.depth {
+            self.buf.extend_from_slice(INDENT);
+        }
+    }
+
+    fn flush(&mut self) {
+        let Some(KdlWriteSink {
+            user,
+            write: Some(write),
+        }) = self.sink
+        else {
+            return;
+        };
+        if !self.buf.is_empty() {
+            self.failed |= !unsafe { write(user, self.buf.as_ptr(), self.buf.len()) };
+            self.buf.clear();
+        }
+    }
+
+    pub(crate) fn node_begin(&mut self, name: &str, ty: Option<&str>) {
+        if !self.expect(self.state == State::Nodes) {
+            return;
+        }
+        self.indent();
+        if let Some(ty) = ty {
+            self.buf.push(b'(');
+            push_ident(&mut self.buf, ty);
+            self.buf.push(b')');
+        }
+        push_ident(&mut self.buf, name);
+        self.state = State::Header;
+    }
+
+    pub(crate) fn entry(
+        &mut self,
+        name: Option<&str>,
+        ty: Option<&str>,
+        which: KdlValueWhich,
+        value: KdlFlatPayload,
+    ) {
+        // KDL has no spelling for non-finite floats.
+        let finite =
+            !matches!(which, KdlValueWhich::Base10Float) || unsafe { value.floating.is_finite() };
+        if !self.expect(self.state == State::Header && finite) {
+            return;
+        }
+        self.buf.push(b' ');
+        if let Some(name) = name {
+            push_ident(&mut self.buf, name);
+            self.buf.push(b'=');
+        }
+        if let Some(ty) = ty {
+            self.buf.push(b'(');
+            push_ident(&mut self.buf, ty);
+            self.buf.push(b')');
+        }
+        unsafe {
+            match which {
+                KdlValueWhich::Null => self.buf.extend_from_slice(b"null"),
+                KdlValueWhich::String => {
+                    push_string(&mut self.buf, value.string.as_str().unwrap_or(""))
+                }
+                KdlValueWhich::RawString => {
+                    push_raw_string(&mut self.buf, value.string.as_str().unwrap_or(""))
+                }
+                KdlValueWhich::Base2
+                | KdlValueWhich::Base8
+                | KdlValueWhich::Base10
+                | KdlValueWhich::Base16 => push_int(&mut self.buf, value.integer, which),
+                KdlValueWhich::Base10Float => {
+                    // Debug is the shortest representation that round-trips, always with a `.` or exponent.
+                    let _ = write!(self.buf, "{:?}", value.floating);
+                }
+                KdlValueWhich::Bool => {
+                    let literal: &[u8] = if value.boolean { b"true" } else { b"false" };
+                    self.buf.extend_from_slice(literal);
+                }
+            }
+        }
+    }
+
+    pub(crate) fn children_begin(&mut self) {
+        if !self.expect(self.state == State::Header) {
+            return;
+        }
+        self.buf.extend_from_slice(b" {\n");
+        self.depth += 1;
+        self.state = State::Nodes;
+    }
+
+    pub(crate) fn children_end(&mut self) {
+        if !self.expect(self.state == State::Nodes && self.depth > 0) {
+            return;
+        }
+        self.depth -= 1;
+        self.indent();
+        self.buf.push(b'}');
+        self.state = State::AfterChildren;
+    }
+
+    pub(crate) fn node_end(&mut self) {
+        if !self.expect(self.state != State::Nodes) {
+            return;
+        }
+        self.buf.push(b'\n');
+        self.state = State::Nodes;
+        if self.buf.len() >= FLUSH_THRESHOLD {
+            self.flush();
+        }
+    }
+
+    fn finish(&mut self) -> bool {
+        self.expect(self.state == State::Nodes && self.depth == 0);
+        self.flush();
+        !self.failed
+    }
+}
+
+fn which(which: u8) -> Option<KdlValueWhich> {
+    Some(match which {
+        0x00 => KdlValueWhich::Null,
+        0x10 => KdlValueWhich::RawString,
+        0x11 => KdlValueWhich::String,
+        0x20 => KdlValueWhich::Base2,
+        0x21 => KdlValueWhich::Base8,
+        0x22 => KdlValueWhich::Base10,
+        0x23 => KdlValueWhich::Base16,
+        0x40 => KdlValueWhich::Base10Float,
+        0x80 => KdlValueWhich::Bool,
+        _ => return None,
+    })
+}
+
+#[no_mangle]
+pub extern "C" fn KDL_Writer_new() -> Box<KdlWriter> {
+    Box::new(KdlWriter::new(None))
+}
+
+#[no_mangle]
+pub extern "C" fn KDL_Writer_new_sink(sink: KdlWriteSink) -> Box<KdlWriter> {
+    Box::new(KdlWriter::new(Some(sink)))
+}
+
+#[no_mangle]
+pub extern "C" fn KDL_Writer_free(_writer: Box<KdlWriter>) {}
+
+#[no_mangle]
+pub unsafe extern "C" fn KDL_Writer_node_begin(
+    writer: &mut KdlWriter,
+    name: KdlFlatString,
+    ty: KdlFlatString,
+) {
+    writer.node_begin(name.as_str().unwrap_or(""), ty.as_str());
+}
+
+#[no_mangle]
+pub unsafe extern "C" fn KDL_Writer_entry(
+    writer: &mut KdlWriter,
+    name: KdlFlatString,
+    ty: KdlFlatString,
+    which: u8,
+    value: KdlFlatPayload,
+) {
+    match self::which(which) {
+        Some(which) => writer.entry(name.as_str(), ty.as_str(), which, value),
+        None => writer.failed = true,
+    }
+}
+
+#[no_mangle]
+pub extern "C" fn KDL_Writer_children_begin(writer: &mut KdlWriter) {
+    writer.children_begin();
+}
+
+#[no_mangle]
+pub extern "C" fn KDL_Writer_children_end(writer: &mut KdlWriter) {
+    writer.children_end();
+}
+
+#[no_mangle]
+pub extern "C" fn KDL_Writer_node_end(writer: &mut KdlWriter) {
+    writer.node_end();
+}
+
+#[no_mangle]
+pub extern "C" fn KDL_Writer_data(writer: &KdlWriter, len: &mut usize) -> *const u8 {
+    *len = writer.buf.len();
+    writer.buf.as_ptr()
+}
+
+#[no_mangle]
+pub extern "C" fn KDL_Writer_clear(writer: &mut KdlWriter) {
+    writer.buf.clear();
+    writer.state = State::Nodes;
+    writer.depth = 0;
+    writer.failed = false;
+}
+
+#[no_mangle]
+pub extern "C" fn KDL_Writer_finish(writer: &mut KdlWriter) -> bool {
+    writer.finish()
+}
+
+/// Writes into a fixed buffer, counting what does not fit.
+struct Truncating<'a> {
+    buf: &'a mut [u8],
+    len: usize,
+}
+
+impl fmt::Write for Truncating<'_> {
+    fn write_str(&mut self, s: &str) -> fmt::Result {
+        if let Some(rest) = self.buf.get_mut(self.len..) {
+            let n = rest.len().min(s.len());
+            rest[..n].copy_from_slice(&s.as_bytes()[..n]);
+        }
+        self.len += s.len();
+        Ok(())
+    }
+}
+
+#[no_mangle]
+pub unsafe extern "C" fn KDL_Document_write(
+    doc: &KdlDocument,
+    buf: *mut u8,
+    capacity: usize,
+) -> usize {
+    let buf = if capacity == 0 {
+        &mut []
+    } else {
+        slice::from_raw_parts_mut(buf, capacity)
+    };
+    let mut out = Truncating { buf, len: 0 };
+    let _ = write!(out, "{}", doc);
+    out.len
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn string(s: &str) -> KdlFlatPayload {
+        KdlFlatPayload {
+            string: KdlFlatString::new(s),
+        }
+    }
+
+    fn int(i: i64) -> KdlFlatPayload {
+        KdlFlatPayload { integer: i }
+    }
+
+    /// Writes one node per value, each holding it as an argument.
+    fn write(values: &[(KdlValueWhich, KdlFlatPayload)]) -> String {
+        let mut writer = KdlWriter::new(None);
+        for &(which, value) in values {
+            writer.node_begin("n", None);
+            writer.entry(None, None, which, value);
+            writer.node_end();
+        }
+        assert!(writer.finish());
+        String::from_utf8(writer.buf).unwrap()
+    }
+
+    /// Each node's first argument, as parsed back.
+    fn read(text: &str) -> Vec<KdlValue> {
+        let doc: KdlDocument = text.parse().unwrap_or_else(|e| panic!("{text:?}: {e:?}"));
+        doc.nodes()
+            .iter()
+            .map(|node| node.entries()[0].value().clone())
+            .collect()
+    }
+
+    #[test]
+    fn identifiers_are_quoted_when_needed() {
+        let names = [
+            "plain", "", "1st", "-1", "+2", "-", "-x", "+", "true", "false", "null", "a b", "a=b",
+            "a\"b", "a/b", "(t)", "a\u{7}b", "ünï", "truth",
+        ];
+        let mut writer = KdlWriter::new(None);
+        for name in names {
+            writer.node_begin(name, Some(name));
+            writer.entry(Some(name), Some(name), KdlValueWhich::Null, int(0));
+            writer.node_end();
+        }
+        assert!(writer.finish());
+        let text = String::from_utf8(writer.buf).unwrap();
+        let doc: KdlDocument = text.parse().unwrap_or_else(|e| panic!("{text:?}: {e:?}"));
+        for (node, name) in doc.nodes().iter().zip(names) {
+            assert_eq!(node.name().value(), name);
+            assert_eq!(node.ty().unwrap().value(), name);
+            let entry = &node.entries()[0];
+            assert_eq!(entry.name().unwrap().value(), name);
+            assert_eq!(entry.ty().unwrap().value(), name);
+        }
+        assert!(text.starts_with("(plain)plain plain=(plain)null\n(\"\")\"\" "));
+        assert!(text.contains("\n(\"-1\")\"-1\" "));
+        assert!(text.contains("\n(-)- -=(-)null\n"));
+        assert!(text.contains("\n(truth)truth "));
+    }
+
+    #[test]
+    fn strings_round_trip() {
+        let strings = [
+            "",
+            "plain",
+            "quote \" and \\ backslash",
+            "\n\r\t\u{8}\u{c}",
+            "\u{0}\u{1}\u{1f}\u{7f}",
+            "ünïcödé \u{2028} 🦀",
+        ];
+        let values: Vec<_> = strings
+            .iter()
+            .flat_map(|s| {
+                [
+                    (KdlValueWhich::String, string(s)),
+                    (KdlValueWhich::RawString, string(s)),
+                ]
+            })
+            .collect();
+        let text = write(&values);
+        assert!(text.contains(r#""\u{0}\u{1}\u{1f}\u{7f}""#));
+        let read = read(&text);
+        for (value, s) in read.iter().zip(strings.iter().flat_map(|s| [s, s])) {
+            assert_eq!(value.as_string(), Some(*s));
+        }
+    }
+
+    #[test]
+    fn raw_strings_have_enough_hashes() {
+        let strings = ["no quotes", "a \"quote\"", "\"# \"##", "\"", "#\"#"];
+        let values: Vec<_> = strings
+            .iter()
+            .map(|s| (KdlValueWhich::RawString, string(s)))
+            .collect();
+        let text = write(&values);
+        assert_eq!(
+            text,
+            "n r\"no quotes\"\nn r#\"a \"quote\"\"#\nn r###\"\"# \"##\"###\nn r#\"\"\"#\nn r##\"#\"#\"##\n"
+        );
+        for (value, s) in read(&text).iter().zip(strings) {
+            assert_eq!(value.as_string(), Some(s));
+        }
+    }
+
+    #[test]
+    fn integers_round_trip_in_every_radix() {
+        let radixes = [
+            KdlValueWhich::Base2,
+            KdlValueWhich::Base8,
+            KdlValueWhich::Base10,
+            KdlValueWhich::Base16,
+        ];
+        let ints = [
+            0,
+            1,
+            -1,
+            9,
+            10,
+            99,
+            100,
+            255,
+            -256,
+            i64::MAX,
+            i64::MIN,
+            i64::MIN + 1,
+        ];
+        let values: Vec<_> = radixes
+            .iter()
+            .flat_map(|&which| ints.iter().map(move |&i| (which, int(i))))
+            .collect();
+        let text = write(&values);
+        assert!(text.contains("n -0x7fffffffffffffff\n"));
+        assert!(text.contains(&format!("n -0b{}\n", "1".repeat(63))));
+        assert!(!text.contains("0x8"));
+        for (value, (which, i)) in read(&text).iter().zip(&values) {
+            let i = unsafe { i.integer };
+            let expected = match which {
+                _ if i == i64::MIN => KdlValue::Base10(i),
+                KdlValueWhich::Base2 => KdlValue::Base2(i),
+                KdlValueWhich::Base8 => KdlValue::Base8(i),
+                KdlValueWhich::Base16 => KdlValue::Base16(i),
+                _ => KdlValue::Base10(i),
+            };
+            assert_eq!(*value, expected);
+        }
+    }
+
+    #[test]
+    fn floats_round_trip() {
+        let floats = [
+            0.0,
+            -0.0,
+            1.0,
+            -1.5,
+            0.1,
+            1e300,
+            1e-300,
+            5e-324,
+            f64::MAX,
+            123456.789,
+        ];
+        let values: Vec<_> = floats
+            .iter()
+            .map(|&f| (KdlValueWhich::Base10Float, KdlFlatPayload { floating: f }))
+            .collect();
+        let text = write(&values);
+        for (value, f) in read(&text).iter().zip(floats) {
+            let KdlValue::Base10Float(read) = value else {
+                panic!("{value:?} is not a float");
+            };
+            assert_eq!(read.to_bits(), f.to_bits());
+        }
+        // Non-finite floats cannot be written.
+        let mut writer = KdlWriter::new(None);
+        writer.node_begin("n", None);
+        writer.entry(
+            None,
+            None,
+            KdlValueWhich::Base10Float,
+            KdlFlatPayload { floating: f64::NAN },
+        );
+        writer.node_end();
+        assert!(!writer.finish());
+    }
+
+    #[test]
+    fn other_values_round_trip() {
+        let values = [
+            (KdlValueWhich::Null, int(0)),
+            (KdlValueWhich::Bool, KdlFlatPayload { boolean: true }),
+            (KdlValueWhich::Bool, KdlFlatPayload { boolean: false }),
+        ];
+        let read = read(&write(&values));
+        assert_eq!(
+            read,
+            [KdlValue::Null, KdlValue::Bool(true), KdlValue::Bool(false)]
+        );
+    }
+
+    #[test]
+    fn children_are_nested_and_indented() {
+        let mut writer = KdlWriter::new(None);
+        writer.node_begin("a", None);
+        writer.entry(Some("k"), None, KdlValueWhich::Base10, int(1));
+        writer.children_begin();
+        writer.node_begin("b", Some("t"));
+        writer.children_begin();
+        writer.node_begin("c", None);
+        writer.node_end();
+        writer.children_end();
+        writer.node_end();
+        writer.children_end();
+        writer.node_end();
+        assert!(writer.finish());
+        assert_eq!(
+            String::from_utf8(writer.buf).unwrap(),
+            "a k=1 {\n    (t)b {\n        c\n    }\n}\n"
+        );
+    }
+
+    #[test]
+    fn misuse_fails_the_writer() {
+        type Step = fn(&mut KdlWriter);
+        let begin: Step = |w| w.node_begin("n", None);
+        let entry: Step = |w| w.entry(None, None, KdlValueWhich::Null, int(0));
+        let children: Step = |w| w.children_begin();
+        let children_end: Step = |w| w.children_end();
+        let end: Step = |w| w.node_end();
+        let cases: &[&[Step]] = &[
+            // An entry or children outside a node.
+            &[entry],
+            &[children],
+            // Ending what was not begun.
+            &[end],
+            &[begin, children_end],
+            &[children_end],
+            // A node inside a node's header, or an entry after its children.
+            &[begin, begin],
+            &[begin, children, children_end, entry],
+            // Left open.
+            &[begin],
+            &[begin, children],
+            &[begin, children, children_end],
+        ];
+        for steps in cases {
+            let mut writer = KdlWriter::new(None);
+            for step in *steps {
+                step(&mut writer);
+            }
+            assert!(!writer.finish());
+            // The failure sticks until cleared.
+            writer.node_begin("n", None);
+            writer.node_end();
+            assert!(!writer.finish());
+            KDL_Writer_clear(&mut writer);
+            writer.node_begin("n", None);
+            writer.node_end();
+            assert!(writer.finish());
+        }
+        let mut writer = KdlWriter::new(None);
+        writer.node_begin("n", None);
+        unsafe {
+            KDL_Writer_entry(
+                &mut writer,
+                KdlFlatString::NONE,
+                KdlFlatString::NONE,
+                0x12,
+                int(0),
+            )
+        };
+        writer.node_end();
+        assert!(!writer.finish());
+    }
+
+    unsafe extern "C" fn collect(user: *mut c_void, data: *const u8, len: usize) -> bool {
+        let (out, calls) = &mut *(user as *mut (Vec<u8>, usize));
+        out.extend_from_slice(slice::from_raw_parts(data, len));
+        *calls += 1;
+        true
+    }
+
+    unsafe extern "C" fn refuse(_user: *mut c_void, _data: *const u8, _len: usize) -> bool {
+        false
+    }
+
+    #[test]
+    fn sinks_get_everything_in_large_pieces() {
+        let mut collected = (Vec::new(), 0);
+        let mut writer = KDL_Writer_new_sink(KdlWriteSink {
+            user: &mut collected as *mut _ as *mut c_void,
+            write: Some(collect),
+        });
+        let long = "x".repeat(1000);
+        for _ in 0..200 {
+            writer.node_begin("n", None);
+            writer.entry(None, None, KdlValueWhich::String, string(&long));
+            writer.node_end();
+        }
+        // Most of it has been handed over already, and the rest is on finishing.
+        assert!(writer.buf.len() < FLUSH_THRESHOLD);
+        assert!(writer.finish());
+        assert!(writer.buf.is_empty());
+        let (out, calls) = collected;
+        assert_eq!(calls, 200 * 1008 / FLUSH_THRESHOLD + 1);
+        assert_eq!(read(str::from_utf8(&out).unwrap()).len(), 200);
+
+        // A sink that refuses fails the writer.
+        let mut writer = KDL_Writer_new_sink(KdlWriteSink {
+            user: std::ptr::null_mut(),
+            write: Some(refuse),
+        });
+        writer.node_begin("n", None);
+        writer.node_end();
+        assert!(!writer.finish());
+    }
+}